@@ -0,0 +1,714 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+/*
+ * rx888_bench - microbenchmarks for the per-sample hot path.
+ *
+ * Every case runs over buffer sizes of reqsize * pktsize bytes for the
+ * request sizes rx888_stream accepts, and reports ns/sample, GB/s of
+ * input and cycles/sample as JSON on stdout, so runs can be diffed:
+ *
+ *   make -s bench > before.json
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "dsp.h"
+#include "kernels.h"
+#include "librx888.h"
+#include "librx888_internal.h"
+
+// wMaxPacketSize 1024 * bMaxBurst 16 on a USB 3 link
+#define PKTSIZE 16384
+#define ROUNDS 10
+#define WRITEV_BATCH 8
+#define URING_DEPTH 8
+
+static const unsigned int reqsizes[] = {1, 4, 8, 16, 32, 64};
+
+static double min_time = 0.5; // seconds per case
+static const char *filter = NULL;
+static const char *write_path = NULL;
+static int results = 0;
+
+static int perf_fd = -1;
+static const char *cycles_source = "none";
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Core cycles from perf when the kernel allows it (kernel time included
+ * if possible, it matters for the writers), else the TSC, else nothing.
+ */
+static void cycles_init(void) {
+    struct perf_event_attr attr;
+
+    for (int user_only = 0; user_only <= 1; user_only++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        attr.exclude_kernel = user_only;
+        attr.exclude_hv = 1;
+        perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (perf_fd >= 0) {
+            cycles_source = user_only ? "cpu_cycles_user" : "cpu_cycles";
+            return;
+        }
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    cycles_source = "tsc";
+#endif
+}
+
+static uint64_t read_cycles(void) {
+    uint64_t count = 0;
+
+    if (perf_fd >= 0) {
+        if (read(perf_fd, &count, sizeof(count)) != sizeof(count))
+            count = 0;
+        return count;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void fill_noise(int16_t *buf, size_t n) {
+    uint32_t x = 2463534242u;
+    for (size_t i = 0; i < n; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        buf[i] = (int16_t)x;
+    }
+}
+
+struct bench_case {
+    const char *group;
+    char name[64];
+    size_t bytes;   // input bytes per call
+    size_t samples; // samples per call, as the kernel counts them
+    void (*fn)(void *arg);
+    void *arg;
+};
+
+/*
+ * Calibrate the call count so a round takes about min_time / ROUNDS,
+ * then keep the fastest of ROUNDS rounds.
+ */
+static void run_case(const struct bench_case *bc) {
+    char full[128];
+    uint64_t iters = 1, best_ns = UINT64_MAX, best_cycles = 0;
+
+    snprintf(full, sizeof(full), "%s/%s", bc->group, bc->name);
+    if (filter && strstr(full, filter) == NULL)
+        return;
+
+    for (;;) {
+        uint64_t t0 = now_ns();
+        for (uint64_t i = 0; i < iters; i++)
+            bc->fn(bc->arg);
+        uint64_t dt = now_ns() - t0;
+        if (dt >= min_time * 1e9 / ROUNDS)
+            break;
+        iters *= dt < 1000 ? 16 : 2;
+    }
+
+    for (int r = 0; r < ROUNDS; r++) {
+        uint64_t c0 = read_cycles();
+        uint64_t t0 = now_ns();
+        for (uint64_t i = 0; i < iters; i++)
+            bc->fn(bc->arg);
+        uint64_t dt = now_ns() - t0;
+        uint64_t dc = read_cycles() - c0;
+        if (dt < best_ns) {
+            best_ns = dt;
+            best_cycles = dc;
+        }
+    }
+
+    double calls = (double)iters;
+    double ns_per_sample = best_ns / (calls * bc->samples);
+    double gbps = calls * bc->bytes / best_ns;
+
+    printf("%s    {\"name\": \"%s\", \"bytes\": %zu, \"samples\": %zu, \"iterations\": %llu, "
+           "\"ns_per_sample\": %.4f, \"gb_per_s\": %.3f, \"cycles_per_sample\": ",
+           results++ ? ",\n" : "", full, bc->bytes, bc->samples,
+           (unsigned long long)iters, ns_per_sample, gbps);
+    if (best_cycles)
+        printf("%.4f}", best_cycles / (calls * bc->samples));
+    else
+        printf("null}");
+    fflush(stdout);
+    fprintf(stderr, "%-32s %8.4f ns/sample %8.3f GB/s\n", full, ns_per_sample, gbps);
+}
+
+// Kernels
+
+struct kernel_arg {
+    int16_t *in;
+    void *out;
+    size_t n;
+    struct ddc *ddc;
+    struct spectrum *sp;
+    kernel_fused_fn fused;
+    rx888_t *dev;
+};
+
+static void bench_derandomize(void *arg) {
+    struct kernel_arg *a = arg;
+    kernel_derandomize(a->in, a->n);
+}
+
+static void bench_s16_to_be16(void *arg) {
+    struct kernel_arg *a = arg;
+    kernel_s16_to_be16(a->in, a->out, a->n);
+}
+
+static void bench_s16_to_f32(void *arg) {
+    struct kernel_arg *a = arg;
+    kernel_s16_to_f32(a->in, a->out, a->n);
+}
+
+static void bench_crc32c(void *arg) {
+    struct kernel_arg *a = arg;
+    *(volatile uint32_t *)a->out = kernel_crc32c(0, a->in, a->n * sizeof(int16_t));
+}
+
+// Derandomize, statistics and CRC as three passes over the buffer ...
+static void bench_separate(void *arg) {
+    struct kernel_arg *a = arg;
+    struct kernel_block_info info;
+    kernel_derandomize(a->in, a->n);
+    kernel_sample_stats(a->in, a->n, &info);
+    info.crc32c = kernel_crc32c(0, a->in, a->n * sizeof(int16_t));
+    *(volatile uint32_t *)a->out = info.crc32c + info.clipped;
+}
+
+// ... and as the one fused pass the library runs
+static void bench_fused(void *arg) {
+    struct kernel_arg *a = arg;
+    struct kernel_block_info info;
+    a->fused(a->in, a->n, &info);
+    *(volatile uint32_t *)a->out = info.crc32c + info.clipped;
+}
+
+// librx888's completion path for one block, with the chain selected at start ...
+static void bench_completion_selected(void *arg) {
+    struct kernel_arg *a = arg;
+    rx888_bench_complete(a->dev, 0);
+}
+
+// ... and with the options tested on every block
+static void bench_completion_checked(void *arg) {
+    struct kernel_arg *a = arg;
+    rx888_bench_complete(a->dev, 1);
+}
+
+/*
+ * A synthetic handle with rx888_stream's defaults, statistics on and pull
+ * mode, and bytes per transfer. Its producer is never started: the bench
+ * completes the transfers itself.
+ */
+static rx888_t *completion_open(size_t bytes) {
+    struct rx888_config cfg;
+    rx888_t *dev = NULL;
+
+    rx888_config_init(&cfg);
+    cfg.synthetic = 1;
+    cfg.pktsize = PKTSIZE;
+    cfg.reqsize = bytes / PKTSIZE;
+    cfg.sample_stats = 1;
+    if (rx888_open(&dev, &cfg) != RX888_OK || rx888_bench_start(dev, NULL, NULL) != RX888_OK) {
+        rx888_close(dev);
+        return NULL;
+    }
+    return dev;
+}
+
+static void bench_cf32_to_cu8(void *arg) {
+    struct kernel_arg *a = arg;
+    dsp_cf32_to_cu8((const float *)a->in, a->out, a->n, 255.0f);
+}
+
+static void bench_ddc(void *arg) {
+    struct kernel_arg *a = arg;
+    ddc_process(a->ddc, a->in, a->n, a->out);
+}
+
+static void bench_spectrum(void *arg) {
+    struct kernel_arg *a = arg;
+    spectrum_process(a->sp, a->in, a->n, a->out, SIZE_MAX);
+}
+
+static void run_kernels(size_t bytes) {
+    size_t n = bytes / sizeof(int16_t);
+    struct kernel_arg a = {.n = n};
+    struct bench_case bc = {.bytes = bytes, .samples = n, .arg = &a};
+    static const unsigned int decims[] = {2, 16, 64};
+    static const unsigned int fft_sizes[] = {1024, 16384};
+
+    a.in = malloc(bytes);
+    a.out = malloc(n * 2 * sizeof(float));
+    if (a.in == NULL || a.out == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    fill_noise(a.in, n);
+    snprintf(bc.name, sizeof(bc.name), "%zu", bytes);
+
+    bc.group = "derandomize";
+    bc.fn = bench_derandomize;
+    run_case(&bc);
+
+    bc.group = "s16_to_be16";
+    bc.fn = bench_s16_to_be16;
+    run_case(&bc);
+
+    bc.group = "s16_to_f32";
+    bc.fn = bench_s16_to_f32;
+    run_case(&bc);
+
+    bc.group = "crc32c";
+    bc.fn = bench_crc32c;
+    run_case(&bc);
+
+    bc.group = "separate_passes";
+    bc.fn = bench_separate;
+    run_case(&bc);
+
+    a.fused = kernel_fused_select(KERNEL_DERANDOMIZE | KERNEL_STATS | KERNEL_CRC32C);
+    bc.group = "fused_pass";
+    bc.fn = bench_fused;
+    run_case(&bc);
+
+    a.dev = completion_open(bytes);
+    if (a.dev) {
+        bc.group = "completion_checked";
+        bc.fn = bench_completion_checked;
+        run_case(&bc);
+
+        bc.group = "completion_selected";
+        bc.fn = bench_completion_selected;
+        run_case(&bc);
+        rx888_close(a.dev);
+    }
+
+    // The rtl_tcp output stage, fed with as many I/Q floats as the buffer holds
+    float *iq = (float *)a.in;
+    for (size_t i = 0; i < bytes / sizeof(float); i++)
+        iq[i] = (i % 7) * 0.1f - 0.3f;
+    bc.group = "cf32_to_cu8";
+    bc.fn = bench_cf32_to_cu8;
+    bc.samples = a.n = bytes / (2 * sizeof(float));
+    run_case(&bc);
+    fill_noise(a.in, n);
+    bc.samples = a.n = n;
+
+    for (size_t i = 0; i < sizeof(decims) / sizeof(decims[0]); i++) {
+        a.ddc = ddc_create(64e6, 10e6, decims[i], n);
+        if (a.ddc == NULL)
+            continue;
+        bc.group = "ddc";
+        snprintf(bc.name, sizeof(bc.name), "decim%u/%zu", decims[i], bytes);
+        bc.fn = bench_ddc;
+        run_case(&bc);
+        ddc_free(a.ddc);
+    }
+
+    // A frame rate of samplerate transforms every input sample
+    for (size_t i = 0; i < sizeof(fft_sizes) / sizeof(fft_sizes[0]); i++) {
+        a.sp = spectrum_create(64e6, fft_sizes[i], 1, 64e6);
+        float *frames = malloc((n / fft_sizes[i] + 1) * (fft_sizes[i] / 2 + 1) * sizeof(float));
+        if (a.sp == NULL || frames == NULL) {
+            spectrum_free(a.sp);
+            free(frames);
+            continue;
+        }
+        void *out = a.out;
+        a.out = frames;
+        bc.group = "spectrum";
+        snprintf(bc.name, sizeof(bc.name), "fft%u/%zu", fft_sizes[i], bytes);
+        bc.fn = bench_spectrum;
+        run_case(&bc);
+        a.out = out;
+        free(frames);
+        spectrum_free(a.sp);
+    }
+
+    free(a.in);
+    free(a.out);
+}
+
+// Output writers
+
+struct writer {
+    int fd;          // destination, a drained pipe or the -w file
+    int is_pipe;
+    int pipe_rd;     // drain side when fd is a pipe
+    int splice_p[2]; // staging pipe for vmsplice into a file
+    pthread_t drain;
+    unsigned char *buf[WRITEV_BATCH];
+    size_t len;
+    off_t off;
+#ifdef HAVE_LIBURING
+    struct io_uring ring;
+    unsigned int uring_inflight;
+#endif
+};
+
+// Stand-in for a fast consumer on the far side of the pipe
+static void *drain_thread(void *arg) {
+    struct writer *w = arg;
+    int devnull = open("/dev/null", O_WRONLY);
+
+    while (splice(w->pipe_rd, NULL, devnull, NULL, 1 << 20, SPLICE_F_MOVE) > 0)
+        ;
+    close(devnull);
+    return NULL;
+}
+
+static void write_all(int fd, const unsigned char *p, size_t len) {
+    while (len > 0) {
+        ssize_t ret = write(fd, p, len);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "write: %s\n", strerror(errno));
+            exit(1);
+        }
+        p += ret;
+        len -= ret;
+    }
+}
+
+// Keep a file target from growing without bound
+static void rewind_file(struct writer *w, size_t len) {
+    w->off += len;
+    if (!w->is_pipe && w->off > (256 << 20)) {
+        lseek(w->fd, 0, SEEK_SET);
+        w->off = 0;
+    }
+}
+
+static void bench_write(void *arg) {
+    struct writer *w = arg;
+    write_all(w->fd, w->buf[0], w->len);
+    rewind_file(w, w->len);
+}
+
+static void bench_writev(void *arg) {
+    struct writer *w = arg;
+    struct iovec iov[WRITEV_BATCH];
+    size_t total = WRITEV_BATCH * w->len, done = 0;
+
+    for (int i = 0; i < WRITEV_BATCH; i++) {
+        iov[i].iov_base = w->buf[i];
+        iov[i].iov_len = w->len;
+    }
+    // Fall back to plain writes for whatever a short writev left over
+    ssize_t ret = writev(w->fd, iov, WRITEV_BATCH);
+    if (ret < 0) {
+        fprintf(stderr, "writev: %s\n", strerror(errno));
+        exit(1);
+    }
+    done = ret;
+    for (int i = 0; i < WRITEV_BATCH; i++) {
+        if (done >= w->len) {
+            done -= w->len;
+            continue;
+        }
+        write_all(w->fd, w->buf[i] + done, w->len - done);
+        done = 0;
+    }
+    rewind_file(w, total);
+}
+
+/*
+ * vmsplice maps the user pages into the pipe instead of copying them.
+ * Files need a second hop through a staging pipe. The buffer is reused
+ * while the pages may still be queued, which corrupts the output but not
+ * the timing.
+ */
+static void bench_splice(void *arg) {
+    struct writer *w = arg;
+    int p = w->is_pipe ? w->fd : w->splice_p[1];
+    struct iovec iov = {.iov_base = w->buf[0], .iov_len = w->len};
+
+    while (iov.iov_len > 0) {
+        ssize_t ret = vmsplice(p, &iov, 1, 0);
+        if (ret < 0) {
+            fprintf(stderr, "vmsplice: %s\n", strerror(errno));
+            exit(1);
+        }
+        iov.iov_base = (unsigned char *)iov.iov_base + ret;
+        iov.iov_len -= ret;
+        if (!w->is_pipe) {
+            while (ret > 0) {
+                ssize_t moved = splice(w->splice_p[0], NULL, w->fd, NULL, ret, SPLICE_F_MOVE);
+                if (moved <= 0) {
+                    fprintf(stderr, "splice: %s\n", strerror(errno));
+                    exit(1);
+                }
+                ret -= moved;
+            }
+        }
+    }
+    rewind_file(w, w->len);
+}
+
+#ifdef HAVE_LIBURING
+static void uring_reap(struct writer *w, unsigned int keep) {
+    struct io_uring_cqe *cqe;
+
+    while (w->uring_inflight > keep) {
+        if (io_uring_wait_cqe(&w->ring, &cqe) < 0)
+            break;
+        if (cqe->res < 0) {
+            fprintf(stderr, "io_uring write: %s\n", strerror(-cqe->res));
+            exit(1);
+        }
+        io_uring_cqe_seen(&w->ring, cqe);
+        w->uring_inflight--;
+    }
+}
+
+// Up to URING_DEPTH writes in flight, one submission per block
+static void bench_io_uring(void *arg) {
+    struct writer *w = arg;
+    struct io_uring_sqe *sqe;
+
+    uring_reap(w, URING_DEPTH - 1);
+    sqe = io_uring_get_sqe(&w->ring);
+    io_uring_prep_write(sqe, w->fd, w->buf[w->uring_inflight % WRITEV_BATCH], w->len,
+                        w->is_pipe ? (uint64_t)-1 : (uint64_t)w->off);
+    io_uring_submit(&w->ring);
+    w->uring_inflight++;
+    rewind_file(w, w->len);
+}
+#endif
+
+static int writer_open(struct writer *w) {
+    int p[2];
+
+    memset(w, 0, sizeof(*w));
+    w->splice_p[0] = w->splice_p[1] = -1;
+    if (write_path) {
+        w->fd = open(write_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (w->fd < 0) {
+            fprintf(stderr, "Cannot open %s: %s\n", write_path, strerror(errno));
+            return -1;
+        }
+        if (pipe(w->splice_p) < 0)
+            return -1;
+        fcntl(w->splice_p[1], F_SETPIPE_SZ, 1 << 20);
+    } else {
+        if (pipe(p) < 0)
+            return -1;
+        fcntl(p[1], F_SETPIPE_SZ, 1 << 20);
+        w->fd = p[1];
+        w->pipe_rd = p[0];
+        w->is_pipe = 1;
+        pthread_create(&w->drain, NULL, drain_thread, w);
+    }
+#ifdef HAVE_LIBURING
+    if (io_uring_queue_init(URING_DEPTH, &w->ring, 0) < 0) {
+        fprintf(stderr, "io_uring_queue_init failed\n");
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+static void writer_close(struct writer *w) {
+#ifdef HAVE_LIBURING
+    io_uring_queue_exit(&w->ring);
+#endif
+    close(w->fd);
+    if (w->is_pipe) {
+        pthread_join(w->drain, NULL);
+        close(w->pipe_rd);
+    }
+    if (w->splice_p[0] >= 0) {
+        close(w->splice_p[0]);
+        close(w->splice_p[1]);
+    }
+    if (write_path)
+        unlink(write_path);
+}
+
+static void run_writers(size_t bytes) {
+    struct writer w;
+    struct bench_case bc = {.bytes = bytes, .samples = bytes / sizeof(int16_t), .arg = &w};
+
+    if (writer_open(&w) < 0) {
+        fprintf(stderr, "Skipping writers: %s\n", strerror(errno));
+        return;
+    }
+    w.len = bytes;
+    for (int i = 0; i < WRITEV_BATCH; i++) {
+        w.buf[i] = malloc(bytes);
+        if (w.buf[i] == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        fill_noise((int16_t *)w.buf[i], bytes / sizeof(int16_t));
+    }
+    snprintf(bc.name, sizeof(bc.name), "%s/%zu", w.is_pipe ? "pipe" : "file", bytes);
+
+    bc.group = "write";
+    bc.fn = bench_write;
+    run_case(&bc);
+
+    bc.group = "writev";
+    bc.fn = bench_writev;
+    bc.bytes = WRITEV_BATCH * bytes;
+    bc.samples = WRITEV_BATCH * bytes / sizeof(int16_t);
+    snprintf(bc.name, sizeof(bc.name), "%s/%dx%zu", w.is_pipe ? "pipe" : "file",
+             WRITEV_BATCH, bytes);
+    run_case(&bc);
+    bc.bytes = bytes;
+    bc.samples = bytes / sizeof(int16_t);
+    snprintf(bc.name, sizeof(bc.name), "%s/%zu", w.is_pipe ? "pipe" : "file", bytes);
+
+    bc.group = "splice";
+    bc.fn = bench_splice;
+    run_case(&bc);
+
+#ifdef HAVE_LIBURING
+    bc.group = "io_uring";
+    bc.fn = bench_io_uring;
+    run_case(&bc);
+    uring_reap(&w, 0);
+#endif
+
+    writer_close(&w);
+    for (int i = 0; i < WRITEV_BATCH; i++)
+        free(w.buf[i]);
+}
+
+static void cpu_model(char *out, size_t len) {
+    char line[256];
+    FILE *f = fopen("/proc/cpuinfo", "r");
+
+    snprintf(out, len, "unknown");
+    if (f == NULL)
+        return;
+    while (fgets(line, sizeof(line), f)) {
+        char *colon = strchr(line, ':');
+        if (strncmp(line, "model name", 10) == 0 && colon) {
+            colon += 2;
+            colon[strcspn(colon, "\n\"\\")] = '\0';
+            snprintf(out, len, "%s", colon);
+            break;
+        }
+    }
+    fclose(f);
+}
+
+static void printhelp(void) {
+    fprintf(stderr, "Usage: rx888_bench [options]\n");
+    fprintf(stderr, " -t SECONDS   Time spent per case (default 0.5)\n");
+    fprintf(stderr, " -f FILTER    Only run cases whose name contains FILTER\n");
+    fprintf(stderr, " -w PATH      Benchmark the writers against a file instead of a pipe\n");
+    fprintf(stderr, " -h           This help\n");
+    fprintf(stderr, "Results go to stdout as JSON, progress to stderr.\n");
+}
+
+int main(int argc, char **argv) {
+    char cpu[128];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:f:w:h")) != -1) {
+        switch (opt) {
+        case 't':
+            min_time = strtod(optarg, NULL);
+            if (min_time <= 0) {
+                fprintf(stderr, "Invalid time %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'f':
+            filter = optarg;
+            break;
+        case 'w':
+            write_path = optarg;
+            break;
+        case 'h':
+        default:
+            printhelp();
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    cycles_init();
+    cpu_model(cpu, sizeof(cpu));
+    printf("{\n  \"cpu\": \"%s\",\n  \"cycles_source\": \"%s\",\n  \"pktsize\": %d,\n"
+           "  \"io_uring\": %s,\n  \"results\": [\n",
+           cpu, cycles_source, PKTSIZE,
+#ifdef HAVE_LIBURING
+           "true"
+#else
+           "false"
+#endif
+    );
+
+    for (size_t i = 0; i < sizeof(reqsizes) / sizeof(reqsizes[0]); i++)
+        run_kernels((size_t)reqsizes[i] * PKTSIZE);
+    for (size_t i = 0; i < sizeof(reqsizes) / sizeof(reqsizes[0]); i++)
+        run_writers((size_t)reqsizes[i] * PKTSIZE);
+
+    printf("\n  ]\n}\n");
+    if (perf_fd >= 0)
+        close(perf_fd);
+    return 0;
+}
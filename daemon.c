@@ -0,0 +1,523 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "daemon.h"
+#include "dsp.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define MAX_CLIENTS 32
+#define MAX_PRODUCTS 32
+#define SPECTRUM_AVERAGES 4
+#define MIN_QUEUE (1024 * 1024)
+#define QUEUE_SECONDS 0.25     // client queue holds this much of its product
+#define SEND_CHUNK (256 * 1024) // bounds the time the lock is held per send
+
+enum product_type {
+    PRODUCT_RAW,
+    PRODUCT_DDC,
+    PRODUCT_SPECTRUM,
+};
+
+struct product {
+    enum product_type type;
+    double freq;          // ddc
+    unsigned int decim;   // ddc
+    unsigned int size;    // spectrum
+    double rate;          // spectrum frames per second
+    unsigned int refs;    // attached clients
+
+    struct ddc *ddc;
+    struct spectrum *spec;
+    float *out;
+
+    // Output for the block being processed
+    const uint8_t *result;
+    size_t result_len;
+};
+
+struct dclient {
+    int fd;
+    struct product *product; // NULL until the request line arrived
+    uint8_t *buf;            // send queue, ring buffer of size bytes
+    size_t size;
+    size_t head;
+    size_t count;
+    uint64_t sent;
+    uint64_t dropped;
+    char line[128];
+    size_t line_len;
+};
+
+struct daemon {
+    struct sockaddr_un addr;
+    int listen_fd;
+    int wake[2];
+    pthread_t thread;
+    volatile bool stop;
+    unsigned int samplerate;
+    size_t max_in;
+
+    pthread_mutex_t lock; // protects clients, products and their refs
+    struct dclient clients[MAX_CLIENTS];
+    unsigned int nclients;
+    struct product *products[MAX_PRODUCTS];
+    unsigned int nproducts;
+};
+
+static void wake(struct daemon *d) {
+    uint8_t b = 0;
+    ssize_t ret = write(d->wake[1], &b, 1);
+    (void)ret; // pipe full means a wakeup is already pending
+}
+
+static void product_free(struct product *p) {
+    ddc_free(p->ddc);
+    spectrum_free(p->spec);
+    free(p->out);
+    free(p);
+}
+
+// Bytes per second a product produces, to size client queues
+static double product_rate(const struct daemon *d, const struct product *p) {
+    switch (p->type) {
+    case PRODUCT_DDC:
+        return d->samplerate / (double)p->decim * 2 * sizeof(float);
+    case PRODUCT_SPECTRUM:
+        return p->rate * (p->size / 2 + 1) * sizeof(float);
+    default:
+        return d->samplerate * 2.0;
+    }
+}
+
+static bool product_same(const struct product *a, const struct product *b) {
+    if (a->type != b->type)
+        return false;
+    if (a->type == PRODUCT_DDC)
+        return a->freq == b->freq && a->decim == b->decim;
+    if (a->type == PRODUCT_SPECTRUM)
+        return a->size == b->size && a->rate == b->rate;
+    return true;
+}
+
+/*
+ * Find a running product matching the request or create one.
+ * Caller holds d->lock. Returns NULL with a reason in err.
+ */
+static struct product *product_get(struct daemon *d, const struct product *req,
+                                   const char **err) {
+    struct product *p;
+
+    for (unsigned int i = 0; i < d->nproducts; i++) {
+        if (product_same(d->products[i], req))
+            return d->products[i];
+    }
+    if (d->nproducts == MAX_PRODUCTS) {
+        *err = "too many products";
+        return NULL;
+    }
+
+    p = calloc(1, sizeof(*p));
+    if (p == NULL) {
+        *err = "out of memory";
+        return NULL;
+    }
+    *p = *req;
+    p->refs = 0;
+    if (p->type == PRODUCT_DDC) {
+        p->ddc = ddc_create(d->samplerate, p->freq, p->decim, d->max_in);
+        p->out = malloc((d->max_in / p->decim + 1) * 2 * sizeof(float));
+        if (p->ddc == NULL || p->out == NULL) {
+            *err = "invalid ddc parameters";
+            product_free(p);
+            return NULL;
+        }
+    } else if (p->type == PRODUCT_SPECTRUM) {
+        p->spec = spectrum_create(d->samplerate, p->size, SPECTRUM_AVERAGES, p->rate);
+        if (p->spec == NULL) {
+            *err = "invalid spectrum parameters";
+            product_free(p);
+            return NULL;
+        }
+        p->out = malloc((d->max_in / p->size + 1) * spectrum_bins(p->spec) * sizeof(float));
+        if (p->out == NULL) {
+            *err = "out of memory";
+            product_free(p);
+            return NULL;
+        }
+    }
+    d->products[d->nproducts++] = p;
+    return p;
+}
+
+// Copy into a client ring; caller holds d->lock
+static void client_queue(struct dclient *cl, const uint8_t *data, size_t len) {
+    if (cl->size - cl->count < len) {
+        cl->dropped += len;
+        return;
+    }
+    size_t tail = (cl->head + cl->count) % cl->size;
+    size_t first = cl->size - tail < len ? cl->size - tail : len;
+    memcpy(cl->buf + tail, data, first);
+    memcpy(cl->buf, data + first, len - first);
+    cl->count += len;
+}
+
+static void client_reply(struct dclient *cl, const char *msg) {
+    ssize_t ret = send(cl->fd, msg, strlen(msg), MSG_DONTWAIT | MSG_NOSIGNAL);
+    (void)ret; // the client sees the close if this fails
+}
+
+static void client_close(struct daemon *d, unsigned int i) {
+    struct dclient *cl = &d->clients[i];
+
+    if (cl->product) {
+        cl->product->refs--;
+        fprintf(stderr, "daemon: client detached, %llu bytes sent, %llu dropped\n",
+                (unsigned long long)cl->sent, (unsigned long long)cl->dropped);
+    }
+    close(cl->fd);
+    free(cl->buf);
+    d->clients[i] = d->clients[--d->nclients];
+}
+
+// Whether a request pattern matched up to the end of the line
+static bool request_end(const struct dclient *cl, int end) {
+    return end > 0 && cl->line[end] == '\0';
+}
+
+// Parse the request line and attach the client; false closes it
+static bool client_attach(struct daemon *d, struct dclient *cl) {
+    struct product req = {0};
+    const char *err = "unknown product";
+    const char *format = "s16le";
+    double rate = d->samplerate;
+    char reply[128];
+    int raw_end = 0, ddc_end = 0, spectrum_end = 0;
+
+    // %n is only reached once every field has been parsed; nothing may follow
+    sscanf(cl->line, "raw %n", &raw_end);
+    sscanf(cl->line, "ddc %lf %u %n", &req.freq, &req.decim, &ddc_end);
+    sscanf(cl->line, "spectrum %u %lf %n", &req.size, &req.rate, &spectrum_end);
+    if (request_end(cl, raw_end)) {
+        req.type = PRODUCT_RAW;
+    } else if (request_end(cl, ddc_end)) {
+        req.type = PRODUCT_DDC;
+        format = "cf32le";
+        rate = d->samplerate / (double)req.decim;
+    } else if (request_end(cl, spectrum_end)) {
+        req.type = PRODUCT_SPECTRUM;
+        format = "f32le";
+        rate = req.rate;
+    } else {
+        goto fail;
+    }
+
+    struct product *p = product_get(d, &req, &err);
+    if (p == NULL)
+        goto fail;
+
+    cl->size = (size_t)(product_rate(d, p) * QUEUE_SECONDS);
+    if (cl->size < MIN_QUEUE)
+        cl->size = MIN_QUEUE;
+    cl->buf = malloc(cl->size);
+    if (cl->buf == NULL) {
+        err = "out of memory";
+        goto fail;
+    }
+    p->refs++;
+    cl->product = p;
+
+    snprintf(reply, sizeof(reply), "ok %.3f %s\n", rate, format);
+    client_reply(cl, reply);
+    fprintf(stderr, "daemon: client attached: %s\n", cl->line);
+    return true;
+
+fail:
+    snprintf(reply, sizeof(reply), "error %s\n", err);
+    client_reply(cl, reply);
+    return false;
+}
+
+// Read the request line, or detect a detach; false closes the client
+static bool client_read(struct daemon *d, struct dclient *cl) {
+    char buf[128];
+    ssize_t ret = recv(cl->fd, buf, sizeof(buf), MSG_DONTWAIT);
+
+    if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EINTR))
+        return false;
+    if (ret < 0 || cl->product)
+        return true; // anything after the request is ignored
+
+    for (ssize_t i = 0; i < ret; i++) {
+        if (buf[i] == '\n') {
+            cl->line[cl->line_len] = '\0';
+            return client_attach(d, cl);
+        }
+        if (cl->line_len == sizeof(cl->line) - 2)
+            return false;
+        cl->line[cl->line_len++] = buf[i];
+    }
+    return true;
+}
+
+static bool client_write(struct dclient *cl) {
+    while (cl->count > 0) {
+        size_t len = cl->size - cl->head < cl->count ? cl->size - cl->head : cl->count;
+        if (len > SEND_CHUNK)
+            len = SEND_CHUNK;
+        ssize_t ret = send(cl->fd, cl->buf + cl->head, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (ret < 0)
+            return errno == EAGAIN || errno == EINTR;
+        cl->head = (cl->head + ret) % cl->size;
+        cl->count -= ret;
+        cl->sent += ret;
+        if ((size_t)ret < len)
+            break;
+    }
+    return true;
+}
+
+static void client_accept(struct daemon *d) {
+    int fd = accept(d->listen_fd, NULL, NULL);
+    if (fd < 0)
+        return;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->nclients == MAX_CLIENTS) {
+        pthread_mutex_unlock(&d->lock);
+        fprintf(stderr, "daemon: too many clients, rejecting connection\n");
+        close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    memset(&d->clients[d->nclients], 0, sizeof(struct dclient));
+    d->clients[d->nclients].fd = fd;
+    d->nclients++;
+    pthread_mutex_unlock(&d->lock);
+}
+
+static void *server_thread(void *arg) {
+    struct daemon *d = arg;
+    struct pollfd pfd[MAX_CLIENTS + 2];
+
+    while (!d->stop) {
+        unsigned int n;
+
+        pthread_mutex_lock(&d->lock);
+        n = d->nclients;
+        for (unsigned int i = 0; i < n; i++) {
+            pfd[i + 2].fd = d->clients[i].fd;
+            pfd[i + 2].events = POLLIN | (d->clients[i].count ? POLLOUT : 0);
+        }
+        pthread_mutex_unlock(&d->lock);
+        pfd[0].fd = d->wake[0];
+        pfd[0].events = POLLIN;
+        pfd[1].fd = d->listen_fd;
+        pfd[1].events = POLLIN;
+
+        if (poll(pfd, n + 2, 1000) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("daemon: poll");
+            break;
+        }
+
+        if (pfd[0].revents & POLLIN) {
+            uint8_t drain[64];
+            while (read(d->wake[0], drain, sizeof(drain)) > 0)
+                ;
+        }
+
+        pthread_mutex_lock(&d->lock);
+        // Walk backwards so client_close() can move the last client into slot i
+        for (unsigned int i = n; i-- > 0;) {
+            struct dclient *cl = &d->clients[i];
+            bool ok = true;
+            if (pfd[i + 2].revents & (POLLERR | POLLHUP))
+                ok = false;
+            if (ok && (pfd[i + 2].revents & POLLIN))
+                ok = client_read(d, cl);
+            if (ok && cl->count)
+                ok = client_write(cl);
+            if (!ok)
+                client_close(d, i);
+        }
+        pthread_mutex_unlock(&d->lock);
+
+        if (pfd[1].revents & POLLIN)
+            client_accept(d);
+    }
+    return NULL;
+}
+
+struct daemon *daemon_start(const char *path, unsigned int samplerate,
+                            size_t max_in) {
+    struct daemon *d;
+
+    d = calloc(1, sizeof(*d));
+    if (d == NULL)
+        return NULL;
+    d->samplerate = samplerate;
+    d->max_in = max_in;
+    d->listen_fd = -1;
+    d->wake[0] = d->wake[1] = -1;
+    pthread_mutex_init(&d->lock, NULL);
+
+    d->addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(d->addr.sun_path)) {
+        fprintf(stderr, "daemon: socket path too long\n");
+        goto fail;
+    }
+    strcpy(d->addr.sun_path, path);
+
+    if (pipe(d->wake) != 0) {
+        perror("daemon: pipe");
+        goto fail;
+    }
+    fcntl(d->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(d->wake[1], F_SETFL, O_NONBLOCK);
+
+    d->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path); // stale socket from a previous run
+    if (d->listen_fd < 0 ||
+        bind(d->listen_fd, (struct sockaddr *)&d->addr, sizeof(d->addr)) != 0 ||
+        listen(d->listen_fd, 8) != 0) {
+        fprintf(stderr, "daemon: cannot listen on %s: %s\n", path, strerror(errno));
+        goto fail;
+    }
+
+    if (pthread_create(&d->thread, NULL, server_thread, d) != 0) {
+        fprintf(stderr, "daemon: cannot start server thread\n");
+        unlink(path);
+        goto fail;
+    }
+
+    fprintf(stderr, "daemon: listening on %s\n", path);
+    return d;
+
+fail:
+    if (d->listen_fd >= 0)
+        close(d->listen_fd);
+    if (d->wake[0] >= 0) {
+        close(d->wake[0]);
+        close(d->wake[1]);
+    }
+    pthread_mutex_destroy(&d->lock);
+    free(d);
+    return NULL;
+}
+
+void daemon_stop(struct daemon *d) {
+    if (d == NULL)
+        return;
+
+    d->stop = true;
+    wake(d);
+    pthread_join(d->thread, NULL);
+
+    while (d->nclients > 0)
+        client_close(d, d->nclients - 1);
+    for (unsigned int i = 0; i < d->nproducts; i++)
+        product_free(d->products[i]);
+    close(d->listen_fd);
+    unlink(d->addr.sun_path);
+    close(d->wake[0]);
+    close(d->wake[1]);
+    pthread_mutex_destroy(&d->lock);
+    free(d);
+}
+
+unsigned int daemon_clients(struct daemon *d) {
+    unsigned int n;
+
+    pthread_mutex_lock(&d->lock);
+    n = d->nclients;
+    pthread_mutex_unlock(&d->lock);
+    return n;
+}
+
+static void product_run(struct product *p, const int16_t *samples, size_t n) {
+    size_t len;
+
+    switch (p->type) {
+    case PRODUCT_RAW:
+        p->result = (const uint8_t *)samples;
+        p->result_len = n * sizeof(int16_t);
+        break;
+    case PRODUCT_DDC:
+        len = ddc_process(p->ddc, samples, n, p->out);
+        p->result = (const uint8_t *)p->out;
+        p->result_len = len * 2 * sizeof(float);
+        break;
+    case PRODUCT_SPECTRUM:
+        len = spectrum_process(p->spec, samples, n, p->out, n / p->size + 1);
+        p->result = (const uint8_t *)p->out;
+        p->result_len = len * spectrum_bins(p->spec) * sizeof(float);
+        break;
+    }
+}
+
+void daemon_process(struct daemon *d, const int16_t *samples, size_t n) {
+    struct product *active[MAX_PRODUCTS];
+    unsigned int nactive = 0;
+
+    // Retire products nobody uses any more; the server thread only adds them
+    pthread_mutex_lock(&d->lock);
+    for (unsigned int i = d->nproducts; i-- > 0;) {
+        struct product *p = d->products[i];
+        if (p->refs == 0) {
+            product_free(p);
+            d->products[i] = d->products[--d->nproducts];
+        } else {
+            active[nactive++] = p;
+        }
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    // Each product is computed once, however many clients use it
+    for (unsigned int i = 0; i < nactive; i++)
+        product_run(active[i], samples, n);
+
+    pthread_mutex_lock(&d->lock);
+    for (unsigned int i = 0; i < d->nclients; i++) {
+        struct dclient *cl = &d->clients[i];
+        if (cl->product && cl->product->result_len)
+            client_queue(cl, cl->product->result, cl->product->result_len);
+    }
+    for (unsigned int i = 0; i < nactive; i++)
+        active[i]->result_len = 0;
+    pthread_mutex_unlock(&d->lock);
+    wake(d);
+}
@@ -0,0 +1,66 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Long running daemon that keeps the device streaming and lets clients
+ * attach over a Unix socket. A client sends one request line and then
+ * receives its product until it disconnects:
+ *
+ *   raw                          int16 ADC samples          (s16le)
+ *   ddc <freq_hz> <decimation>   interleaved float I/Q      (cf32le)
+ *   spectrum <size> <rate_hz>    size / 2 + 1 float dBFS bins per frame (f32le)
+ *
+ * and is answered with "ok <samplerate> <format>\n" or "error <reason>\n".
+ * Clients asking for the same product share one DSP instance; each client
+ * has its own bounded queue and loses data, not the device, when slow.
+ */
+
+struct daemon;
+
+struct daemon *daemon_start(const char *path, unsigned int samplerate,
+                            size_t max_in);
+void daemon_stop(struct daemon *d);
+
+// Number of attached clients
+unsigned int daemon_clients(struct daemon *d);
+
+// Run every active product over n samples and queue the results
+void daemon_process(struct daemon *d, const int16_t *samples, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
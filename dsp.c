@@ -0,0 +1,493 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "dsp.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HB_TAPS 23       // half-band length, (HB_TAPS - 1) / 2 must be odd
+#define HB_SIDE 6        // non-zero taps on each side of the centre
+#define NCO_CHUNK 1024   // rotator table length
+
+struct halfband {
+    float *buf;   // history followed by new input; interleaved I/Q in a ddc
+    size_t hist;  // samples carried over from the previous call
+};
+
+struct ddc {
+    double samplerate;
+    double freq;
+    unsigned int decim;
+    unsigned int nstages;
+    size_t max_in;
+    struct halfband *stages;
+    float coef[HB_SIDE]; // taps at centre +- (2j + 1)
+
+    double phase;        // NCO phase at the start of the next block
+    double dphase;       // NCO increment per sample, radians
+    float *lut;          // exp(-j * dphase * k), k < NCO_CHUNK
+};
+
+static void design_halfband(float *coef) {
+    const int c = (HB_TAPS - 1) / 2;
+    double sum = 0.5;
+
+    // Blackman windowed sinc with the cutoff at a quarter of the input rate
+    for (int j = 0; j < HB_SIDE; j++) {
+        int k = c + 2 * j + 1;
+        double x = (double)(k - c);
+        double sinc = sin(M_PI * x / 2) / (M_PI * x);
+        double w = 0.42 - 0.5 * cos(2 * M_PI * k / (HB_TAPS - 1)) +
+                   0.08 * cos(4 * M_PI * k / (HB_TAPS - 1));
+        coef[j] = (float)(sinc * w);
+        sum += 2 * coef[j];
+    }
+    for (int j = 0; j < HB_SIDE; j++)
+        coef[j] /= sum;
+}
+
+void ddc_set_freq(struct ddc *ddc, double freq) {
+    ddc->freq = freq;
+    ddc->dphase = -2 * M_PI * freq / ddc->samplerate;
+    for (int k = 0; k < NCO_CHUNK; k++) {
+        ddc->lut[2 * k] = (float)cos(ddc->dphase * k);
+        ddc->lut[2 * k + 1] = (float)sin(ddc->dphase * k);
+    }
+}
+
+struct ddc *ddc_create(double samplerate, double freq, unsigned int decim,
+                       size_t max_in) {
+    struct ddc *ddc;
+
+    if (decim < 2 || (decim & (decim - 1)) != 0)
+        return NULL;
+
+    ddc = calloc(1, sizeof(*ddc));
+    if (ddc == NULL)
+        return NULL;
+    ddc->samplerate = samplerate;
+    ddc->decim = decim;
+    ddc->max_in = max_in;
+    while ((1u << ddc->nstages) < decim)
+        ddc->nstages++;
+
+    ddc->lut = malloc(2 * NCO_CHUNK * sizeof(float));
+    ddc->stages = calloc(ddc->nstages, sizeof(struct halfband));
+    if (ddc->lut == NULL || ddc->stages == NULL)
+        goto fail;
+    for (unsigned int i = 0; i < ddc->nstages; i++) {
+        // history plus new input, including what the previous stage carried over
+        size_t len = 2 * HB_TAPS + (max_in >> i) + 1;
+        ddc->stages[i].buf = calloc(2 * len, sizeof(float));
+        if (ddc->stages[i].buf == NULL)
+            goto fail;
+        ddc->stages[i].hist = HB_TAPS - 1;
+    }
+
+    design_halfband(ddc->coef);
+    ddc_set_freq(ddc, freq);
+    return ddc;
+
+fail:
+    ddc_free(ddc);
+    return NULL;
+}
+
+void ddc_free(struct ddc *ddc) {
+    if (ddc == NULL)
+        return;
+    if (ddc->stages) {
+        for (unsigned int i = 0; i < ddc->nstages; i++)
+            free(ddc->stages[i].buf);
+        free(ddc->stages);
+    }
+    free(ddc->lut);
+    free(ddc);
+}
+
+unsigned int ddc_decimation(const struct ddc *ddc) {
+    return ddc->decim;
+}
+
+void ddc_seek(struct ddc *ddc, uint64_t sample_index) {
+    // Whole cycles in long double: an index deep into a long capture
+    // leaves too few bits of a double for the fraction
+    long double cycles = (long double)ddc->freq * sample_index / ddc->samplerate;
+    ddc->phase = -2 * M_PI * (double)(cycles - floorl(cycles));
+}
+
+size_t ddc_settle(const struct ddc *ddc) {
+    // Stage i holds HB_TAPS - 1 samples of history at 1 / 2^i of the input rate
+    return (size_t)(HB_TAPS - 1) * ddc->decim;
+}
+
+// Mix n real samples down to complex baseband into out
+static void nco_mix(struct ddc *ddc, const int16_t *in, size_t n, float *out) {
+    const float scale = 1.0f / 32768.0f;
+
+    for (size_t base = 0; base < n; base += NCO_CHUNK) {
+        size_t len = n - base < NCO_CHUNK ? n - base : NCO_CHUNK;
+        float sr = (float)cos(ddc->phase) * scale;
+        float si = (float)sin(ddc->phase) * scale;
+        const float *lut = ddc->lut;
+
+        for (size_t k = 0; k < len; k++) {
+            float x = (float)in[base + k];
+            float cr = sr * lut[2 * k] - si * lut[2 * k + 1];
+            float ci = sr * lut[2 * k + 1] + si * lut[2 * k];
+            out[2 * (base + k)] = x * cr;
+            out[2 * (base + k) + 1] = x * ci;
+        }
+        ddc->phase = fmod(ddc->phase + ddc->dphase * len, 2 * M_PI);
+    }
+}
+
+/*
+ * Decimate the n new samples already placed after the history in hb->buf
+ * by two, writing the result to out. Returns the number of outputs.
+ */
+static size_t halfband_run(const struct ddc *ddc, struct halfband *hb,
+                           size_t n, float *out) {
+    const int c = (HB_TAPS - 1) / 2;
+    size_t total = hb->hist + n;
+    size_t m = 0;
+
+    for (size_t pos = 0; pos + HB_TAPS <= total; pos += 2, m++) {
+        const float *x = hb->buf + 2 * (pos + c);
+        float yi = 0.5f * x[0];
+        float yq = 0.5f * x[1];
+        for (int j = 0; j < HB_SIDE; j++) {
+            int d = 2 * j + 1;
+            yi += ddc->coef[j] * (x[-2 * d] + x[2 * d]);
+            yq += ddc->coef[j] * (x[-2 * d + 1] + x[2 * d + 1]);
+        }
+        out[2 * m] = yi;
+        out[2 * m + 1] = yq;
+    }
+
+    size_t left = total - 2 * m;
+    memmove(hb->buf, hb->buf + 2 * (total - left), 2 * left * sizeof(float));
+    hb->hist = left;
+    return m;
+}
+
+size_t ddc_process(struct ddc *ddc, const int16_t *in, size_t n, float *out) {
+    size_t written = 0;
+
+    for (size_t done = 0; done < n;) {
+        size_t chunk = n - done < ddc->max_in ? n - done : ddc->max_in;
+        size_t len = chunk;
+        struct halfband *hb = &ddc->stages[0];
+
+        nco_mix(ddc, in + done, len, hb->buf + 2 * hb->hist);
+        for (unsigned int i = 0; i < ddc->nstages; i++) {
+            hb = &ddc->stages[i];
+            float *dst = out + 2 * written;
+            if (i + 1 < ddc->nstages)
+                dst = ddc->stages[i + 1].buf + 2 * ddc->stages[i + 1].hist;
+            len = halfband_run(ddc, hb, len, dst);
+        }
+        written += len;
+        done += chunk;
+    }
+    return written;
+}
+
+struct decimator {
+    unsigned int nstages;
+    size_t max_in;
+    struct halfband *stages;
+    float coef[HB_SIDE];
+    float *out; // last stage output before conversion back to int16
+};
+
+struct decimator *decimator_create(unsigned int decim, size_t max_in) {
+    struct decimator *dec;
+
+    if (decim < 2 || (decim & (decim - 1)) != 0)
+        return NULL;
+
+    dec = calloc(1, sizeof(*dec));
+    if (dec == NULL)
+        return NULL;
+    dec->max_in = max_in;
+    while ((1u << dec->nstages) < decim)
+        dec->nstages++;
+
+    dec->stages = calloc(dec->nstages, sizeof(struct halfband));
+    dec->out = malloc(((max_in >> dec->nstages) + 1) * sizeof(float));
+    if (dec->stages == NULL || dec->out == NULL)
+        goto fail;
+    for (unsigned int i = 0; i < dec->nstages; i++) {
+        size_t len = 2 * HB_TAPS + (max_in >> i) + 1;
+        dec->stages[i].buf = calloc(len, sizeof(float));
+        if (dec->stages[i].buf == NULL)
+            goto fail;
+    }
+    decimator_reset(dec);
+    design_halfband(dec->coef);
+    return dec;
+
+fail:
+    decimator_free(dec);
+    return NULL;
+}
+
+void decimator_free(struct decimator *dec) {
+    if (dec == NULL)
+        return;
+    if (dec->stages) {
+        for (unsigned int i = 0; i < dec->nstages; i++)
+            free(dec->stages[i].buf);
+        free(dec->stages);
+    }
+    free(dec->out);
+    free(dec);
+}
+
+void decimator_reset(struct decimator *dec) {
+    for (unsigned int i = 0; i < dec->nstages; i++) {
+        memset(dec->stages[i].buf, 0, (HB_TAPS - 1) * sizeof(float));
+        dec->stages[i].hist = HB_TAPS - 1;
+    }
+}
+
+// halfband_run() for a real signal
+static size_t halfband_run_real(const float *coef, struct halfband *hb, size_t n,
+                                float *out) {
+    const int c = (HB_TAPS - 1) / 2;
+    size_t total = hb->hist + n;
+    size_t m = 0;
+
+    for (size_t pos = 0; pos + HB_TAPS <= total; pos += 2, m++) {
+        const float *x = hb->buf + pos + c;
+        float y = 0.5f * x[0];
+        for (int j = 0; j < HB_SIDE; j++)
+            y += coef[j] * (x[-(2 * j + 1)] + x[2 * j + 1]);
+        out[m] = y;
+    }
+
+    size_t left = total - 2 * m;
+    memmove(hb->buf, hb->buf + (total - left), left * sizeof(float));
+    hb->hist = left;
+    return m;
+}
+
+size_t decimator_process(struct decimator *dec, const int16_t *in, size_t n, int16_t *out) {
+    size_t written = 0;
+
+    for (size_t done = 0; done < n;) {
+        size_t len = n - done < dec->max_in ? n - done : dec->max_in;
+        struct halfband *hb = &dec->stages[0];
+        float *dst = hb->buf + hb->hist;
+
+        for (size_t k = 0; k < len; k++)
+            dst[k] = (float)in[done + k];
+        done += len;
+        for (unsigned int i = 0; i < dec->nstages; i++) {
+            hb = &dec->stages[i];
+            dst = dec->out;
+            if (i + 1 < dec->nstages)
+                dst = dec->stages[i + 1].buf + dec->stages[i + 1].hist;
+            len = halfband_run_real(dec->coef, hb, len, dst);
+        }
+        for (size_t k = 0; k < len; k++) {
+            float y = lrintf(dec->out[k]);
+            out[written + k] = y > 32767.0f ? 32767 : y < -32768.0f ? -32768 : (int16_t)y;
+        }
+        written += len;
+    }
+    return written;
+}
+
+struct spectrum {
+    unsigned int size;
+    unsigned int log2size;
+    unsigned int averages;
+    uint64_t period;    // input samples from one frame start to the next
+    uint64_t pos;       // position within the current period
+    unsigned int done;  // FFTs accumulated for the current frame
+    float *window;
+    float *twiddle;     // exp(-2 pi j k / size), k < size / 2
+    float *work;        // interleaved complex FFT buffer
+    float *acc;         // power accumulator, size / 2 + 1 bins
+    size_t fill;        // samples collected in work
+};
+
+struct spectrum *spectrum_create(double samplerate, unsigned int size,
+                                 unsigned int averages, double frame_rate) {
+    struct spectrum *sp;
+
+    if (size < 16 || (size & (size - 1)) != 0 || averages < 1 || frame_rate <= 0)
+        return NULL;
+
+    sp = calloc(1, sizeof(*sp));
+    if (sp == NULL)
+        return NULL;
+    sp->size = size;
+    sp->averages = averages;
+    while ((1u << sp->log2size) < size)
+        sp->log2size++;
+    sp->period = (uint64_t)(samplerate / frame_rate);
+    if (sp->period < (uint64_t)size * averages)
+        sp->period = (uint64_t)size * averages;
+
+    sp->window = malloc(size * sizeof(float));
+    sp->twiddle = malloc(size * sizeof(float));
+    sp->work = malloc(2 * size * sizeof(float));
+    sp->acc = calloc(size / 2 + 1, sizeof(float));
+    if (!sp->window || !sp->twiddle || !sp->work || !sp->acc) {
+        spectrum_free(sp);
+        return NULL;
+    }
+    for (unsigned int i = 0; i < size; i++)
+        sp->window[i] = (float)(0.5 - 0.5 * cos(2 * M_PI * i / size));
+    for (unsigned int k = 0; k < size / 2; k++) {
+        sp->twiddle[2 * k] = (float)cos(2 * M_PI * k / size);
+        sp->twiddle[2 * k + 1] = (float)-sin(2 * M_PI * k / size);
+    }
+    return sp;
+}
+
+void spectrum_free(struct spectrum *sp) {
+    if (sp == NULL)
+        return;
+    free(sp->window);
+    free(sp->twiddle);
+    free(sp->work);
+    free(sp->acc);
+    free(sp);
+}
+
+unsigned int spectrum_bins(const struct spectrum *sp) {
+    return sp->size / 2 + 1;
+}
+
+uint64_t spectrum_period(const struct spectrum *sp) {
+    return sp->period;
+}
+
+// In-place iterative radix-2 FFT of sp->work
+static void fft(struct spectrum *sp) {
+    float *x = sp->work;
+    unsigned int n = sp->size;
+
+    for (unsigned int i = 1, j = 0; i < n; i++) {
+        unsigned int bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j |= bit;
+        if (i < j) {
+            float tr = x[2 * i], ti = x[2 * i + 1];
+            x[2 * i] = x[2 * j];
+            x[2 * i + 1] = x[2 * j + 1];
+            x[2 * j] = tr;
+            x[2 * j + 1] = ti;
+        }
+    }
+    for (unsigned int len = 2; len <= n; len <<= 1) {
+        unsigned int half = len / 2, step = n / len;
+        for (unsigned int i = 0; i < n; i += len) {
+            for (unsigned int k = 0; k < half; k++) {
+                float wr = sp->twiddle[2 * k * step], wi = sp->twiddle[2 * k * step + 1];
+                float *a = x + 2 * (i + k), *b = x + 2 * (i + k + half);
+                float br = b[0] * wr - b[1] * wi;
+                float bi = b[0] * wi + b[1] * wr;
+                b[0] = a[0] - br;
+                b[1] = a[1] - bi;
+                a[0] += br;
+                a[1] += bi;
+            }
+        }
+    }
+}
+
+size_t spectrum_process(struct spectrum *sp, const int16_t *in, size_t n,
+                        float *out, size_t max_frames) {
+    const uint64_t busy = (uint64_t)sp->size * sp->averages;
+    const unsigned int bins = sp->size / 2 + 1;
+    // Full scale sine through the Hann window lands at 0 dBFS
+    const float norm = 1.0f / (32768.0f * sp->size / 4);
+    size_t frames = 0;
+
+    while (n > 0) {
+        if (sp->pos >= busy) {
+            // Skip input until the next frame is due
+            uint64_t skip = sp->period - sp->pos;
+            if (skip > n)
+                skip = n;
+            in += skip;
+            n -= skip;
+            sp->pos = (sp->pos + skip) % sp->period;
+            continue;
+        }
+
+        size_t take = sp->size - sp->fill;
+        if (take > n)
+            take = n;
+        for (size_t i = 0; i < take; i++) {
+            sp->work[2 * (sp->fill + i)] = in[i] * sp->window[sp->fill + i] * norm;
+            sp->work[2 * (sp->fill + i) + 1] = 0.0f;
+        }
+        sp->fill += take;
+        sp->pos += take;
+        in += take;
+        n -= take;
+        if (sp->fill < sp->size)
+            break;
+
+        fft(sp);
+        for (unsigned int k = 0; k < bins; k++)
+            sp->acc[k] += sp->work[2 * k] * sp->work[2 * k] +
+                          sp->work[2 * k + 1] * sp->work[2 * k + 1];
+        sp->fill = 0;
+
+        if (++sp->done == sp->averages) {
+            if (frames < max_frames) {
+                float *dst = out + frames * bins;
+                for (unsigned int k = 0; k < bins; k++)
+                    dst[k] = 10.0f * log10f(sp->acc[k] / sp->averages + 1e-20f);
+                frames++;
+            }
+            memset(sp->acc, 0, bins * sizeof(float));
+            sp->done = 0;
+            if (sp->period == busy)
+                sp->pos = 0;
+        }
+    }
+    return frames;
+}
+
+void dsp_cf32_to_cu8(const float *in, uint8_t *out, size_t n, float scale) {
+    for (size_t i = 0; i < 2 * n; i++) {
+        float v = in[i] * scale + 127.5f;
+        if (v < 0.0f)
+            v = 0.0f;
+        if (v > 255.0f)
+            v = 255.0f;
+        out[i] = (uint8_t)v;
+    }
+}
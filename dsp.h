@@ -0,0 +1,109 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#ifndef DSP_H
+#define DSP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Digital down converter: mixes the real ADC stream down by a tuning
+ * frequency and decimates it by a power of two through a cascade of
+ * half-band filters. Output is interleaved float I/Q.
+ */
+struct ddc;
+
+// decim must be a power of two >= 2; max_in is the largest input block in samples
+struct ddc *ddc_create(double samplerate, double freq, unsigned int decim,
+                       size_t max_in);
+void ddc_free(struct ddc *ddc);
+void ddc_set_freq(struct ddc *ddc, double freq);
+unsigned int ddc_decimation(const struct ddc *ddc);
+
+// Set the NCO phase to what it is at input sample index of a stream started at 0
+void ddc_seek(struct ddc *ddc, uint64_t sample_index);
+
+/*
+ * Input samples it takes a new ddc to flush its initial filter history,
+ * a multiple of the decimation. Started that far ahead of a point in a
+ * stream, its output from that point on is that of the whole stream.
+ */
+size_t ddc_settle(const struct ddc *ddc);
+
+/*
+ * Process n real samples. Writes at most n / decim + 1 complex samples
+ * to out (2 floats each) and returns the number written.
+ */
+size_t ddc_process(struct ddc *ddc, const int16_t *in, size_t n, float *out);
+
+/*
+ * Real decimator: low-pass filters the real ADC stream and decimates it
+ * by a power of two through the same half-band cascade, int16 in and
+ * out. The output covers 0 to samplerate / (2 * decim).
+ */
+struct decimator;
+
+// decim must be a power of two >= 2; max_in is the largest input block in samples
+struct decimator *decimator_create(unsigned int decim, size_t max_in);
+void decimator_free(struct decimator *dec);
+
+// Forget the filter history, as after a gap in the input
+void decimator_reset(struct decimator *dec);
+
+// Process n samples; writes at most n / decim + 1 samples to out and returns how many
+size_t decimator_process(struct decimator *dec, const int16_t *in, size_t n, int16_t *out);
+
+/*
+ * Power spectrum of the real ADC stream: Hann windowed FFTs of size
+ * points, averaged, emitted at most frame_rate times per second as
+ * size / 2 + 1 float bins in dBFS. Input between frames is skipped.
+ */
+struct spectrum;
+
+struct spectrum *spectrum_create(double samplerate, unsigned int size,
+                                 unsigned int averages, double frame_rate);
+void spectrum_free(struct spectrum *sp);
+unsigned int spectrum_bins(const struct spectrum *sp);
+
+// Input samples from one frame start to the next; frames start at multiples of it
+uint64_t spectrum_period(const struct spectrum *sp);
+
+// Process n samples; writes whole frames to out and returns how many
+size_t spectrum_process(struct spectrum *sp, const int16_t *in, size_t n,
+                        float *out, size_t max_frames);
+
+// Interleaved float I/Q to offset binary uint8 I/Q (rtl_tcp format)
+void dsp_cf32_to_cu8(const float *in, uint8_t *out, size_t n, float scale);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
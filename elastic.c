@@ -0,0 +1,282 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#define _GNU_SOURCE // O_TMPFILE
+#include "elastic.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CHUNK_SIZE (1 << 20)
+
+struct chunk {
+    struct chunk *next;
+    size_t len;
+    unsigned char data[CHUNK_SIZE];
+};
+
+struct elastic {
+    elastic_drain_fn fn;
+    void *ctx;
+    size_t mem_limit;
+    pthread_t thread;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool stop;
+    bool failed; // the drain or the spill file gave up, writes are refused
+
+    // In memory, oldest first; the producer fills the tail
+    struct chunk *head;
+    struct chunk *tail;
+    struct chunk *spare; // one freed chunk kept to avoid malloc churn
+    size_t mem_used;
+
+    /*
+     * Once memory is full everything goes to the scratch file until the
+     * drain has caught up with it, so the order never changes: memory
+     * holds only data older than the file.
+     */
+    int fd;
+    bool spilling;
+    off_t spill_read;
+    off_t spill_end;
+    unsigned char *spill_buf; // drain side read buffer
+
+    struct elastic_stats stats;
+};
+
+static struct chunk *chunk_get(struct elastic *e) {
+    struct chunk *c = e->spare;
+
+    if (c)
+        e->spare = NULL;
+    else if ((c = malloc(sizeof(*c))) == NULL)
+        return NULL;
+    c->next = NULL;
+    c->len = 0;
+    return c;
+}
+
+static void chunk_put(struct elastic *e, struct chunk *c) {
+    if (e->spare == NULL)
+        e->spare = c;
+    else
+        free(c);
+}
+
+static void *drain_thread(void *arg) {
+    struct elastic *e = arg;
+
+    pthread_mutex_lock(&e->lock);
+    for (;;) {
+        while (e->head == NULL && e->spill_read == e->spill_end && !e->stop)
+            pthread_cond_wait(&e->cond, &e->lock);
+
+        if (e->head) {
+            // A chunk the producer is still filling is taken as it is
+            struct chunk *c = e->head;
+            e->head = c->next;
+            if (e->tail == c)
+                e->tail = NULL;
+            pthread_mutex_unlock(&e->lock);
+            int ret = e->failed ? 0 : e->fn(c->data, c->len, e->ctx);
+            pthread_mutex_lock(&e->lock);
+            e->failed |= ret != 0;
+            e->mem_used -= CHUNK_SIZE;
+            e->stats.mem_bytes -= c->len;
+            chunk_put(e, c);
+        } else if (e->spill_read < e->spill_end) {
+            off_t off = e->spill_read;
+            size_t len = e->spill_end - off;
+            if (len > CHUNK_SIZE)
+                len = CHUNK_SIZE;
+            pthread_mutex_unlock(&e->lock);
+            ssize_t got = pread(e->fd, e->spill_buf, len, off);
+            int ret = -1;
+            if (got == (ssize_t)len)
+                ret = e->failed ? 0 : e->fn(e->spill_buf, len, e->ctx);
+            else
+                fprintf(stderr, "Reading the spill file: %s\n",
+                        got < 0 ? strerror(errno) : "short read");
+            pthread_mutex_lock(&e->lock);
+            e->failed |= ret != 0;
+            e->spill_read += len;
+            e->stats.spill_bytes -= len;
+            // Caught up: back to memory, and give the disk space back
+            if (e->spill_read == e->spill_end) {
+                e->spilling = false;
+                e->spill_read = e->spill_end = 0;
+                if (ftruncate(e->fd, 0) != 0)
+                    fprintf(stderr, "Truncating the spill file: %s\n", strerror(errno));
+            }
+        } else {
+            break; // stopped and empty
+        }
+    }
+    pthread_mutex_unlock(&e->lock);
+    return NULL;
+}
+
+static int spill_open(const char *dir) {
+    char path[4096];
+    int fd = open(dir, O_TMPFILE | O_RDWR, 0600);
+
+    if (fd >= 0)
+        return fd;
+    // No O_TMPFILE on this filesystem: create and unlink
+    snprintf(path, sizeof(path), "%s/rx888-spill-XXXXXX", dir);
+    fd = mkstemp(path);
+    if (fd >= 0)
+        unlink(path);
+    return fd;
+}
+
+struct elastic *elastic_open(size_t mem_limit, const char *dir, elastic_drain_fn fn,
+                             void *ctx) {
+    struct elastic *e = calloc(1, sizeof(*e));
+
+    if (e == NULL)
+        return NULL;
+    e->fn = fn;
+    e->ctx = ctx;
+    e->mem_limit = mem_limit < CHUNK_SIZE ? CHUNK_SIZE : mem_limit;
+    e->fd = spill_open(dir);
+    if (e->fd < 0) {
+        fprintf(stderr, "Cannot create a spill file in %s: %s\n", dir, strerror(errno));
+        free(e);
+        return NULL;
+    }
+    e->spill_buf = malloc(CHUNK_SIZE);
+    if (e->spill_buf == NULL)
+        goto fail;
+    pthread_mutex_init(&e->lock, NULL);
+    pthread_cond_init(&e->cond, NULL);
+    if (pthread_create(&e->thread, NULL, drain_thread, e) != 0) {
+        fprintf(stderr, "Could not start the elastic buffer drain thread\n");
+        pthread_cond_destroy(&e->cond);
+        pthread_mutex_destroy(&e->lock);
+        goto fail;
+    }
+    return e;
+
+fail:
+    free(e->spill_buf);
+    close(e->fd);
+    free(e);
+    return NULL;
+}
+
+// Append to the scratch file; called with the lock held
+static int spill(struct elastic *e, const unsigned char *data, size_t len) {
+    while (len > 0) {
+        ssize_t ret = pwrite(e->fd, data, len, e->spill_end);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0) {
+            fprintf(stderr, "Writing the spill file: %s\n", strerror(errno));
+            return -1;
+        }
+        data += ret;
+        len -= ret;
+        e->spill_end += ret;
+        e->stats.spilled += ret;
+        e->stats.spill_bytes += ret;
+    }
+    if (e->stats.spill_bytes > e->stats.spill_high)
+        e->stats.spill_high = e->stats.spill_bytes;
+    return 0;
+}
+
+int elastic_write(struct elastic *e, const void *data, size_t len) {
+    const unsigned char *p = data;
+    int ret = 0;
+
+    pthread_mutex_lock(&e->lock);
+    if (e->failed) {
+        pthread_mutex_unlock(&e->lock);
+        return -1;
+    }
+    while (len > 0 && !e->spilling) {
+        struct chunk *c = e->tail;
+        if (c == NULL || c->len == CHUNK_SIZE) {
+            if (e->mem_used + CHUNK_SIZE > e->mem_limit || (c = chunk_get(e)) == NULL) {
+                e->spilling = true;
+                break;
+            }
+            if (e->tail)
+                e->tail->next = c;
+            else
+                e->head = c;
+            e->tail = c;
+            e->mem_used += CHUNK_SIZE;
+        }
+        size_t n = CHUNK_SIZE - c->len;
+        if (n > len)
+            n = len;
+        memcpy(c->data + c->len, p, n);
+        c->len += n;
+        p += n;
+        len -= n;
+        e->stats.mem_bytes += n;
+    }
+    if (e->stats.mem_bytes > e->stats.mem_high)
+        e->stats.mem_high = e->stats.mem_bytes;
+    // A hole in the stream: nothing after it is worth draining
+    if (len > 0 && (ret = spill(e, p, len)) != 0)
+        e->failed = true;
+    pthread_cond_signal(&e->cond);
+    pthread_mutex_unlock(&e->lock);
+    return ret;
+}
+
+void elastic_close(struct elastic *e) {
+    if (e == NULL)
+        return;
+
+    pthread_mutex_lock(&e->lock);
+    e->stop = true;
+    pthread_cond_signal(&e->cond);
+    pthread_mutex_unlock(&e->lock);
+    pthread_join(e->thread, NULL);
+
+    pthread_cond_destroy(&e->cond);
+    pthread_mutex_destroy(&e->lock);
+    free(e->spare);
+    free(e->spill_buf);
+    close(e->fd);
+    free(e);
+}
+
+void elastic_get_stats(struct elastic *e, struct elastic_stats *stats) {
+    pthread_mutex_lock(&e->lock);
+    *stats = e->stats;
+    pthread_mutex_unlock(&e->lock);
+}
@@ -0,0 +1,76 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#ifndef ELASTIC_H
+#define ELASTIC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Elastic buffer between a producer that must never wait and a consumer
+ * that keeps up on average but pauses. Data is copied into memory up to
+ * a limit; past it, it goes to an unlinked scratch file. A drain thread
+ * hands everything to the consumer in order, so nothing is lost as long
+ * as the disk has room.
+ */
+struct elastic;
+
+// Called on the drain thread with the next piece of the stream; return -1 to give up
+typedef int (*elastic_drain_fn)(const void *data, size_t len, void *ctx);
+
+struct elastic_stats {
+    uint64_t mem_bytes;     // buffered in memory now
+    uint64_t mem_high;      // most ever buffered in memory
+    uint64_t spill_bytes;   // waiting in the scratch file now
+    uint64_t spill_high;    // most ever waiting in the scratch file
+    uint64_t spilled;       // bytes that went through the scratch file
+};
+
+// mem_limit in bytes; the scratch file is created in dir
+struct elastic *elastic_open(size_t mem_limit, const char *dir, elastic_drain_fn fn,
+                             void *ctx);
+
+/*
+ * Append to the stream; only waits for a memory copy or a page cache write.
+ * Returns -1 once the spill file or the drain has failed: the stream has a
+ * hole and later data is refused.
+ */
+int elastic_write(struct elastic *e, const void *data, size_t len);
+
+// Drain what is left, then stop the drain thread and free everything
+void elastic_close(struct elastic *e);
+
+void elastic_get_stats(struct elastic *e, struct elastic_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
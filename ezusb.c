@@ -30,6 +30,8 @@
 
 #include "libusb.h"
 #include "ezusb.h"
+#include "probes.h"
+#include "usb.h"
 
 /*
  * This file contains functions for uploading firmware into Cypress
@@ -126,7 +128,7 @@ static int ezusb_write(libusb_device_handle *device, const char *label,
 
 	if (verbose > 1)
 		logerror("%s, addr 0x%08x len %4u (0x%04x)\n", label, addr, (unsigned)len, (unsigned)len);
-	status = libusb_control_transfer(device,
+	status = usb->control_transfer(device,
 		LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE,
 		opcode, addr & 0xFFFF, addr >> 16,
 		(unsigned char*)data, (uint16_t)len, 1000);
@@ -153,7 +155,7 @@ static int ezusb_read(libusb_device_handle *device, const char *label,
 
 	if (verbose > 1)
 		logerror("%s, addr 0x%08x len %4u (0x%04x)\n", label, addr, (unsigned)len, (unsigned)len);
-	status = libusb_control_transfer(device,
+	status = usb->control_transfer(device,
 		LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE,
 		opcode, addr & 0xFFFF, addr >> 16,
 		(unsigned char*)data, (uint16_t)len, 1000);
@@ -181,7 +183,7 @@ static bool ezusb_cpucs(libusb_device_handle *device, uint32_t addr, bool doRun)
 
 	if (verbose)
 		logerror("%s\n", data ? "stop CPU" : "reset CPU");
-	status = libusb_control_transfer(device,
+	status = usb->control_transfer(device,
 		LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE,
 		RW_INTERNAL, addr & 0xFFFF, addr >> 16,
 		&data, 1, 1000);
@@ -209,7 +211,7 @@ static bool ezusb_fx3_jump(libusb_device_handle *device, uint32_t addr)
 
 	if (verbose)
 		logerror("transfer execution to Program Entry at 0x%08x\n", addr);
-	status = libusb_control_transfer(device,
+	status = usb->control_transfer(device,
 		LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE,
 		RW_INTERNAL, addr & 0xFFFF, addr >> 16,
 		NULL, 0, 1000);
@@ -849,11 +851,13 @@ int command_send(struct libusb_device_handle *dev_handle, enum FX3Command cmd,
 
   int ret;
 
+  RX888_PROBE3(command_start, cmd, data, 0);
   /* Send the control message. */
-  ret = libusb_control_transfer(
+  ret = usb->control_transfer(
       dev_handle, LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_OUT, cmd, 0, 0,
       (unsigned char *)&data, sizeof(data), 0);
 
+  RX888_PROBE2(command_done, cmd, ret);
   if (ret < 0) {
     fprintf(stderr, "Could not send command: 0x%X with data: %d. Error : %s.\n",
             cmd, data, libusb_error_name(ret));
@@ -868,12 +872,14 @@ int argument_send(struct libusb_device_handle *dev_handle, enum ArgumentList cmd
 
   int ret;
 
+  RX888_PROBE3(command_start, SETARGFX3, data, cmd);
   /* Send the control message. */
   uint8_t zero = 0;
-  ret = libusb_control_transfer(
+  ret = usb->control_transfer(
       dev_handle, LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_OUT, SETARGFX3, data, cmd,
       (unsigned char *)&zero, sizeof(zero), 0);
 
+  RX888_PROBE2(command_done, SETARGFX3, ret);
   if (ret < 0) {
     fprintf(stderr, "Could not send argument: 0x%X with data: %d. Error : %s.\n",
             cmd, data, libusb_error_name(ret));
@@ -889,11 +895,13 @@ int control_send(struct libusb_device_handle *dev_handle, enum FX3Command cmd,
 
   int ret;
 
+  RX888_PROBE3(command_start, cmd, value, index);
   /* Send the control message. */
-  ret = libusb_control_transfer(
+  ret = usb->control_transfer(
       dev_handle, LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_OUT, cmd, value,
       index, data, length, 0);
 
+  RX888_PROBE2(command_done, cmd, ret);
   if (ret < 0) {
     fprintf(stderr, "Could not send control: 0x%X with value: 0x%X, index: 0x%X, length: %d. Error : %s.\n",
             cmd, value, index, length, libusb_error_name(ret));
@@ -909,12 +917,14 @@ int control_send_byte(struct libusb_device_handle *dev_handle,
 
   int ret;
 
+  RX888_PROBE3(command_start, cmd, value, index);
   /* Send the control message. */
   uint8_t ldata = data;
-  ret = libusb_control_transfer(
+  ret = usb->control_transfer(
       dev_handle, LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_OUT, cmd, value,
       index, &ldata, sizeof(ldata), 0);
 
+  RX888_PROBE2(command_done, cmd, ret);
   if (ret < 0) {
     fprintf(stderr, "Could not send byte control: 0x%X with value: 0x%X, index: 0x%X, data: 0x%X. Error : %s.\n",
             cmd, value, index, data, libusb_error_name(ret));
@@ -0,0 +1,343 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "gaincal.h"
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define GAINCAL_GUARD 1024 // samples skipped after a measured step
+#define GAINCAL_TIMEOUT_MS 1000
+
+static double nominal_vga(unsigned int gain) {
+    return rx888_nominal_gain_db(gain, 0);
+}
+
+static double nominal_att(unsigned int att) {
+    return rx888_nominal_gain_db(0x80, att) - rx888_nominal_gain_db(0x80, 0);
+}
+
+void gaincal_nominal(struct gaincal *gc) {
+    for (unsigned int i = 0; i < GAINCAL_VGA; i++)
+        gc->vga[i] = nominal_vga(i);
+    for (unsigned int i = 0; i < GAINCAL_ATT; i++)
+        gc->att[i] = nominal_att(i);
+    gc->measured = false;
+}
+
+double gaincal_db(const struct gaincal *gc, unsigned int gain, unsigned int att) {
+    return gc->vga[gain % GAINCAL_VGA] + gc->att[att < GAINCAL_ATT ? att : GAINCAL_ATT - 1];
+}
+
+unsigned int gaincal_vga(const struct gaincal *gc, unsigned int mode, double db) {
+    unsigned int best = mode & 0x80;
+
+    for (unsigned int v = best + 1; v < (mode & 0x80) + 0x80; v++) {
+        if (fabs(gc->vga[v] - db) < fabs(gc->vga[best] - db))
+            best = v;
+    }
+    return best;
+}
+
+// Signal power at one setting
+struct level {
+    double db; // dBFS
+    bool valid;
+};
+
+struct meter {
+    rx888_t *dev;
+    uint64_t next_tag; // first tag not looked at yet
+    uint64_t block_samples;
+};
+
+/*
+ * Look through the tags complete by a block for the one of the change
+ * just sent, and where its samples start: past its measured step, or a
+ * block past its acknowledgement when the step was too small to see.
+ */
+static bool find_tag(struct meter *m, uint64_t complete, enum ArgumentList arg, uint32_t value,
+                     uint64_t *start) {
+    struct rx888_tag tags[16];
+
+    while (m->next_tag < complete) {
+        unsigned int n = rx888_get_tags(m->dev, m->next_tag, tags, 16);
+        if (n == 0) {
+            m->next_tag = complete;
+            break;
+        }
+        for (unsigned int i = 0; i < n; i++) {
+            m->next_tag = tags[i].id + 1;
+            if (tags[i].request != SETARGFX3 || tags[i].argument != (uint32_t)arg ||
+                tags[i].value != value)
+                continue;
+            if (tags[i].effect != RX888_TAG_NO_STEP)
+                *start = tags[i].effect + GAINCAL_GUARD;
+            else
+                *start = tags[i].acked + m->block_samples;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Apply a setting and measure GAINCAL_SAMPLES of the signal after it took effect
+static int measure(struct meter *m, enum ArgumentList arg, unsigned int value, struct level *lv) {
+    uint64_t start = 0, n = 0, clipped = 0;
+    double sum = 0, sumsq = 0;
+    bool tagged = false;
+    int ret;
+
+    ret = arg == AD8340_VGA ? rx888_set_gain(m->dev, value) : rx888_set_att(m->dev, value);
+    if (ret != RX888_OK) {
+        fprintf(stderr, "Gain calibration: cannot set %s %u\n",
+                arg == AD8340_VGA ? "VGA" : "attenuation", value);
+        return -1;
+    }
+    while (n < GAINCAL_SAMPLES) {
+        struct rx888_block *block;
+        ret = rx888_lease(m->dev, &block, GAINCAL_TIMEOUT_MS);
+        if (ret == RX888_TIMEOUT)
+            fprintf(stderr, "Gain calibration: no samples from the device\n");
+        if (ret != RX888_OK)
+            return -1;
+        if (!tagged)
+            tagged = find_tag(m, block->tags, arg, value, &start);
+        if (tagged) {
+            const int16_t *s = (const int16_t *)block->data;
+            size_t len = block->length / sizeof(int16_t), i = 0;
+            if (start > block->sample_index)
+                i = start - block->sample_index < len ? start - block->sample_index : len;
+            for (; i < len && n < GAINCAL_SAMPLES; i++, n++) {
+                sum += s[i];
+                sumsq += (double)s[i] * s[i];
+                clipped += s[i] == INT16_MIN || s[i] == INT16_MAX;
+            }
+        }
+        rx888_release(m->dev, block);
+    }
+    // Variance, so that the ADC's DC offset does not count as signal
+    double mean = sum / n;
+    lv->db = 10 * log10((sumsq / n - mean * mean) / (32768.0 * 32768.0) + 1e-20);
+    lv->valid = clipped == 0 && lv->db >= GAINCAL_FLOOR_DB;
+    return 0;
+}
+
+/*
+ * Fill the settings of [first, first + count) that could not be measured
+ * from the nominal step to the nearest one that was, or to ref if none
+ * in the range was.
+ */
+static void fill(float *db, const struct level *lv, unsigned int first, unsigned int count,
+                 double (*nominal)(unsigned int), unsigned int ref) {
+    for (unsigned int i = first; i < first + count; i++) {
+        if (lv[i].valid)
+            continue;
+        unsigned int from = ref;
+        for (unsigned int d = 1; d < count; d++) {
+            if (i >= first + d && lv[i - d].valid) {
+                from = i - d;
+                break;
+            }
+            if (i + d < first + count && lv[i + d].valid) {
+                from = i + d;
+                break;
+            }
+        }
+        db[i] = db[from] + nominal(i) - nominal(from);
+    }
+}
+
+int gaincal_measure(rx888_t *dev, unsigned int gain, unsigned int att, struct gaincal *gc) {
+    struct level vga[GAINCAL_VGA], atten[GAINCAL_ATT], at_ref;
+    struct meter m = {.dev = dev, .block_samples = rx888_block_size(dev) / sizeof(int16_t)};
+    struct rx888_block *block;
+    unsigned int ref = GAINCAL_VGA, nvga = 0, natt = 0;
+    int ret = -1;
+
+    // Tags from before the calibration are not its own
+    if (rx888_lease(dev, &block, GAINCAL_TIMEOUT_MS) != RX888_OK) {
+        fprintf(stderr, "Gain calibration: no samples from the device\n");
+        return -1;
+    }
+    m.next_tag = block->tags;
+    rx888_release(dev, block);
+
+    fprintf(stderr, "Gain calibration: VGA sweep at attenuation %u\n", att);
+    for (unsigned int v = 0; v < GAINCAL_VGA; v++) {
+        if (measure(&m, AD8340_VGA, v, &vga[v]) != 0)
+            goto restore;
+        nvga += vga[v].valid;
+    }
+
+    // The loudest VGA value with room for the attenuator to go to 0, else the quietest
+    for (unsigned int v = 0; v < GAINCAL_VGA; v++) {
+        if (vga[v].valid && vga[v].db - nominal_att(att) <= GAINCAL_HEADROOM_DB &&
+            (ref == GAINCAL_VGA || vga[v].db > vga[ref].db))
+            ref = v;
+    }
+    for (unsigned int v = 0; v < GAINCAL_VGA && ref == GAINCAL_VGA; v++) {
+        if (vga[v].valid && (ref == GAINCAL_VGA || vga[v].db < vga[ref].db))
+            ref = v;
+    }
+    if (ref == GAINCAL_VGA) {
+        fprintf(stderr, "Gain calibration: the input clips or is below %.0f dBFS at every VGA "
+                "value\n", GAINCAL_FLOOR_DB);
+        goto restore;
+    }
+
+    fprintf(stderr, "Gain calibration: attenuator sweep at VGA 0x%02x, %.1f dBFS\n", ref,
+            vga[ref].db);
+    if (measure(&m, AD8340_VGA, ref, &at_ref) != 0)
+        goto restore;
+    for (unsigned int a = 0; a < GAINCAL_ATT; a++) {
+        if (measure(&m, DAT31_ATT, a, &atten[a]) != 0)
+            goto restore;
+        natt += atten[a].valid;
+    }
+
+    // Anchored to the nominal gain at (ref, att)
+    double anchor = atten[att].valid ? atten[att].db : at_ref.db;
+    for (unsigned int v = 0; v < GAINCAL_VGA; v++)
+        gc->vga[v] = vga[v].db - vga[ref].db + nominal_vga(ref);
+    for (unsigned int a = 0; a < GAINCAL_ATT; a++)
+        gc->att[a] = atten[a].db - anchor + nominal_att(att);
+    gc->att[att] = nominal_att(att);
+    atten[att].valid = true;
+    fill(gc->vga, vga, 0, 0x80, nominal_vga, ref);
+    fill(gc->vga, vga, 0x80, 0x80, nominal_vga, ref);
+    fill(gc->att, atten, 0, GAINCAL_ATT, nominal_att, att);
+    gc->measured = true;
+
+    double dev_vga = 0, dev_att = 0;
+    for (unsigned int v = 0; v < GAINCAL_VGA; v++)
+        dev_vga = fmax(dev_vga, fabs(gc->vga[v] - nominal_vga(v)));
+    for (unsigned int a = 0; a < GAINCAL_ATT; a++)
+        dev_att = fmax(dev_att, fabs(gc->att[a] - nominal_att(a)));
+    fprintf(stderr, "Gain calibration: %u of %u VGA and %u of %u attenuator values measured, "
+            "at most %.2f and %.2f dB off nominal\n", nvga, GAINCAL_VGA, natt, GAINCAL_ATT,
+            dev_vga, dev_att);
+    ret = 0;
+
+restore:
+    if (rx888_set_gain(dev, gain) != RX888_OK || rx888_set_att(dev, att) != RX888_OK)
+        ret = -1;
+    return ret;
+}
+
+const char *gaincal_default_path(char *buf, size_t size) {
+    const char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+
+    if (xdg && *xdg)
+        snprintf(buf, size, "%s/rx888/gain.cal", xdg);
+    else if (home && *home)
+        snprintf(buf, size, "%s/.cache/rx888/gain.cal", home);
+    else
+        return NULL;
+    return buf;
+}
+
+int gaincal_load(struct gaincal *gc, const char *path) {
+    bool seen[GAINCAL_VGA + GAINCAL_ATT] = {false};
+    unsigned int version = 0, count = 0, index;
+    char kind[8];
+    float db;
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL) {
+        if (errno != ENOENT)
+            fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (fscanf(f, "rx888-gaincal %u", &version) != 1 || version != 1) {
+        fprintf(stderr, "%s: not a gain table\n", path);
+        fclose(f);
+        errno = EINVAL;
+        return -1;
+    }
+    while (fscanf(f, "%7s %u %f", kind, &index, &db) == 3) {
+        if (strcmp(kind, "vga") == 0 && index < GAINCAL_VGA) {
+            gc->vga[index] = db;
+        } else if (strcmp(kind, "att") == 0 && index < GAINCAL_ATT) {
+            gc->att[index] = db;
+            index += GAINCAL_VGA;
+        } else {
+            break;
+        }
+        count += !seen[index];
+        seen[index] = true;
+    }
+    fclose(f);
+    if (count != GAINCAL_VGA + GAINCAL_ATT) {
+        fprintf(stderr, "%s: incomplete gain table\n", path);
+        gaincal_nominal(gc);
+        errno = EINVAL;
+        return -1;
+    }
+    gc->measured = true;
+    return 0;
+}
+
+// mkdir -p of the directory path is in
+static void make_parents(const char *path) {
+    char dir[4096];
+
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (char *p = dir + 1; *p; p++) {
+        if (*p != '/')
+            continue;
+        *p = '\0';
+        mkdir(dir, 0755);
+        *p = '/';
+    }
+}
+
+int gaincal_save(const struct gaincal *gc, const char *path) {
+    char tmp[4096];
+    FILE *f;
+
+    make_parents(path);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    f = fopen(tmp, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Cannot open %s: %s\n", tmp, strerror(errno));
+        return -1;
+    }
+    fprintf(f, "rx888-gaincal 1\n");
+    for (unsigned int i = 0; i < GAINCAL_VGA; i++)
+        fprintf(f, "vga %u %.3f\n", i, gc->vga[i]);
+    for (unsigned int i = 0; i < GAINCAL_ATT; i++)
+        fprintf(f, "att %u %.3f\n", i, gc->att[i]);
+    if (ferror(f) | fclose(f) || rename(tmp, path) != 0) {
+        fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
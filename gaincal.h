@@ -0,0 +1,93 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#ifndef GAINCAL_H
+#define GAINCAL_H
+
+#include "librx888.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Front end gain table: the gain in dB of every AD8340_VGA value (bit 7
+ * high gain mode) and every DAT31_ATT value, the total being their sum.
+ * gaincal_nominal() fills it from the datasheet curves behind
+ * rx888_nominal_gain_db(); gaincal_measure() measures the steps against
+ * a stable input instead. A measured table is anchored to the nominal
+ * gain at the setting it was referenced to, so both are on one scale.
+ */
+#define GAINCAL_VGA 256
+#define GAINCAL_ATT 64
+
+struct gaincal {
+    float vga[GAINCAL_VGA];
+    float att[GAINCAL_ATT];
+    bool measured;
+};
+
+#define GAINCAL_SAMPLES (1 << 18) // samples averaged per setting
+#define GAINCAL_FLOOR_DB -60.0    // dBFS: settings giving less are too close to the ADC noise
+#define GAINCAL_HEADROOM_DB -6.0  // dBFS: most the attenuator sweep may reach at DAT31_ATT 0
+
+void gaincal_nominal(struct gaincal *gc);
+
+double gaincal_db(const struct gaincal *gc, unsigned int gain, unsigned int att);
+
+// AD8340_VGA value in the gain mode of mode (bit 7) whose gain is closest to db
+unsigned int gaincal_vga(const struct gaincal *gc, unsigned int mode, double db);
+
+/*
+ * Sweep every AD8340_VGA value at attenuation att, then every DAT31_ATT
+ * value at a VGA value that leaves room for it, measuring the signal
+ * power each gives. The device must be streaming in pull mode with
+ * nothing else leasing blocks, and the input must not change while it
+ * runs. Settings where the ADC clips or the signal is below
+ * GAINCAL_FLOOR_DB are filled in from the nominal steps to the nearest
+ * measured one. gain and att are the current settings, restored at the
+ * end. Returns 0 or -1.
+ */
+int gaincal_measure(rx888_t *dev, unsigned int gain, unsigned int att, struct gaincal *gc);
+
+/*
+ * Cache file: $XDG_CACHE_HOME/rx888/gain.cal, or ~/.cache/rx888/gain.cal.
+ * Returns buf, or NULL when neither variable is set.
+ */
+const char *gaincal_default_path(char *buf, size_t size);
+
+// Returns 0, or -1 with errno ENOENT when there is no such file and a message otherwise
+int gaincal_load(struct gaincal *gc, const char *path);
+
+// Replaces path atomically, creating missing directories
+int gaincal_save(const struct gaincal *gc, const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,180 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "journal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JOURNAL_POLL_MS 20
+#define JOURNAL_BATCH 256 // records per write()
+
+struct journal_slot {
+    atomic_size_t seq; // ring position it is free for, that plus 1 once written
+    struct journal_record rec;
+};
+
+// Bounded multi-producer queue, the same scheme as the log ring in logring.c
+struct journal {
+    struct journal_slot slots[JOURNAL_RING];
+    atomic_size_t head;
+    atomic_uint_fast64_t lost;
+    atomic_bool stop;
+    int fd;
+    bool failed; // a write failed: drain and discard
+    const char *path;
+    pthread_t thread;
+
+    // Writer side
+    size_t tail;
+    struct journal_record batch[JOURNAL_BATCH];
+};
+
+void journal_post(struct journal *j, const struct journal_record *rec) {
+    size_t pos = atomic_load_explicit(&j->head, memory_order_relaxed);
+    struct journal_slot *s;
+
+    for (;;) {
+        s = &j->slots[pos % JOURNAL_RING];
+        size_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        if (seq == pos) {
+            if (atomic_compare_exchange_weak_explicit(&j->head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        } else if ((ptrdiff_t)(seq - pos) < 0) {
+            atomic_fetch_add_explicit(&j->lost, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&j->head, memory_order_relaxed);
+        }
+    }
+    s->rec = *rec;
+    atomic_store_explicit(&s->seq, pos + 1, memory_order_release);
+}
+
+static void write_all(struct journal *j, const void *buf, size_t len) {
+    const char *p = buf;
+
+    while (len > 0 && !j->failed) {
+        ssize_t n = write(j->fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            fprintf(stderr, "Writing %s: %s, journal stopped\n", j->path,
+                    n < 0 ? strerror(errno) : "short write");
+            j->failed = true;
+            return;
+        }
+        p += n;
+        len -= n;
+    }
+}
+
+// Write out every record posted so far
+static void drain(struct journal *j) {
+    for (;;) {
+        size_t n = 0;
+        for (; n < JOURNAL_BATCH; n++) {
+            struct journal_slot *s = &j->slots[j->tail % JOURNAL_RING];
+            if (atomic_load_explicit(&s->seq, memory_order_acquire) != j->tail + 1)
+                break;
+            j->batch[n] = s->rec;
+            atomic_store_explicit(&s->seq, j->tail + JOURNAL_RING, memory_order_release);
+            j->tail++;
+        }
+        if (n == 0)
+            return;
+        write_all(j, j->batch, n * sizeof(j->batch[0]));
+    }
+}
+
+static void *journal_thread(void *arg) {
+    struct journal *j = arg;
+    const struct timespec poll = {0, JOURNAL_POLL_MS * 1000000L};
+
+    while (!atomic_load(&j->stop)) {
+        nanosleep(&poll, NULL);
+        drain(j);
+    }
+    return NULL;
+}
+
+struct journal *journal_open(const char *path, struct journal_header *hdr) {
+    struct journal *j = calloc(1, sizeof(*j));
+
+    if (j == NULL)
+        return NULL;
+    for (size_t i = 0; i < JOURNAL_RING; i++)
+        atomic_init(&j->slots[i].seq, i);
+    j->path = path;
+    j->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (j->fd < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        free(j);
+        return NULL;
+    }
+    memcpy(hdr->magic, JOURNAL_MAGIC, sizeof(hdr->magic));
+    hdr->version = JOURNAL_VERSION;
+    hdr->record_size = sizeof(struct journal_record);
+    hdr->lost = 0;
+    write_all(j, hdr, sizeof(*hdr));
+    if (j->failed || pthread_create(&j->thread, NULL, journal_thread, j) != 0) {
+        if (!j->failed)
+            fprintf(stderr, "Could not start the journal writer thread\n");
+        close(j->fd);
+        free(j);
+        return NULL;
+    }
+    return j;
+}
+
+void journal_close(struct journal *j) {
+    uint64_t lost;
+
+    if (j == NULL)
+        return;
+    atomic_store(&j->stop, true);
+    pthread_join(j->thread, NULL);
+    drain(j);
+    lost = atomic_load(&j->lost);
+    if (lost) {
+        fprintf(stderr, "Journal: %llu records lost with the ring full\n",
+                (unsigned long long)lost);
+        // Not seekable (a pipe): the count is only on stderr
+        if (pwrite(j->fd, &lost, sizeof(lost), offsetof(struct journal_header, lost)) < 0)
+            j->failed = true;
+    }
+    close(j->fd);
+    free(j);
+}
@@ -0,0 +1,95 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Per-transfer journal (cfg.journal): one fixed-size record for every
+ * transfer the device completed, good or failed, for post-mortem
+ * analysis with rx888_journal. A good transfer's record is posted when
+ * its block goes back to the device, so it can say how long the
+ * application held it; records are therefore in release order, not
+ * completion order. Posting is lock free from any thread; a writer
+ * thread appends the records to the file in batches. Host byte order.
+ */
+
+#define JOURNAL_MAGIC "RX888JNL"
+#define JOURNAL_VERSION 1
+
+struct journal_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t samplerate;
+    uint32_t block_size;
+    uint32_t queuedepth;
+    uint32_t reserved;
+    uint64_t lost; // records dropped with the ring full, filled in at close
+};
+
+struct journal_record {
+    uint64_t seq;          // completion sequence number; a failure has the next good one's
+    uint64_t sample_index; // of the first sample; a failure has the next good one's
+    uint64_t time_ns;      // CLOCK_MONOTONIC time the transfer completed
+    uint32_t length;       // actual_length
+    int32_t status;        // enum libusb_transfer_status, 0 completed
+    uint32_t complete_ns;  // completion path until the block was handed over, callback included
+    uint32_t hold_ns;      // completion until the last reference was released, 0 for a failure
+    uint16_t in_flight;    // transfers still submitted at the completion
+    uint16_t ready;        // blocks waiting to be leased at the completion
+    uint16_t transfer;     // index in the transfer pool
+    uint16_t flags;        // JOURNAL_*
+};
+
+#define JOURNAL_DRAINING 1 // completed after streaming was stopped
+
+_Static_assert(sizeof(struct journal_header) == 40, "journal header layout");
+_Static_assert(sizeof(struct journal_record) == 48, "journal record layout");
+
+#define JOURNAL_RING 4096 // records posted and not yet written
+
+struct journal;
+
+// Create path and write the header; hdr's magic, version and record size are filled in
+struct journal *journal_open(const char *path, struct journal_header *hdr);
+
+// Thread safe and lock free; a record that finds the ring full is counted as lost
+void journal_post(struct journal *j, const struct journal_record *rec);
+
+// Write what is left and the lost count, and close the file
+void journal_close(struct journal *j);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,87 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Per-sample kernels on the streaming hot path, kept apart from the code
+ * that calls them so the benchmarks exercise exactly what ships.
+ */
+
+// Undo the ADC output randomizer in place: odd samples have bits 15..1 inverted
+void kernel_derandomize(int16_t *samples, size_t n);
+
+// Little endian int16 to big endian int16, as VITA-49 payloads want
+void kernel_s16_to_be16(const int16_t *in, uint16_t *out, size_t n);
+
+// int16 to float, scaled so that full scale is +-1.0
+void kernel_s16_to_f32(const int16_t *in, float *out, size_t n);
+
+/*
+ * CRC32C (Castagnoli) of len bytes, continuing from crc; start from 0.
+ * Uses the SSE4.2 or ARMv8 CRC instructions when the build targets them.
+ */
+uint32_t kernel_crc32c(uint32_t crc, const void *data, size_t len);
+
+// What the per-block kernels found
+struct kernel_block_info {
+    uint32_t crc32c;  // KERNEL_CRC32C
+    uint32_t clipped; // KERNEL_STATS: samples at either full scale code
+    int16_t min, max; // KERNEL_STATS
+};
+
+// Clip count and range of n samples into info
+void kernel_sample_stats(const int16_t *in, size_t n, struct kernel_block_info *info);
+
+/*
+ * Fused per-block pass: every enabled operation runs over one cache
+ * sized piece of the buffer before moving to the next, so the buffer
+ * comes in from memory once however many are enabled. Derandomizing
+ * happens first; the statistics and the CRC see the derandomized data.
+ */
+enum kernel_op {
+    KERNEL_DERANDOMIZE = 1,
+    KERNEL_STATS = 2,
+    KERNEL_CRC32C = 4,
+};
+
+typedef void (*kernel_fused_fn)(int16_t *samples, size_t n, struct kernel_block_info *info);
+
+// The pass specialized for a combination of kernel_op flags, NULL for none
+kernel_fused_fn kernel_fused_select(unsigned int ops);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1269 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "librx888.h"
+#include "librx888_internal.h"
+#include "ezusb.h"
+#include "journal.h"
+#include "kernels.h"
+#include "logring.h"
+#include "probes.h"
+#include "trace.h"
+#include "usb.h"
+#include <endian.h>
+#include <libusb.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RX888_VID 0x04b4
+#define RX888_PID_BOOT 0x00f3   // FX3 bootloader, needs firmware
+#define RX888_PID_STREAM 0x00f1 // SDDC firmware running
+
+#define SYNTH_PKTSIZE 16384 // wMaxPacketSize 1024 * bMaxBurst 16 on a USB 3 link
+
+// Hold latency histogram: 8 buckets per power of two of ns
+#define LATENCY_BUCKETS (62 * 8)
+
+// Configuration change tags, see struct rx888_tag
+#define TAG_WINDOW 64       // samples per power measurement
+#define TAG_MIN_STEP_DB 0.5 // smaller steps are not reported
+#define TAG_MIN_SCORE 10.0  // step over the noise of the window powers
+
+enum tag_state {
+    TAG_SENDING, // command in flight
+    TAG_DETECT,  // collecting window powers around it
+    TAG_DONE,
+};
+
+struct tag_slot {
+    struct rx888_tag tag;
+    enum tag_state state;
+    uint64_t start; // first sample not yet completed when it was issued
+    uint64_t from;  // window powers cover [from, to)
+    uint64_t to;
+    float *power;
+    size_t windows;
+};
+
+// Verbosity level, shared with ezusb.c
+int verbose;
+
+struct rx888 {
+    struct rx888_config cfg;
+    struct libusb_device_handle *dev_handle;
+    struct libusb_config_descriptor *config;
+    int interface_number;
+    unsigned int ep;
+    unsigned int pktsize;
+    size_t block_size;
+
+    struct libusb_transfer **transfers;
+    struct rx888_block *blocks;
+    atomic_uint *refs; // references held on each block by the application
+
+    atomic_bool stop_transfers;
+    atomic_int xfers_in_progress;
+    atomic_int xfers_low; // fewest transfers left in flight at a completion
+    bool claimed;
+    bool logging; // holds a logring_start()
+    bool started;
+
+    rx888_callback callback;
+    void *callback_ctx;
+
+    // Pull mode: completed blocks waiting for rx888_lease(), in order
+    pthread_mutex_t ready_lock;
+    struct rx888_block **ready;
+    unsigned int ready_head;
+    unsigned int ready_count;
+
+    uint64_t seq;
+    uint64_t sample_index;
+    atomic_uint_fast64_t success_count;
+    atomic_uint_fast64_t failure_count;
+    atomic_uint_fast64_t bytes;
+    atomic_uint_fast64_t latency[LATENCY_BUCKETS];
+
+    // cfg.journal: completion side of each block's record, finished when it is released
+    struct journal *journal;
+    struct journal_record *journal_recs;
+
+    // Per-block kernels, one fused pass picked for the configuration in rx888_start()
+    kernel_fused_fn block_pass;
+    // Completion chain specialized for the configuration, see complete_select()
+    void (*complete)(struct rx888 *dev, struct rx888_block *block, size_t length);
+    atomic_uint_fast64_t clipped;
+    atomic_uint peak;
+
+    // Stream clock: index after the last completed block and its time, under a seqlock
+    atomic_uint clock_seq;
+    atomic_uint_fast64_t clock_index;
+    atomic_uint_fast64_t clock_ns;
+
+    // Configuration change tags; ids below tags_done are complete
+    pthread_mutex_t tag_lock;
+    struct tag_slot tags[RX888_TAG_RING];
+    uint64_t tags_issued;
+    atomic_uint_fast64_t tags_done;
+    atomic_uint tags_detecting;
+
+    // Synthetic source: submitted blocks in order, completed blocks for the event loop
+    pthread_t producer;
+    bool producing;
+    pthread_mutex_t synth_lock;
+    pthread_cond_t synth_cond;
+    unsigned int *submitted;
+    unsigned int submitted_head;
+    unsigned int submitted_count;
+    unsigned int *completed;
+    unsigned int completed_head;
+    unsigned int completed_count;
+    atomic_uint_fast64_t overruns;
+    atomic_uint_fast64_t lost_samples; // overrun samples not yet reflected in sample_index
+};
+
+void rx888_config_init(struct rx888_config *cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->samplerate = 32000000;
+    cfg->gain = 0x80;
+    cfg->att = 0;
+    cfg->queuedepth = 16;
+    cfg->reqsize = 8;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void synth_submit(rx888_t *dev, unsigned int i) {
+    pthread_mutex_lock(&dev->synth_lock);
+    dev->submitted[(dev->submitted_head + dev->submitted_count) % dev->cfg.queuedepth] = i;
+    dev->submitted_count++;
+    pthread_mutex_unlock(&dev->synth_lock);
+}
+
+static void resubmit(rx888_t *dev, unsigned int i) {
+    if (atomic_load(&dev->stop_transfers))
+        return;
+    trace_instant("resubmit", dev->blocks[i].seq);
+    RX888_PROBE2(transfer_resubmit, i, dev->blocks[i].seq);
+    if (dev->cfg.synthetic) {
+        atomic_fetch_add(&dev->xfers_in_progress, 1);
+        synth_submit(dev, i);
+    } else {
+        int ret = usb->submit_transfer(dev->transfers[i]);
+        if (ret == 0)
+            atomic_fetch_add(&dev->xfers_in_progress, 1);
+        else
+            logring_post(LOGRING_ERROR, "Resubmitting transfer %u failed: %s", i,
+                         libusb_error_name(ret));
+    }
+}
+
+static void block_stats(rx888_t *dev, const struct kernel_block_info *info) {
+    unsigned int peak = -(int)info->min > info->max ? -(int)info->min : info->max;
+    unsigned int seen = atomic_load(&dev->peak);
+
+    if (info->clipped)
+        atomic_fetch_add(&dev->clipped, info->clipped);
+    while (peak > seen && !atomic_compare_exchange_weak(&dev->peak, &seen, peak))
+        ;
+}
+
+static void clock_set(rx888_t *dev, uint64_t index, uint64_t ns) {
+    unsigned int seq = atomic_load_explicit(&dev->clock_seq, memory_order_relaxed);
+
+    atomic_store_explicit(&dev->clock_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&dev->clock_index, index, memory_order_relaxed);
+    atomic_store_explicit(&dev->clock_ns, ns, memory_order_relaxed);
+    atomic_store_explicit(&dev->clock_seq, seq + 2, memory_order_release);
+}
+
+// Stream index of the sample being taken now, from the last completed block, which ends at *last
+static uint64_t clock_now(rx888_t *dev, uint64_t *last) {
+    unsigned int seq;
+    uint64_t index, ns, now;
+
+    do {
+        seq = atomic_load_explicit(&dev->clock_seq, memory_order_acquire);
+        index = atomic_load_explicit(&dev->clock_index, memory_order_relaxed);
+        ns = atomic_load_explicit(&dev->clock_ns, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || seq != atomic_load_explicit(&dev->clock_seq, memory_order_relaxed));
+
+    now = now_ns();
+    if (last)
+        *last = index;
+    if (ns == 0 || now <= ns)
+        return index;
+    return index + (uint64_t)((now - ns) * (double)dev->cfg.samplerate / 1e9);
+}
+
+// Move tags_done past every complete tag; called with tag_lock held
+static void tags_advance(rx888_t *dev) {
+    uint64_t done = atomic_load(&dev->tags_done);
+
+    while (done < dev->tags_issued && dev->tags[done % RX888_TAG_RING].state == TAG_DONE)
+        done++;
+    atomic_store(&dev->tags_done, done);
+}
+
+static void tag_finish(rx888_t *dev, struct tag_slot *t, uint64_t effect, float step_db) {
+    t->tag.effect = effect;
+    t->tag.step_db = step_db;
+    if (t->state == TAG_DETECT)
+        atomic_fetch_sub(&dev->tags_detecting, 1);
+    t->state = TAG_DONE;
+    free(t->power);
+    t->power = NULL;
+}
+
+// Record a change about to be sent; returns its id
+static uint64_t tag_issue(rx888_t *dev, uint32_t request, uint32_t argument, uint64_t value) {
+    pthread_mutex_lock(&dev->tag_lock);
+    uint64_t id = dev->tags_issued++;
+    struct tag_slot *t = &dev->tags[id % RX888_TAG_RING];
+
+    // A full ring gives up on the oldest change rather than blocking the caller
+    if (id >= RX888_TAG_RING && t->state != TAG_DONE)
+        tag_finish(dev, t, RX888_TAG_NO_STEP, 0);
+    tags_advance(dev);
+    uint64_t issued = clock_now(dev, &t->start);
+    t->tag = (struct rx888_tag){
+        .id = id,
+        .request = request,
+        .argument = argument,
+        .value = value,
+        .time_ns = now_ns(),
+        .issued = issued,
+        .effect = RX888_TAG_NO_STEP,
+    };
+    t->state = TAG_SENDING;
+    pthread_mutex_unlock(&dev->tag_lock);
+    return id;
+}
+
+/*
+ * The command behind a tag returned: look for its step from the first
+ * sample still to come when it was sent to two transfers, and at least
+ * 10 ms, after the acknowledgement.
+ */
+static void tag_acked(rx888_t *dev, uint64_t id, int status) {
+    uint64_t span = dev->block_size / sizeof(int16_t);
+    uint64_t after = 2 * span > dev->cfg.samplerate / 100 ? 2 * span : dev->cfg.samplerate / 100;
+
+    pthread_mutex_lock(&dev->tag_lock);
+    struct tag_slot *t = &dev->tags[id % RX888_TAG_RING];
+    if (t->tag.id != id || t->state != TAG_SENDING) {
+        pthread_mutex_unlock(&dev->tag_lock);
+        return;
+    }
+    t->tag.status = status;
+    t->tag.acked = clock_now(dev, NULL);
+    if (status != RX888_OK || dev->cfg.synthetic) {
+        // Nothing changed in the signal
+        tag_finish(dev, t, RX888_TAG_NO_STEP, 0);
+        tags_advance(dev);
+    } else {
+        t->from = t->start;
+        t->windows = (t->tag.acked + after - t->from) / TAG_WINDOW;
+        t->to = t->from + t->windows * TAG_WINDOW;
+        t->power = calloc(t->windows, sizeof(*t->power));
+        if (t->power == NULL) {
+            tag_finish(dev, t, RX888_TAG_NO_STEP, 0);
+            tags_advance(dev);
+        } else {
+            t->state = TAG_DETECT;
+            atomic_fetch_add(&dev->tags_detecting, 1);
+        }
+    }
+    pthread_mutex_unlock(&dev->tag_lock);
+}
+
+/*
+ * Locate the step: the split of the window powers (in dB) into a before
+ * and an after that explains most of their variance. It counts when the
+ * means differ by TAG_MIN_STEP_DB and the split stands TAG_MIN_SCORE
+ * standard errors clear of the window noise.
+ */
+static void tag_locate(rx888_t *dev, struct tag_slot *t) {
+    size_t n = t->windows;
+    double sum = 0, sq = 0, best = 0, best_step = 0;
+    size_t split = 0;
+
+    for (size_t w = 0; w < n; w++) {
+        double db = 10 * log10(t->power[w] / TAG_WINDOW + 1e-3);
+        t->power[w] = (float)db;
+        sum += db;
+        sq += db * db;
+    }
+    double left = 0;
+    for (size_t s = 1; s + 1 < n; s++) {
+        left += t->power[s - 1];
+        double ma = left / s, mb = (sum - left) / (n - s);
+        double between = (double)s * (n - s) / n * (mb - ma) * (mb - ma);
+        if (between > best) {
+            best = between;
+            best_step = mb - ma;
+            split = s;
+        }
+    }
+    // best / within is the squared t statistic of the step
+    double within = (sq - sum * sum / n - best) / (n > 2 ? n - 2 : 1);
+    bool clear = within <= 0 || best / within >= TAG_MIN_SCORE * TAG_MIN_SCORE;
+    if (split && fabs(best_step) >= TAG_MIN_STEP_DB && clear)
+        tag_finish(dev, t, t->from + split * TAG_WINDOW, (float)best_step);
+    else
+        tag_finish(dev, t, RX888_TAG_NO_STEP, 0);
+}
+
+// Completion path, while any tag is collecting: add the block to their window powers
+static void tags_detect(rx888_t *dev, const struct rx888_block *block) {
+    const int16_t *s = (const int16_t *)block->data;
+    uint64_t base = block->sample_index;
+    uint64_t end = base + block->length / sizeof(int16_t);
+
+    pthread_mutex_lock(&dev->tag_lock);
+    for (uint64_t id = atomic_load(&dev->tags_done); id < dev->tags_issued; id++) {
+        struct tag_slot *t = &dev->tags[id % RX888_TAG_RING];
+        if (t->state != TAG_DETECT)
+            continue;
+        uint64_t from = base > t->from ? base : t->from;
+        uint64_t to = end < t->to ? end : t->to;
+        for (uint64_t i = from; i < to;) {
+            size_t w = (i - t->from) / TAG_WINDOW;
+            uint64_t stop = t->from + (w + 1) * TAG_WINDOW;
+            if (stop > to)
+                stop = to;
+            float acc = 0;
+            for (; i < stop; i++)
+                acc += (float)s[i - base] * s[i - base];
+            t->power[w] += acc;
+        }
+        if (end >= t->to)
+            tag_locate(dev, t);
+    }
+    tags_advance(dev);
+    pthread_mutex_unlock(&dev->tag_lock);
+}
+
+unsigned int rx888_get_tags(rx888_t *dev, uint64_t first, struct rx888_tag *tags,
+                            unsigned int max) {
+    unsigned int n = 0;
+
+    pthread_mutex_lock(&dev->tag_lock);
+    uint64_t done = atomic_load(&dev->tags_done);
+    if (done > RX888_TAG_RING && first < done - RX888_TAG_RING)
+        first = done - RX888_TAG_RING;
+    for (; first < done && n < max; first++)
+        tags[n++] = dev->tags[first % RX888_TAG_RING].tag;
+    pthread_mutex_unlock(&dev->tag_lock);
+    return n;
+}
+
+// Durations in journal records saturate at about 4.3 s
+static uint32_t journal_ns(uint64_t ns) {
+    return ns < UINT32_MAX ? ns : UINT32_MAX;
+}
+
+// Steps of the completion chain, fixed for a run by complete_select()
+enum {
+    CHAIN_PASS = 1,     // run dev->block_pass over the samples
+    CHAIN_STATS = 2,    // account clipped samples and peak, needs CHAIN_PASS
+    CHAIN_CALLBACK = 4, // hand the block to dev->callback, else park it for rx888_lease()
+    CHAIN_JOURNAL = 8,  // start the block's journal record
+};
+
+/*
+ * Common completion path for libusb and the synthetic source. chain is a
+ * compile time constant in every instantiation below, so each one carries
+ * only the steps its configuration needs and no per-block option tests.
+ */
+static inline __attribute__((always_inline))
+void complete_chain(rx888_t *dev, struct rx888_block *block, size_t length,
+                    const unsigned int chain) {
+    int in_flight = atomic_fetch_sub(&dev->xfers_in_progress, 1) - 1;
+    // Draining after a stop is not starvation
+    if (in_flight < atomic_load(&dev->xfers_low) && !atomic_load(&dev->stop_transfers))
+        atomic_store(&dev->xfers_low, in_flight);
+
+    atomic_fetch_add(&dev->success_count, 1);
+    atomic_fetch_add(&dev->bytes, length);
+
+    block->length = length;
+    block->seq = dev->seq++;
+    dev->sample_index += atomic_exchange(&dev->lost_samples, 0);
+    block->sample_index = dev->sample_index;
+    dev->sample_index += block->length / sizeof(int16_t);
+    trace_instant("complete", block->seq);
+    RX888_PROBE4(transfer_complete, block - dev->blocks, 0, length, block->seq);
+
+    if (chain & CHAIN_PASS) {
+        struct kernel_block_info info = {0};
+        trace_begin("kernels", block->seq);
+        dev->block_pass((int16_t *)block->data, block->length / sizeof(int16_t), &info);
+        trace_end("kernels", block->seq);
+        block->crc32c = info.crc32c;
+        if ((chain & CHAIN_STATS) && block->length > 0)
+            block_stats(dev, &info);
+    }
+
+    clock_set(dev, dev->sample_index, block->time_ns);
+    if (atomic_load_explicit(&dev->tags_detecting, memory_order_relaxed))
+        tags_detect(dev, block);
+    block->tags = atomic_load_explicit(&dev->tags_done, memory_order_relaxed);
+
+    struct journal_record *rec = NULL;
+    if (chain & CHAIN_JOURNAL) {
+        rec = &dev->journal_recs[block - dev->blocks];
+        *rec = (struct journal_record){
+            .seq = block->seq,
+            .sample_index = block->sample_index,
+            .time_ns = block->time_ns,
+            .length = length,
+            .in_flight = in_flight,
+            .ready = dev->ready_count,
+            .transfer = block - dev->blocks,
+            .flags = atomic_load(&dev->stop_transfers) ? JOURNAL_DRAINING : 0,
+        };
+    }
+
+    // The library's reference, handed to the callback or the leaseholder
+    atomic_store(&dev->refs[block - dev->blocks], 1);
+
+    if (chain & CHAIN_CALLBACK) {
+        trace_begin("callback", block->seq);
+        if (dev->callback(block, dev->callback_ctx) != 0)
+            atomic_store(&dev->stop_transfers, true);
+        trace_end("callback", block->seq);
+        if (chain & CHAIN_JOURNAL)
+            rec->complete_ns = journal_ns(now_ns() - block->time_ns);
+        rx888_release(dev, block);
+        return;
+    }
+
+    // Pull mode: park the block until the application leases it
+    if (chain & CHAIN_JOURNAL)
+        rec->complete_ns = journal_ns(now_ns() - block->time_ns);
+    pthread_mutex_lock(&dev->ready_lock);
+    unsigned int tail = (dev->ready_head + dev->ready_count) % dev->cfg.queuedepth;
+    dev->ready[tail] = block;
+    dev->ready_count++;
+    pthread_mutex_unlock(&dev->ready_lock);
+}
+
+#define COMPLETE(chain)                                                             \
+    static void complete_##chain(rx888_t *dev, struct rx888_block *block, size_t length) { \
+        complete_chain(dev, block, length, chain);                                  \
+    }
+COMPLETE(0)
+COMPLETE(1)
+COMPLETE(3)
+COMPLETE(4)
+COMPLETE(5)
+COMPLETE(7)
+COMPLETE(8)
+COMPLETE(9)
+COMPLETE(11)
+COMPLETE(12)
+COMPLETE(13)
+COMPLETE(15)
+#undef COMPLETE
+
+// Pick the completion chain for the configuration and mode, once per run
+static void complete_select(rx888_t *dev) {
+    static void (*const table[16])(rx888_t *, struct rx888_block *, size_t) = {
+        complete_0, complete_1, complete_0, complete_3,
+        complete_4, complete_5, complete_4, complete_7,
+        complete_8, complete_9, complete_8, complete_11,
+        complete_12, complete_13, complete_12, complete_15,
+    };
+    unsigned int chain = 0;
+
+    if (dev->block_pass) {
+        chain |= CHAIN_PASS;
+        if (dev->cfg.sample_stats)
+            chain |= CHAIN_STATS;
+    }
+    if (dev->callback)
+        chain |= CHAIN_CALLBACK;
+    if (dev->journal)
+        chain |= CHAIN_JOURNAL;
+    dev->complete = table[chain];
+}
+
+// The chain with every option tested per block, the baseline rx888_bench times against
+static void complete_checked(rx888_t *dev, struct rx888_block *block, size_t length) {
+    unsigned int chain = 0;
+
+    if (dev->block_pass) {
+        chain |= CHAIN_PASS;
+        if (dev->cfg.sample_stats)
+            chain |= CHAIN_STATS;
+    }
+    if (dev->callback)
+        chain |= CHAIN_CALLBACK;
+    if (dev->journal)
+        chain |= CHAIN_JOURNAL;
+    complete_chain(dev, block, length, chain);
+}
+
+static void LIBUSB_CALL transfer_callback(struct libusb_transfer *transfer) {
+    struct rx888_block *block = transfer->user_data;
+    rx888_t *dev = block->priv;
+
+    block->time_ns = now_ns();
+    if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+        RX888_PROBE4(transfer_complete, block - dev->blocks, transfer->status,
+                     transfer->actual_length, dev->seq);
+        int in_flight = atomic_fetch_sub(&dev->xfers_in_progress, 1) - 1;
+        atomic_fetch_add(&dev->failure_count, 1);
+        if (dev->journal) {
+            struct journal_record rec = {
+                .seq = dev->seq,
+                .sample_index = dev->sample_index,
+                .time_ns = block->time_ns,
+                .length = transfer->actual_length,
+                .status = transfer->status,
+                .in_flight = in_flight,
+                .ready = dev->ready_count,
+                .transfer = block - dev->blocks,
+                .flags = atomic_load(&dev->stop_transfers) ? JOURNAL_DRAINING : 0,
+            };
+            journal_post(dev->journal, &rec);
+        }
+        logring_post(LOGRING_ERROR, "Transfer callback status %s received %d bytes.",
+                     libusb_error_name(transfer->status), transfer->actual_length);
+        resubmit(dev, block - dev->blocks);
+        return;
+    }
+    if ((size_t)transfer->actual_length < dev->block_size)
+        logring_post(LOGRING_INFO, "Short transfer: %d of %zu bytes", transfer->actual_length,
+                     dev->block_size);
+    dev->complete(dev, block, transfer->actual_length);
+}
+
+/*
+ * Synthetic source: plays the part of the FX3 and libusb. Every block
+ * period it completes the oldest submitted transfer, or counts an
+ * overrun when the application holds them all, as the FX3 would lose
+ * data then. Completions are handed to whoever handles events, like
+ * libusb does, so the completion path runs on the same thread.
+ */
+static void *synth_producer(void *arg) {
+    rx888_t *dev = arg;
+    struct timespec next;
+    uint64_t t;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    t = (uint64_t)next.tv_sec * 1000000000ULL + next.tv_nsec;
+    for (;;) {
+        // Read every period so rx888_set_samplerate() takes effect
+        t += (uint64_t)(dev->block_size / sizeof(int16_t)) * 1000000000ULL /
+             dev->cfg.samplerate;
+        next.tv_sec = t / 1000000000ULL;
+        next.tv_nsec = t % 1000000000ULL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        pthread_mutex_lock(&dev->synth_lock);
+        if (dev->submitted_count == 0) {
+            bool done = atomic_load(&dev->stop_transfers);
+            pthread_mutex_unlock(&dev->synth_lock);
+            if (done)
+                break;
+            atomic_fetch_add(&dev->overruns, 1);
+            RX888_PROBE1(overrun, dev->block_size / sizeof(int16_t));
+            atomic_fetch_add(&dev->lost_samples, dev->block_size / sizeof(int16_t));
+            continue;
+        }
+        unsigned int i = dev->submitted[dev->submitted_head];
+        dev->submitted_head = (dev->submitted_head + 1) % dev->cfg.queuedepth;
+        dev->submitted_count--;
+        dev->blocks[i].time_ns = t;
+        dev->completed[(dev->completed_head + dev->completed_count) % dev->cfg.queuedepth] = i;
+        dev->completed_count++;
+        pthread_cond_signal(&dev->synth_cond);
+        pthread_mutex_unlock(&dev->synth_lock);
+    }
+    return NULL;
+}
+
+static int synth_handle_events(rx888_t *dev, int timeout_ms) {
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&dev->synth_lock);
+    while (dev->completed_count == 0) {
+        if (pthread_cond_timedwait(&dev->synth_cond, &dev->synth_lock, &deadline) != 0)
+            break;
+    }
+    while (dev->completed_count > 0) {
+        unsigned int i = dev->completed[dev->completed_head];
+        dev->completed_head = (dev->completed_head + 1) % dev->cfg.queuedepth;
+        dev->completed_count--;
+        pthread_mutex_unlock(&dev->synth_lock);
+        dev->complete(dev, &dev->blocks[i], dev->block_size);
+        pthread_mutex_lock(&dev->synth_lock);
+    }
+    pthread_mutex_unlock(&dev->synth_lock);
+    return RX888_OK;
+}
+
+// Noise at a realistic level, randomized like the ADC would when asked to
+static void synth_fill(rx888_t *dev) {
+    uint32_t x = 2463534242u;
+
+    for (unsigned int b = 0; b < dev->cfg.queuedepth; b++) {
+        int16_t *s = (int16_t *)dev->blocks[b].data;
+        for (size_t i = 0; i < dev->block_size / sizeof(int16_t); i++) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            s[i] = (int16_t)(x >> 16) >> 4;
+            if (dev->cfg.randomizer && (s[i] & 1))
+                s[i] ^= (int16_t)0xfffe;
+        }
+    }
+}
+
+// Find the RX888, uploading firmware to a bootloader-mode device first
+static int find_device(rx888_t *dev) {
+    libusb_device **devs;
+    ssize_t list;
+    int ret;
+
+search:
+    list = usb->get_device_list(NULL, &devs);
+    if (list < 0) {
+        fprintf(stderr, "Error in getting device list\n");
+        return RX888_ERROR;
+    }
+
+    for (ssize_t i = 0; i < list && dev->dev_handle == NULL; i++) {
+        struct libusb_device_descriptor desc;
+        ret = usb->get_device_descriptor(devs[i], &desc);
+        if (ret < 0) {
+            fprintf(stderr, "unable to get device descriptor\n");
+            continue;
+        }
+        if (desc.idVendor != RX888_VID)
+            continue;
+
+        if (desc.idProduct == RX888_PID_BOOT) {
+            struct libusb_device_handle *boot_handle = NULL;
+            if (dev->cfg.firmware == NULL) {
+                fprintf(stderr, "Device needs firmware, use --firmware\n");
+                continue;
+            }
+            ret = usb->open(devs[i], &boot_handle);
+            if (ret != 0) {
+                fprintf(stderr, "Error or device could not be found: error %s\n",
+                        libusb_error_name(ret));
+                continue;
+            }
+            ret = ezusb_load_ram(boot_handle, dev->cfg.firmware, FX_TYPE_FX3,
+                                 IMG_TYPE_IMG, 1);
+            usb->close(boot_handle);
+            if (ret == 0) {
+                fprintf(stderr, "Firmware updated\n");
+                usb->free_device_list(devs, 1);
+                sleep(3);
+                goto search;
+            }
+            fprintf(stderr, "Firmware upload failed for device\n");
+        }
+        if (desc.idProduct == RX888_PID_STREAM) {
+            ret = usb->open(devs[i], &dev->dev_handle);
+            if (ret != 0) {
+                fprintf(stderr, "Error opening device: %s\n", libusb_error_name(ret));
+                dev->dev_handle = NULL;
+                continue;
+            }
+            ret = usb->kernel_driver_active(dev->dev_handle, 0);
+            if (ret != 0) {
+                fprintf(stderr,
+                        "Kernel driver active. Trying to detach kernel driver\n");
+                ret = usb->detach_kernel_driver(dev->dev_handle, 0);
+                if (ret != 0) {
+                    fprintf(stderr,
+                            "Could not detach kernel driver from an interface\n");
+                    usb->close(dev->dev_handle);
+                    dev->dev_handle = NULL;
+                }
+            }
+        }
+    }
+    usb->free_device_list(devs, 1);
+
+    if (dev->dev_handle == NULL) {
+        fprintf(stderr, "Error or device could not be found, try loading firmware\n");
+        return RX888_ERROR;
+    }
+    return RX888_OK;
+}
+
+static int alloc_transfers(rx888_t *dev) {
+    unsigned int queuedepth = dev->cfg.queuedepth;
+
+    dev->transfers = calloc(queuedepth, sizeof(struct libusb_transfer *));
+    dev->blocks = calloc(queuedepth, sizeof(struct rx888_block));
+    dev->ready = calloc(queuedepth, sizeof(struct rx888_block *));
+    dev->refs = calloc(queuedepth, sizeof(atomic_uint));
+    dev->submitted = calloc(queuedepth, sizeof(unsigned int));
+    dev->completed = calloc(queuedepth, sizeof(unsigned int));
+    if (dev->transfers == NULL || dev->blocks == NULL || dev->ready == NULL ||
+        dev->refs == NULL || dev->submitted == NULL || dev->completed == NULL) {
+        fprintf(stderr, "Could not allocate memory for transfer structures\n");
+        return RX888_ERROR;
+    }
+
+    for (unsigned int i = 0; i < queuedepth; i++) {
+        dev->blocks[i].data = malloc(dev->block_size);
+        dev->blocks[i].priv = dev;
+        if (dev->blocks[i].data == NULL) {
+            fprintf(stderr, "Could not allocate memory for data buffers\n");
+            return RX888_ERROR;
+        }
+        if (dev->cfg.synthetic)
+            continue;
+        dev->transfers[i] = usb->alloc_transfer(0);
+        if (dev->transfers[i] == NULL) {
+            fprintf(stderr, "Could not allocate memory for data buffers\n");
+            return RX888_ERROR;
+        }
+        libusb_fill_bulk_transfer(dev->transfers[i], dev->dev_handle, dev->ep,
+                                  dev->blocks[i].data, dev->block_size,
+                                  transfer_callback, &dev->blocks[i], 0);
+    }
+    return RX888_OK;
+}
+
+// Free data buffers and transfer structures
+static void free_transfers(rx888_t *dev) {
+    for (unsigned int i = 0; i < dev->cfg.queuedepth; i++) {
+        if (dev->transfers && dev->transfers[i])
+            usb->free_transfer(dev->transfers[i]);
+        if (dev->blocks)
+            free(dev->blocks[i].data);
+    }
+    free(dev->transfers);
+    free(dev->blocks);
+    free(dev->ready);
+    free(dev->refs);
+    free(dev->submitted);
+    free(dev->completed);
+    dev->refs = NULL;
+    dev->submitted = NULL;
+    dev->completed = NULL;
+    dev->transfers = NULL;
+    dev->blocks = NULL;
+    dev->ready = NULL;
+}
+
+int rx888_open(rx888_t **devp, const struct rx888_config *cfg) {
+    struct libusb_endpoint_descriptor const *endpointDesc;
+    struct libusb_ss_endpoint_companion_descriptor *ep_comp;
+    struct libusb_interface_descriptor const *interfaceDesc;
+    rx888_t *dev;
+    int ret;
+
+    *devp = NULL;
+    if (cfg->queuedepth < 1 || cfg->reqsize < 1) {
+        fprintf(stderr, "Invalid queue depth or request size\n");
+        return RX888_ERROR;
+    }
+
+    dev = calloc(1, sizeof(*dev));
+    if (dev == NULL)
+        return RX888_ERROR;
+    dev->cfg = *cfg;
+    dev->ep = 1 | LIBUSB_ENDPOINT_IN;
+    pthread_mutex_init(&dev->ready_lock, NULL);
+    pthread_mutex_init(&dev->synth_lock, NULL);
+    pthread_mutex_init(&dev->tag_lock, NULL);
+    pthread_cond_init(&dev->synth_cond, NULL);
+    // Without the drain thread messages are printed as they come
+    dev->logging = logring_start() == 0;
+
+    if (cfg->synthetic) {
+        *devp = dev;
+        dev->pktsize = cfg->pktsize ? cfg->pktsize : SYNTH_PKTSIZE;
+        dev->block_size = (size_t)dev->cfg.reqsize * dev->pktsize;
+        fprintf(stderr, "Synthetic source, Queue depth: %d, Request size: %zu\n",
+                dev->cfg.queuedepth, dev->block_size);
+        if (alloc_transfers(dev) != RX888_OK)
+            return RX888_ERROR;
+        synth_fill(dev);
+        return RX888_OK;
+    }
+
+    usb = &usb_libusb;
+    if (cfg->sim) {
+        struct usb_sim_config sim;
+        if (usb_sim_parse(&sim, cfg->sim) == 0) {
+            usb = usb_sim_init(&sim);
+            fprintf(stderr, "Using %s\n", usb->name);
+        } else {
+            usb = NULL;
+        }
+    }
+
+    ret = usb ? usb->init(NULL) : LIBUSB_ERROR_INVALID_PARAM;
+    if (ret != 0) {
+        fprintf(stderr, "Error initializing libusb: %s\n",
+                libusb_error_name(ret));
+        usb = &usb_libusb;
+        pthread_mutex_destroy(&dev->ready_lock);
+        pthread_mutex_destroy(&dev->synth_lock);
+        pthread_mutex_destroy(&dev->tag_lock);
+        pthread_cond_destroy(&dev->synth_cond);
+        if (dev->logging)
+            logring_stop();
+        free(dev);
+        return RX888_ERROR;
+    }
+    *devp = dev;
+
+    if (find_device(dev) != RX888_OK)
+        return RX888_ERROR;
+
+    sleep(1);
+    ret = usb->get_config_descriptor(usb->get_device(dev->dev_handle), 0,
+                                       &dev->config);
+    if (ret != 0) {
+        fprintf(stderr, "Error reading config descriptor: %s\n",
+                libusb_error_name(ret));
+        dev->config = NULL;
+        return RX888_ERROR;
+    }
+
+    ret = usb->claim_interface(dev->dev_handle, dev->interface_number);
+    if (ret != 0) {
+        fprintf(stderr, "Error claiming interface, error: %s\n",
+                libusb_error_name(ret));
+        return RX888_ERROR;
+    }
+    dev->claimed = true;
+    fprintf(stderr, "Successfully claimed interface\n");
+
+    interfaceDesc = &(dev->config->interface[0].altsetting[0]);
+    endpointDesc = &interfaceDesc->endpoint[0];
+
+    ret = usb->get_ss_endpoint_companion_descriptor(NULL, endpointDesc, &ep_comp);
+    if (ret != 0) {
+        fprintf(stderr, "Error reading SuperSpeed endpoint companion descriptor: %s\n",
+                libusb_error_name(ret));
+        return RX888_ERROR;
+    }
+    dev->pktsize = endpointDesc->wMaxPacketSize * (ep_comp->bMaxBurst + 1);
+    usb->free_ss_endpoint_companion_descriptor(ep_comp);
+
+    dev->block_size = (size_t)dev->cfg.reqsize * dev->pktsize;
+    fprintf(stderr, "Queue depth: %d, Request size: %zu\n", dev->cfg.queuedepth,
+            dev->block_size);
+
+    return alloc_transfers(dev);
+}
+
+static void pass_select(rx888_t *dev) {
+    dev->block_pass = kernel_fused_select((dev->cfg.randomizer ? KERNEL_DERANDOMIZE : 0) |
+                                          (dev->cfg.sample_stats ? KERNEL_STATS : 0) |
+                                          (dev->cfg.block_crc ? KERNEL_CRC32C : 0));
+}
+
+int rx888_start(rx888_t *dev) {
+    uint32_t gpio = 0;
+
+    pass_select(dev);
+    if (dev->cfg.journal) {
+        struct journal_header hdr = {
+            .samplerate = dev->cfg.samplerate,
+            .block_size = dev->block_size,
+            .queuedepth = dev->cfg.queuedepth,
+        };
+        dev->journal_recs = calloc(dev->cfg.queuedepth, sizeof(*dev->journal_recs));
+        if (dev->journal_recs == NULL ||
+            (dev->journal = journal_open(dev->cfg.journal, &hdr)) == NULL)
+            return RX888_ERROR;
+    }
+    complete_select(dev);
+
+    if (dev->cfg.synthetic) {
+        for (unsigned int i = 0; i < dev->cfg.queuedepth; i++)
+            resubmit(dev, i);
+        atomic_store(&dev->xfers_low, atomic_load(&dev->xfers_in_progress));
+        if (pthread_create(&dev->producer, NULL, synth_producer, dev) != 0) {
+            fprintf(stderr, "Could not start the synthetic source\n");
+            return RX888_ERROR;
+        }
+        dev->producing = true;
+        dev->started = true;
+        return RX888_OK;
+    }
+
+    for (unsigned int i = 0; i < dev->cfg.queuedepth; i++) {
+        if (usb->submit_transfer(dev->transfers[i]) == 0)
+            atomic_fetch_add(&dev->xfers_in_progress, 1);
+    }
+    atomic_store(&dev->xfers_low, atomic_load(&dev->xfers_in_progress));
+    dev->started = true;
+
+    if (dev->cfg.dither) {
+        gpio |= DITH;
+    }
+    if (dev->cfg.randomizer) {
+        gpio |= RANDO;
+    }
+    if (dev->cfg.vhf) {
+        gpio |= VHF_EN;
+    }
+
+    usleep(5000);
+    command_send(dev->dev_handle, GPIOFX3, gpio);
+    usleep(5000);
+    argument_send(dev->dev_handle, DAT31_ATT, dev->cfg.att);
+    usleep(5000);
+    argument_send(dev->dev_handle, AD8340_VGA, dev->cfg.gain);
+    usleep(5000);
+    command_send(dev->dev_handle, STARTADC, dev->cfg.samplerate);
+    usleep(5000);
+    command_send(dev->dev_handle, STARTFX3, 0);
+    usleep(5000);
+    command_send(dev->dev_handle, dev->cfg.vhf ? TUNERINIT : TUNERSTDBY, 0);
+
+    return RX888_OK;
+}
+
+void rx888_stop(rx888_t *dev) {
+    atomic_store(&dev->stop_transfers, true);
+}
+
+int rx888_handle_events(rx888_t *dev, int timeout_ms) {
+    struct timeval tv;
+
+    if (dev->cfg.synthetic)
+        return synth_handle_events(dev, timeout_ms);
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    return usb->handle_events_timeout(NULL, &tv) == 0 ? RX888_OK : RX888_ERROR;
+}
+
+int rx888_run(rx888_t *dev, rx888_callback cb, void *ctx) {
+    dev->callback_ctx = ctx;
+    dev->callback = cb;
+    complete_select(dev);
+
+    do {
+        if (dev->cfg.synthetic)
+            synth_handle_events(dev, 100);
+        else
+            usb->handle_events(NULL);
+    } while (!atomic_load(&dev->stop_transfers));
+
+    return RX888_STOPPED;
+}
+
+static struct rx888_block *ready_pop(rx888_t *dev) {
+    struct rx888_block *block = NULL;
+
+    pthread_mutex_lock(&dev->ready_lock);
+    if (dev->ready_count > 0) {
+        block = dev->ready[dev->ready_head];
+        dev->ready_head = (dev->ready_head + 1) % dev->cfg.queuedepth;
+        dev->ready_count--;
+    }
+    pthread_mutex_unlock(&dev->ready_lock);
+    return block;
+}
+
+static int64_t now_ms(void) {
+    return now_ns() / 1000000;
+}
+
+int rx888_lease(rx888_t *dev, struct rx888_block **block, int timeout_ms) {
+    int64_t deadline = now_ms() + timeout_ms;
+
+    *block = NULL;
+    while ((*block = ready_pop(dev)) == NULL) {
+        if (atomic_load(&dev->stop_transfers) &&
+            atomic_load(&dev->xfers_in_progress) == 0)
+            return RX888_STOPPED;
+
+        int wait = 100;
+        if (timeout_ms >= 0) {
+            int64_t left = deadline - now_ms();
+            if (left <= 0)
+                return RX888_TIMEOUT;
+            if (left < wait)
+                wait = (int)left;
+        }
+        rx888_handle_events(dev, wait);
+    }
+    return RX888_OK;
+}
+
+static unsigned int latency_bucket(uint64_t ns) {
+    if (ns < 8)
+        return ns;
+    unsigned int msb = 63 - __builtin_clzll(ns);
+    unsigned int b = (msb - 2) * 8 + ((ns >> (msb - 3)) & 7);
+    return b < LATENCY_BUCKETS ? b : LATENCY_BUCKETS - 1;
+}
+
+// Upper bound of a bucket
+static uint64_t latency_bucket_ns(unsigned int b) {
+    b++;
+    if (b < 8)
+        return b;
+    return (uint64_t)(8 + b % 8) << (b / 8 - 1);
+}
+
+void rx888_block_ref(rx888_t *dev, struct rx888_block *block) {
+    atomic_fetch_add(&dev->refs[block - dev->blocks], 1);
+}
+
+void rx888_release(rx888_t *dev, struct rx888_block *block) {
+    size_t i = block - dev->blocks;
+
+    // Last reference gone: the buffer goes back to the device
+    if (atomic_fetch_sub(&dev->refs[i], 1) == 1) {
+        uint64_t hold = now_ns() - block->time_ns;
+        atomic_fetch_add(&dev->latency[latency_bucket(hold)], 1);
+        if (dev->journal) {
+            dev->journal_recs[i].hold_ns = journal_ns(hold);
+            journal_post(dev->journal, &dev->journal_recs[i]);
+        }
+        resubmit(dev, i);
+    }
+}
+
+int rx888_bench_start(rx888_t *dev, rx888_callback cb, void *ctx) {
+    if (!dev->cfg.synthetic || dev->started || dev->cfg.journal)
+        return RX888_ERROR;
+    pass_select(dev);
+    dev->callback_ctx = ctx;
+    dev->callback = cb;
+    complete_select(dev);
+    for (unsigned int i = 0; i < dev->cfg.queuedepth; i++)
+        resubmit(dev, i);
+    return RX888_OK;
+}
+
+void rx888_bench_complete(rx888_t *dev, int checked) {
+    pthread_mutex_lock(&dev->synth_lock);
+    if (dev->submitted_count == 0) {
+        pthread_mutex_unlock(&dev->synth_lock);
+        return;
+    }
+    unsigned int i = dev->submitted[dev->submitted_head];
+    dev->submitted_head = (dev->submitted_head + 1) % dev->cfg.queuedepth;
+    dev->submitted_count--;
+    pthread_mutex_unlock(&dev->synth_lock);
+
+    dev->blocks[i].time_ns = now_ns();
+    if (checked)
+        complete_checked(dev, &dev->blocks[i], dev->block_size);
+    else
+        dev->complete(dev, &dev->blocks[i], dev->block_size);
+    if (dev->callback == NULL) {
+        struct rx888_block *block = ready_pop(dev);
+        if (block)
+            rx888_release(dev, block);
+    }
+}
+
+size_t rx888_block_size(const rx888_t *dev) {
+    return dev->block_size;
+}
+
+unsigned int rx888_samplerate(const rx888_t *dev) {
+    return dev->cfg.samplerate;
+}
+
+void rx888_get_stats(const rx888_t *dev, struct rx888_stats *stats) {
+    stats->success_count = atomic_load(&dev->success_count);
+    stats->failure_count = atomic_load(&dev->failure_count);
+    stats->bytes = atomic_load(&dev->bytes);
+    stats->in_flight = atomic_load(&dev->xfers_in_progress);
+    stats->in_flight_low = atomic_load(&dev->xfers_low);
+    stats->ready = dev->ready_count;
+    stats->held = 0;
+    if (stats->in_flight + stats->ready < dev->cfg.queuedepth)
+        stats->held = dev->cfg.queuedepth - stats->in_flight - stats->ready;
+    stats->queuedepth = dev->cfg.queuedepth;
+    stats->overruns = atomic_load(&dev->overruns);
+    stats->clipped = atomic_load(&dev->clipped);
+    stats->peak = atomic_load(&dev->peak);
+}
+
+uint64_t rx888_latency_ns(const rx888_t *dev, double quantile) {
+    uint64_t total = 0, seen = 0;
+
+    for (unsigned int b = 0; b < LATENCY_BUCKETS; b++)
+        total += atomic_load(&dev->latency[b]);
+    if (total == 0)
+        return 0;
+    for (unsigned int b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += atomic_load(&dev->latency[b]);
+        if (seen > 0 && seen >= quantile * total)
+            return latency_bucket_ns(b);
+    }
+    return latency_bucket_ns(LATENCY_BUCKETS - 1);
+}
+
+double rx888_nominal_gain_db(unsigned int gain, unsigned int att) {
+    // VGA voltage gain is linear in the code; the attenuator steps 0.5 dB
+    double vernier = (gain & 0x80) ? 0.409 : 0.055744;
+    unsigned int code = gain & 0x7f;
+
+    if (code == 0)
+        code = 1;
+    return 20 * log10(code * vernier) - 0.5 * att;
+}
+
+// Changes sent while streaming are tagged; the setup in rx888_start() and the stop are not
+static bool streaming(rx888_t *dev) {
+    return dev->started && !atomic_load(&dev->stop_transfers);
+}
+
+int rx888_command(rx888_t *dev, enum FX3Command cmd, uint32_t data) {
+    bool tag = streaming(dev);
+    uint64_t id = tag ? tag_issue(dev, cmd, 0, data) : 0;
+    int ret = dev->cfg.synthetic ? 0 : command_send(dev->dev_handle, cmd, data);
+
+    if (tag)
+        tag_acked(dev, id, ret == 0 ? RX888_OK : RX888_ERROR);
+    return ret;
+}
+
+int rx888_argument(rx888_t *dev, enum ArgumentList arg, uint32_t data) {
+    bool tag = streaming(dev);
+    uint64_t id = tag ? tag_issue(dev, SETARGFX3, arg, data) : 0;
+    int ret = dev->cfg.synthetic ? 0 : argument_send(dev->dev_handle, arg, data);
+
+    if (tag)
+        tag_acked(dev, id, ret == 0 ? RX888_OK : RX888_ERROR);
+    return ret;
+}
+
+int rx888_set_gain(rx888_t *dev, unsigned int gain) {
+    if (rx888_argument(dev, AD8340_VGA, gain) != 0)
+        return RX888_ERROR;
+    dev->cfg.gain = gain;
+    return RX888_OK;
+}
+
+int rx888_set_att(rx888_t *dev, unsigned int att) {
+    if (att > 63 || rx888_argument(dev, DAT31_ATT, att) != 0)
+        return RX888_ERROR;
+    dev->cfg.att = att;
+    return RX888_OK;
+}
+
+int rx888_set_samplerate(rx888_t *dev, unsigned int samplerate) {
+    if (samplerate < 1000000 || rx888_command(dev, STARTADC, samplerate) != 0)
+        return RX888_ERROR;
+    dev->cfg.samplerate = samplerate;
+    return RX888_OK;
+}
+
+int rx888_tune(rx888_t *dev, uint64_t freq_hz) {
+    if (!dev->cfg.vhf) {
+        fprintf(stderr, "Tuning needs VHF mode\n");
+        return RX888_ERROR;
+    }
+    bool tag = streaming(dev);
+    uint64_t id = tag ? tag_issue(dev, TUNERTUNE, 0, freq_hz) : 0;
+    // TUNERTUNE takes the frequency as a little endian UINT64
+    uint64_t le = htole64(freq_hz);
+    int ret = dev->cfg.synthetic ? 0 : control_send(dev->dev_handle, TUNERTUNE, 0, 0,
+                                                    (unsigned char *)&le, sizeof(le));
+
+    if (tag)
+        tag_acked(dev, id, ret == 0 ? RX888_OK : RX888_ERROR);
+    return ret == 0 ? RX888_OK : RX888_ERROR;
+}
+
+void rx888_close(rx888_t *dev) {
+    if (dev == NULL)
+        return;
+
+    if (dev->started) {
+        atomic_store(&dev->stop_transfers, true);
+        // Blocks still waiting for a lease are not in flight; drop them
+        while (ready_pop(dev) != NULL)
+            ;
+        while (atomic_load(&dev->xfers_in_progress) != 0) {
+            fprintf(stderr, "%d transfers are pending\n",
+                    atomic_load(&dev->xfers_in_progress));
+            rx888_handle_events(dev, 100);
+        }
+        fprintf(stderr, "\nTransfers completed\n");
+        rx888_command(dev, STOPFX3, 0);
+    }
+    if (dev->producing)
+        pthread_join(dev->producer, NULL);
+
+    free_transfers(dev);
+    journal_close(dev->journal);
+    free(dev->journal_recs);
+
+    if (dev->claimed)
+        usb->release_interface(dev->dev_handle, dev->interface_number);
+    if (dev->config)
+        usb->free_config_descriptor(dev->config);
+    if (dev->dev_handle)
+        usb->close(dev->dev_handle);
+    if (!dev->cfg.synthetic)
+        usb->exit(NULL);
+
+    pthread_mutex_destroy(&dev->ready_lock);
+    pthread_mutex_destroy(&dev->synth_lock);
+    pthread_mutex_destroy(&dev->tag_lock);
+    pthread_cond_destroy(&dev->synth_cond);
+    for (unsigned int i = 0; i < RX888_TAG_RING; i++)
+        free(dev->tags[i].power);
+    if (dev->logging)
+        logring_stop();
+    free(dev);
+}
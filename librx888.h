@@ -0,0 +1,246 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#ifndef LIBRX888_H
+#define LIBRX888_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rx888.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * librx888 - device bring-up and streaming for the RX888 family.
+ *
+ * Typical use:
+ *
+ *   struct rx888_config cfg;
+ *   rx888_config_init(&cfg);
+ *   cfg.firmware = "SDDC_FX3.img";
+ *   rx888_t *dev;
+ *   if (rx888_open(&dev, &cfg) == 0 && rx888_start(dev) == 0) {
+ *       // either: rx888_run(dev, callback, ctx);
+ *       // or:     rx888_lease() / rx888_release() in a loop
+ *   }
+ *   rx888_close(dev);
+ *
+ * Sample buffers are never copied by the library: a block handed to the
+ * application points straight into the libusb transfer buffer. Blocks are
+ * reference counted, so several consumers can hold the same block with
+ * rx888_block_ref(); it is resubmitted to the device when the last
+ * reference is dropped with rx888_release().
+ *
+ * With cfg.synthetic set, no device is opened: a producer thread completes
+ * the submitted transfers at the configured sample rate and transfer
+ * geometry, and everything above it runs unchanged. It exists to measure
+ * whether a host keeps up before hardware is attached.
+ */
+
+typedef struct rx888 rx888_t;
+
+// Verbosity level for diagnostics printed on stderr
+extern int verbose;
+
+enum rx888_status {
+    RX888_OK = 0,
+    RX888_ERROR = -1,   // generic failure, see stderr
+    RX888_TIMEOUT = -2, // rx888_lease() timed out
+    RX888_STOPPED = -3, // streaming has been stopped, no more blocks
+};
+
+struct rx888_config {
+    const char *firmware;    // FX3 image, uploaded if the device is in bootloader mode
+    unsigned int samplerate; // ADC sample rate in Hz
+    unsigned int gain;       // AD8340 VGA value, bit 7 selects high gain mode
+    unsigned int att;        // DAT-31 attenuation, 0-63
+    unsigned int queuedepth; // Number of transfers kept in flight
+    unsigned int reqsize;    // Transfer size in packets
+    int dither;              // Enable ADC dither
+    int randomizer;          // Enable ADC output randomization (undone by the library)
+    int synthetic;           // No device: an in-process source paced at samplerate stands in
+    unsigned int pktsize;    // Synthetic source packet size in bytes, 0 for 16384
+    const char *sim;         // Simulated FX3 instead of libusb, options as in usb_sim_parse()
+    int block_crc;           // CRC32C of every block into block->crc32c
+    int sample_stats;        // Count clipped samples and track the peak, see rx888_stats
+    int vhf;                 // VHF input through the R82XX tuner instead of HF, see rx888_tune()
+    const char *journal;     // Per-transfer journal file, see journal.h
+};
+
+// Filled transfer buffer handed to the application
+struct rx888_block {
+    unsigned char *data;   // sample data, little endian int16
+    size_t length;         // number of valid bytes in data
+    uint64_t seq;          // completion sequence number, starting at 0
+    uint64_t sample_index; // stream index of the first sample in data
+    uint64_t time_ns;      // CLOCK_MONOTONIC time the transfer completed
+    uint32_t crc32c;       // CRC32C of data with cfg.block_crc
+    uint64_t tags;         // tags complete at delivery: ids below this, see rx888_get_tags()
+    void *priv;            // library private
+};
+
+#define RX888_TAG_NO_STEP UINT64_MAX
+
+/*
+ * A configuration change sent while streaming: every rx888_command(),
+ * rx888_argument() and rx888_tune(), and the setters built on them. The
+ * stream indexes are of the sample the ADC was taking at the time,
+ * extrapolated from the last completed transfer, so they can be off by
+ * the transfer pipeline's jitter. effect is measured instead: the step
+ * the change made in the signal power, located to 64 samples in a range
+ * of at least two transfers around the command.
+ */
+struct rx888_tag {
+    uint64_t id;        // from 0, in the order the changes were issued
+    uint32_t request;   // enum FX3Command; SETARGFX3 for an argument
+    uint32_t argument;  // enum ArgumentList with SETARGFX3, else 0
+    uint64_t value;
+    int status;         // RX888_OK, RX888_ERROR if the command failed
+    uint64_t time_ns;   // CLOCK_MONOTONIC time it was issued
+    uint64_t issued;    // stream index when it was sent
+    uint64_t acked;     // stream index when the firmware acknowledged it
+    uint64_t effect;    // first sample after the power step, RX888_TAG_NO_STEP if none
+    float step_db;      // size of that step
+};
+
+struct rx888_stats {
+    uint64_t success_count; // transfers completed successfully
+    uint64_t failure_count; // transfers completed with an error
+    uint64_t bytes;         // payload bytes delivered
+    unsigned int in_flight;     // transfers currently submitted
+    unsigned int in_flight_low; // fewest transfers submitted since streaming started
+    unsigned int ready;         // completed blocks waiting to be leased
+    unsigned int held;          // blocks referenced by the application
+    unsigned int queuedepth;    // size of the transfer pool
+    uint64_t overruns;          // synthetic source: blocks lost with no transfer submitted
+    uint64_t clipped;           // cfg.sample_stats: samples at either ADC full scale code
+    unsigned int peak;          // cfg.sample_stats: largest sample magnitude so far
+};
+
+/*
+ * Callback mode handler. Called from the libusb event context for every
+ * completed block; the library drops its reference when the handler
+ * returns, so the block is resubmitted unless the handler took one.
+ * Return non-zero to stop streaming.
+ */
+typedef int (*rx888_callback)(struct rx888_block *block, void *ctx);
+
+// Fill cfg with the defaults used by rx888_stream.
+void rx888_config_init(struct rx888_config *cfg);
+
+/*
+ * Find the device, upload firmware if needed, claim the interface and
+ * allocate the transfer pool. Returns RX888_OK and a handle in *dev.
+ */
+int rx888_open(rx888_t **dev, const struct rx888_config *cfg);
+
+// Submit the transfer pool and program the ADC. Streaming starts here.
+int rx888_start(rx888_t *dev);
+
+/*
+ * Request streaming to stop. Safe to call from a signal handler or
+ * another thread; rx888_run() and rx888_lease() return RX888_STOPPED
+ * once the in-flight transfers have drained.
+ */
+void rx888_stop(rx888_t *dev);
+
+// Stop streaming, drain transfers, release the device and free the handle.
+void rx888_close(rx888_t *dev);
+
+// Callback mode: handle USB events and dispatch blocks until stopped.
+int rx888_run(rx888_t *dev, rx888_callback cb, void *ctx);
+
+/*
+ * Pull mode: wait up to timeout_ms (negative waits forever) for the next
+ * filled block. The caller holds one reference to it, which is given
+ * back with rx888_release(). Blocks are returned in completion order.
+ */
+int rx888_lease(rx888_t *dev, struct rx888_block **block, int timeout_ms);
+
+// Take another reference to a block the caller already holds. Thread safe.
+void rx888_block_ref(rx888_t *dev, struct rx888_block *block);
+
+// Drop a reference; the last one returns the block to the device. Thread safe.
+void rx888_release(rx888_t *dev, struct rx888_block *block);
+
+// Handle pending USB events for at most timeout_ms.
+int rx888_handle_events(rx888_t *dev, int timeout_ms);
+
+// Size in bytes of one transfer buffer.
+size_t rx888_block_size(const rx888_t *dev);
+
+// Configured ADC sample rate in Hz.
+unsigned int rx888_samplerate(const rx888_t *dev);
+
+void rx888_get_stats(const rx888_t *dev, struct rx888_stats *stats);
+
+/*
+ * Block hold latency: time from transfer completion until the last
+ * reference is released and the buffer is back with the device, at the
+ * given quantile (0.5 median, 1.0 maximum), in ns. Resolution is 1/8 of
+ * the value.
+ */
+uint64_t rx888_latency_ns(const rx888_t *dev, double quantile);
+
+/*
+ * Nominal front end gain in dB for an AD8340_VGA value (bit 7 high gain
+ * mode) and a DAT31_ATT value, from the VGA and attenuator datasheets.
+ */
+double rx888_nominal_gain_db(unsigned int gain, unsigned int att);
+
+// Raw vendor requests, see FX3Command / ArgumentList in rx888.h
+int rx888_command(rx888_t *dev, enum FX3Command cmd, uint32_t data);
+int rx888_argument(rx888_t *dev, enum ArgumentList arg, uint32_t data);
+
+// Change settings while streaming.
+int rx888_set_gain(rx888_t *dev, unsigned int gain);
+int rx888_set_att(rx888_t *dev, unsigned int att);
+int rx888_set_samplerate(rx888_t *dev, unsigned int samplerate);
+
+/*
+ * Copy out complete tags with ids from first on, at most max; returns how
+ * many. A block's tags field says which ids are complete by then. Only
+ * the last RX888_TAG_RING are kept: older ones are skipped.
+ */
+#define RX888_TAG_RING 256
+unsigned int rx888_get_tags(rx888_t *dev, uint64_t first, struct rx888_tag *tags,
+                            unsigned int max);
+
+/*
+ * VHF mode (cfg.vhf): rx888_start() switches the ADC to the tuner output
+ * and initializes the R82XX, which then mixes the tuned frequency down to
+ * its IF. Blocks until the firmware has taken the command; safe to call
+ * from another thread while streaming.
+ */
+int rx888_tune(rx888_t *dev, uint64_t freq_hz);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
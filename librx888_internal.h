@@ -0,0 +1,60 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#ifndef LIBRX888_INTERNAL_H
+#define LIBRX888_INTERNAL_H
+
+#include "librx888.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Hooks for rx888_bench, not part of the library API. They drive the
+ * completion path of a synthetic handle on the calling thread, as the
+ * synthetic producer and the event handler would, without the pacing
+ * and the thread handoff, so the chain itself is what gets timed.
+ */
+
+/*
+ * rx888_start() for a synthetic handle without its producer: select the
+ * per-block pass and the completion chain for cb (NULL for pull mode)
+ * and submit the transfer pool.
+ */
+int rx888_bench_start(rx888_t *dev, rx888_callback cb, void *ctx);
+
+/*
+ * Complete the oldest submitted transfer, and in pull mode lease and
+ * release it. checked runs the chain with the options tested on every
+ * block instead of the one selected at start.
+ */
+void rx888_bench_complete(rx888_t *dev, int checked);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,220 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "logring.h"
+#include "librx888.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define LOGRING_POLL_MS 50
+#define LOGRING_WINDOW_NS 1000000000ULL
+
+struct slot {
+    atomic_size_t seq; // ring position it is free for, that plus 1 once written
+    char text[LOGRING_TEXT];
+};
+
+// A line printed in the current window and how often it came again
+struct recent {
+    char text[LOGRING_TEXT];
+    uint64_t repeats;
+};
+
+/*
+ * Bounded multi-producer queue after Dmitry Vyukov's: a producer claims
+ * a position with a compare and swap on head and publishes the slot
+ * through its sequence number, so neither side ever waits on the other.
+ */
+static struct {
+    struct slot slots[LOGRING_SLOTS];
+    atomic_size_t head;        // next position to post to
+    atomic_uint_fast64_t lost; // posted with the ring full
+    atomic_bool running;
+    atomic_int posting; // posts under way, waited out by logring_stop()
+
+    pthread_mutex_t lock; // start and stop
+    unsigned int users;
+    bool initialized;
+    pthread_t thread;
+
+    // Drain side
+    size_t tail;
+    struct recent recent[LOGRING_LINES];
+    unsigned int lines; // printed in the window
+    uint64_t suppressed;
+    uint64_t window_ns;
+} ring = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void logring_post(enum logring_level level, const char *fmt, ...) {
+    va_list ap;
+    struct slot *s;
+    size_t pos;
+
+    if ((int)level > verbose)
+        return;
+    va_start(ap, fmt);
+    atomic_fetch_add(&ring.posting, 1);
+    if (!atomic_load(&ring.running)) {
+        atomic_fetch_sub(&ring.posting, 1);
+        vfprintf(stderr, fmt, ap);
+        fputc('\n', stderr);
+        va_end(ap);
+        return;
+    }
+    pos = atomic_load_explicit(&ring.head, memory_order_relaxed);
+    for (;;) {
+        s = &ring.slots[pos % LOGRING_SLOTS];
+        size_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        if (seq == pos) {
+            if (atomic_compare_exchange_weak_explicit(&ring.head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        } else if ((ptrdiff_t)(seq - pos) < 0) {
+            // Not drained yet since the last lap: full
+            atomic_fetch_add(&ring.lost, 1);
+            goto out;
+        } else {
+            pos = atomic_load_explicit(&ring.head, memory_order_relaxed);
+        }
+    }
+    vsnprintf(s->text, sizeof(s->text), fmt, ap);
+    atomic_store_explicit(&s->seq, pos + 1, memory_order_release);
+out:
+    atomic_fetch_sub(&ring.posting, 1);
+    va_end(ap);
+}
+
+// End of a window: the repeat counts of its lines, and what was not shown
+static void flush(uint64_t now) {
+    double secs = (now - ring.window_ns) / 1e9;
+    uint64_t lost = atomic_exchange(&ring.lost, 0);
+
+    for (unsigned int i = 0; i < ring.lines; i++) {
+        if (ring.recent[i].repeats)
+            fprintf(stderr, "%s (%llu more times in %.1f s)\n", ring.recent[i].text,
+                    (unsigned long long)ring.recent[i].repeats, secs);
+    }
+    if (ring.suppressed)
+        fprintf(stderr, "%llu more log messages in %.1f s not shown\n",
+                (unsigned long long)ring.suppressed, secs);
+    if (lost)
+        fprintf(stderr, "%llu log messages lost with the log ring full\n",
+                (unsigned long long)lost);
+    ring.lines = 0;
+    ring.suppressed = 0;
+}
+
+static void take(const char *text, uint64_t now) {
+    if (ring.lines == 0 && ring.suppressed == 0)
+        ring.window_ns = now;
+    for (unsigned int i = 0; i < ring.lines; i++) {
+        if (strcmp(ring.recent[i].text, text) == 0) {
+            ring.recent[i].repeats++;
+            return;
+        }
+    }
+    if (ring.lines == LOGRING_LINES) {
+        ring.suppressed++;
+        return;
+    }
+    fprintf(stderr, "%s\n", text);
+    memcpy(ring.recent[ring.lines].text, text, LOGRING_TEXT);
+    ring.recent[ring.lines++].repeats = 0;
+}
+
+static void drain(void) {
+    uint64_t now = mono_ns();
+
+    for (;;) {
+        struct slot *s = &ring.slots[ring.tail % LOGRING_SLOTS];
+        if (atomic_load_explicit(&s->seq, memory_order_acquire) != ring.tail + 1)
+            break;
+        take(s->text, now);
+        atomic_store_explicit(&s->seq, ring.tail + LOGRING_SLOTS, memory_order_release);
+        ring.tail++;
+    }
+    if (now - ring.window_ns >= LOGRING_WINDOW_NS || atomic_load(&ring.lost))
+        flush(now);
+}
+
+static void *drain_thread(void *arg) {
+    const struct timespec poll = {0, LOGRING_POLL_MS * 1000000L};
+
+    (void)arg;
+    while (atomic_load(&ring.running)) {
+        nanosleep(&poll, NULL);
+        drain();
+    }
+    return NULL;
+}
+
+int logring_start(void) {
+    int ret = 0;
+
+    pthread_mutex_lock(&ring.lock);
+    if (ring.users == 0) {
+        if (!ring.initialized) {
+            for (size_t i = 0; i < LOGRING_SLOTS; i++)
+                atomic_init(&ring.slots[i].seq, i);
+            ring.initialized = true;
+        }
+        atomic_store(&ring.running, true);
+        if (pthread_create(&ring.thread, NULL, drain_thread, NULL) != 0) {
+            atomic_store(&ring.running, false);
+            ret = -1;
+        }
+    }
+    if (ret == 0)
+        ring.users++;
+    pthread_mutex_unlock(&ring.lock);
+    return ret;
+}
+
+void logring_stop(void) {
+    pthread_mutex_lock(&ring.lock);
+    if (ring.users > 0 && --ring.users == 0) {
+        atomic_store(&ring.running, false);
+        while (atomic_load(&ring.posting) > 0)
+            sched_yield();
+        pthread_join(ring.thread, NULL);
+        drain();
+        flush(mono_ns());
+    }
+    pthread_mutex_unlock(&ring.lock);
+}
@@ -0,0 +1,67 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#ifndef LOGRING_H
+#define LOGRING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Diagnostics from paths that must not block, such as the USB completion
+ * callback. Messages are formatted into a lock-free ring and printed on
+ * stderr by a drain thread, which folds repeats of a message within a
+ * second into one count and prints at most LOGRING_LINES distinct lines
+ * a second. Messages above the verbose level are dropped when posted;
+ * when the ring is full they are counted and dropped. Outside
+ * logring_start() / logring_stop() they are printed directly.
+ */
+
+enum logring_level {
+    LOGRING_ERROR, // always shown
+    LOGRING_INFO,  // with --verbose
+    LOGRING_DEBUG, // with verbose 2
+};
+
+#define LOGRING_SLOTS 256 // messages posted and not yet drained
+#define LOGRING_TEXT 160  // longest message, longer ones are truncated
+#define LOGRING_LINES 20  // distinct lines printed per second
+
+// Start the drain thread; calls nest, the last logring_stop() ends it
+int logring_start(void);
+
+// Print what is left, the pending repeat counts and the drops, and end the drain thread
+void logring_stop(void);
+
+// Post a message without a trailing newline. Thread safe and lock free.
+void logring_post(enum logring_level level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
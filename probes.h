@@ -0,0 +1,62 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+ * USDT probes, provider "rx888", for bpftrace and perf on live systems.
+ * They are built in when systemtap's <sys/sdt.h> is installed (the
+ * Makefile defines HAVE_SDT); a probe is then a single nop until a tracer
+ * attaches, and nothing at all otherwise. Example scripts are in
+ * bpftrace/.
+ *
+ *   transfer_complete(index, status, length, seq)  libusb status, 0 on success
+ *   transfer_resubmit(index, seq)
+ *   overrun(samples)                               synthetic source lost a block
+ *   sink_write_start(name, seq)
+ *   sink_write_done(name, seq)
+ *   sink_drop(name, seq)                           sink queue full
+ *   command_start(request, value, index)           vendor request to the FX3,
+ *                                                  value is the payload of a command
+ *   command_done(request, ret)
+ */
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+#define RX888_PROBE1(name, a) DTRACE_PROBE1(rx888, name, a)
+#define RX888_PROBE2(name, a, b) DTRACE_PROBE2(rx888, name, a, b)
+#define RX888_PROBE3(name, a, b, c) DTRACE_PROBE3(rx888, name, a, b, c)
+#define RX888_PROBE4(name, a, b, c, d) DTRACE_PROBE4(rx888, name, a, b, c, d)
+#else
+#define RX888_PROBE1(name, a) do { (void)sizeof(a); } while (0)
+#define RX888_PROBE2(name, a, b) do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#define RX888_PROBE3(name, a, b, c) \
+    do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while (0)
+#define RX888_PROBE4(name, a, b, c, d) \
+    do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); (void)sizeof(d); } while (0)
+#endif
+
+#endif
@@ -0,0 +1,354 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "rtl_tcp.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define MAX_CLIENTS 8
+#define CMD_QUEUE 64
+#define SEND_CHUNK (64 * 1024) // most sent per poll wakeup, see client_write()
+
+const int rtl_tcp_r820t_gains[RTL_TCP_R820T_GAINS] = {
+    0,   9,   14,  27,  37,  77,  87,  125, 144, 157, 166, 197, 207, 229, 254,
+    280, 297, 328, 338, 364, 372, 386, 402, 421, 434, 439, 445, 480, 496};
+
+struct client {
+    int fd;
+    uint8_t *buf; // send queue, ring buffer of queue_size bytes
+    size_t head;
+    size_t count;
+    uint64_t sent;
+    uint64_t dropped;
+    uint8_t cmd[5]; // partially received command
+    size_t cmd_len;
+};
+
+struct rtl_tcp_server {
+    int listen_fd;
+    int wake[2]; // self pipe, written on broadcast and stop
+    size_t queue_size;
+    pthread_t thread;
+    volatile bool stop;
+
+    pthread_mutex_t lock; // protects clients and the command queue
+    struct client clients[MAX_CLIENTS];
+    unsigned int nclients;
+    struct rtl_tcp_command cmds[CMD_QUEUE];
+    unsigned int cmd_head;
+    unsigned int cmd_count;
+};
+
+static void wake(struct rtl_tcp_server *srv) {
+    uint8_t b = 0;
+    ssize_t ret = write(srv->wake[1], &b, 1);
+    (void)ret; // pipe full means a wakeup is already pending
+}
+
+// Copy into a client ring; caller holds srv->lock
+static void client_queue(struct rtl_tcp_server *srv, struct client *cl,
+                         const uint8_t *data, size_t len) {
+    if (srv->queue_size - cl->count < len) {
+        cl->dropped += len;
+        return;
+    }
+    size_t tail = (cl->head + cl->count) % srv->queue_size;
+    size_t first = srv->queue_size - tail < len ? srv->queue_size - tail : len;
+    memcpy(cl->buf + tail, data, first);
+    memcpy(cl->buf, data + first, len - first);
+    cl->count += len;
+}
+
+static void client_close(struct rtl_tcp_server *srv, unsigned int i) {
+    struct client *cl = &srv->clients[i];
+
+    fprintf(stderr, "rtl_tcp: client disconnected, %llu bytes sent, %llu dropped\n",
+            (unsigned long long)cl->sent, (unsigned long long)cl->dropped);
+    close(cl->fd);
+    free(cl->buf);
+    srv->clients[i] = srv->clients[--srv->nclients];
+}
+
+static void client_accept(struct rtl_tcp_server *srv) {
+    struct sockaddr_in peer;
+    socklen_t len = sizeof(peer);
+    int fd = accept(srv->listen_fd, (struct sockaddr *)&peer, &len);
+    if (fd < 0)
+        return;
+
+    pthread_mutex_lock(&srv->lock);
+    if (srv->nclients == MAX_CLIENTS) {
+        pthread_mutex_unlock(&srv->lock);
+        fprintf(stderr, "rtl_tcp: too many clients, rejecting connection\n");
+        close(fd);
+        return;
+    }
+
+    struct client *cl = &srv->clients[srv->nclients];
+    memset(cl, 0, sizeof(*cl));
+    cl->buf = malloc(srv->queue_size);
+    if (cl->buf == NULL) {
+        pthread_mutex_unlock(&srv->lock);
+        close(fd);
+        return;
+    }
+    cl->fd = fd;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // Dongle info header: magic, tuner type, number of gain steps
+    uint8_t hdr[12] = {'R', 'T', 'L', '0'};
+    uint32_t tuner = htonl(RTL_TCP_TUNER_R820T);
+    uint32_t gains = htonl(RTL_TCP_R820T_GAINS);
+    memcpy(hdr + 4, &tuner, 4);
+    memcpy(hdr + 8, &gains, 4);
+    client_queue(srv, cl, hdr, sizeof(hdr));
+    srv->nclients++;
+    pthread_mutex_unlock(&srv->lock);
+
+    fprintf(stderr, "rtl_tcp: client connected from %s:%d\n",
+            inet_ntoa(peer.sin_addr), ntohs(peer.sin_port));
+}
+
+// Read commands from a client; returns false when it went away
+static bool client_read(struct rtl_tcp_server *srv, struct client *cl) {
+    ssize_t ret = recv(cl->fd, cl->cmd + cl->cmd_len, sizeof(cl->cmd) - cl->cmd_len,
+                       MSG_DONTWAIT);
+    if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EINTR))
+        return false;
+    if (ret < 0)
+        return true;
+
+    cl->cmd_len += ret;
+    if (cl->cmd_len == sizeof(cl->cmd)) {
+        uint32_t param;
+        memcpy(&param, cl->cmd + 1, 4);
+        if (srv->cmd_count < CMD_QUEUE) {
+            unsigned int tail = (srv->cmd_head + srv->cmd_count) % CMD_QUEUE;
+            srv->cmds[tail].cmd = cl->cmd[0];
+            srv->cmds[tail].param = ntohl(param);
+            srv->cmd_count++;
+        }
+        cl->cmd_len = 0;
+    }
+    return true;
+}
+
+/*
+ * Send at most SEND_CHUNK of the queue, once per poll wakeup, so the lock
+ * rtl_tcp_broadcast() waits on is held for one send per client at most; poll
+ * comes straight back while the socket takes more. Returns false on error.
+ */
+static bool client_write(struct rtl_tcp_server *srv, struct client *cl) {
+    size_t len = srv->queue_size - cl->head < cl->count ? srv->queue_size - cl->head
+                                                       : cl->count;
+    if (len > SEND_CHUNK)
+        len = SEND_CHUNK;
+    ssize_t ret = send(cl->fd, cl->buf + cl->head, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (ret < 0)
+        return errno == EAGAIN || errno == EINTR;
+    cl->head = (cl->head + ret) % srv->queue_size;
+    cl->count -= ret;
+    cl->sent += ret;
+    return true;
+}
+
+static void *server_thread(void *arg) {
+    struct rtl_tcp_server *srv = arg;
+    struct pollfd pfd[MAX_CLIENTS + 2];
+
+    while (!srv->stop) {
+        unsigned int n;
+
+        pthread_mutex_lock(&srv->lock);
+        n = srv->nclients;
+        for (unsigned int i = 0; i < n; i++) {
+            pfd[i + 2].fd = srv->clients[i].fd;
+            pfd[i + 2].events = POLLIN | (srv->clients[i].count ? POLLOUT : 0);
+        }
+        pthread_mutex_unlock(&srv->lock);
+        pfd[0].fd = srv->wake[0];
+        pfd[0].events = POLLIN;
+        pfd[1].fd = srv->listen_fd;
+        pfd[1].events = POLLIN;
+
+        if (poll(pfd, n + 2, 1000) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("rtl_tcp: poll");
+            break;
+        }
+
+        if (pfd[0].revents & POLLIN) {
+            uint8_t drain[64];
+            while (read(srv->wake[0], drain, sizeof(drain)) > 0)
+                ;
+        }
+
+        pthread_mutex_lock(&srv->lock);
+        // Walk backwards so client_close() can move the last client into slot i
+        for (unsigned int i = n; i-- > 0;) {
+            struct client *cl = &srv->clients[i];
+            bool ok = true;
+            if (pfd[i + 2].revents & (POLLERR | POLLHUP))
+                ok = false;
+            if (ok && (pfd[i + 2].revents & POLLIN))
+                ok = client_read(srv, cl);
+            if (ok && cl->count)
+                ok = client_write(srv, cl);
+            if (!ok)
+                client_close(srv, i);
+        }
+        pthread_mutex_unlock(&srv->lock);
+
+        if (pfd[1].revents & POLLIN)
+            client_accept(srv);
+    }
+    return NULL;
+}
+
+struct rtl_tcp_server *rtl_tcp_start(const char *addr, unsigned int port,
+                                     size_t queue_size) {
+    struct rtl_tcp_server *srv;
+    struct sockaddr_in local;
+    int one = 1;
+
+    srv = calloc(1, sizeof(*srv));
+    if (srv == NULL)
+        return NULL;
+    srv->queue_size = queue_size;
+    srv->listen_fd = -1;
+    srv->wake[0] = srv->wake[1] = -1;
+    pthread_mutex_init(&srv->lock, NULL);
+
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_port = htons(port);
+    if (inet_pton(AF_INET, addr, &local.sin_addr) != 1) {
+        fprintf(stderr, "rtl_tcp: invalid listen address %s\n", addr);
+        goto fail;
+    }
+
+    if (pipe(srv->wake) != 0) {
+        perror("rtl_tcp: pipe");
+        goto fail;
+    }
+    fcntl(srv->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(srv->wake[1], F_SETFL, O_NONBLOCK);
+
+    srv->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (srv->listen_fd < 0) {
+        perror("rtl_tcp: socket");
+        goto fail;
+    }
+    setsockopt(srv->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(srv->listen_fd, (struct sockaddr *)&local, sizeof(local)) != 0 ||
+        listen(srv->listen_fd, 1) != 0) {
+        fprintf(stderr, "rtl_tcp: cannot listen on %s:%u: %s\n", addr, port,
+                strerror(errno));
+        goto fail;
+    }
+
+    if (pthread_create(&srv->thread, NULL, server_thread, srv) != 0) {
+        fprintf(stderr, "rtl_tcp: cannot start server thread\n");
+        goto fail;
+    }
+
+    fprintf(stderr, "rtl_tcp: listening on %s:%u\n", addr, port);
+    return srv;
+
+fail:
+    if (srv->listen_fd >= 0)
+        close(srv->listen_fd);
+    if (srv->wake[0] >= 0) {
+        close(srv->wake[0]);
+        close(srv->wake[1]);
+    }
+    pthread_mutex_destroy(&srv->lock);
+    free(srv);
+    return NULL;
+}
+
+void rtl_tcp_stop(struct rtl_tcp_server *srv) {
+    if (srv == NULL)
+        return;
+
+    srv->stop = true;
+    wake(srv);
+    pthread_join(srv->thread, NULL);
+
+    while (srv->nclients > 0)
+        client_close(srv, srv->nclients - 1);
+    close(srv->listen_fd);
+    close(srv->wake[0]);
+    close(srv->wake[1]);
+    pthread_mutex_destroy(&srv->lock);
+    free(srv);
+}
+
+unsigned int rtl_tcp_clients(struct rtl_tcp_server *srv) {
+    unsigned int n;
+
+    pthread_mutex_lock(&srv->lock);
+    n = srv->nclients;
+    pthread_mutex_unlock(&srv->lock);
+    return n;
+}
+
+void rtl_tcp_broadcast(struct rtl_tcp_server *srv, const uint8_t *data,
+                       size_t len) {
+    pthread_mutex_lock(&srv->lock);
+    for (unsigned int i = 0; i < srv->nclients; i++)
+        client_queue(srv, &srv->clients[i], data, len);
+    pthread_mutex_unlock(&srv->lock);
+    wake(srv);
+}
+
+int rtl_tcp_next_command(struct rtl_tcp_server *srv,
+                         struct rtl_tcp_command *cmd) {
+    int ret = 0;
+
+    pthread_mutex_lock(&srv->lock);
+    if (srv->cmd_count > 0) {
+        *cmd = srv->cmds[srv->cmd_head];
+        srv->cmd_head = (srv->cmd_head + 1) % CMD_QUEUE;
+        srv->cmd_count--;
+        ret = 1;
+    }
+    pthread_mutex_unlock(&srv->lock);
+    return ret;
+}
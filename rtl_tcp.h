@@ -0,0 +1,97 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#ifndef RTL_TCP_H
+#define RTL_TCP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * rtl_tcp compatible server. Samples are handed to rtl_tcp_broadcast()
+ * as offset binary uint8 I/Q and copied into a bounded queue per client;
+ * when a client falls behind its queue overflows and whole chunks are
+ * dropped for that client only, so the caller never blocks.
+ */
+
+enum rtl_tcp_cmd {
+    RTL_TCP_SET_FREQ = 0x01,
+    RTL_TCP_SET_SAMPLE_RATE = 0x02,
+    RTL_TCP_SET_GAIN_MODE = 0x03,
+    RTL_TCP_SET_GAIN = 0x04,
+    RTL_TCP_SET_FREQ_CORRECTION = 0x05,
+    RTL_TCP_SET_IF_GAIN = 0x06,
+    RTL_TCP_SET_TEST_MODE = 0x07,
+    RTL_TCP_SET_AGC_MODE = 0x08,
+    RTL_TCP_SET_DIRECT_SAMPLING = 0x09,
+    RTL_TCP_SET_OFFSET_TUNING = 0x0a,
+    RTL_TCP_SET_RTL_XTAL = 0x0b,
+    RTL_TCP_SET_TUNER_XTAL = 0x0c,
+    RTL_TCP_SET_TUNER_GAIN_BY_INDEX = 0x0d,
+    RTL_TCP_SET_BIAS_TEE = 0x0e,
+};
+
+// Tuner type announced to clients; selects the gain table they display
+#define RTL_TCP_TUNER_R820T 5
+#define RTL_TCP_R820T_GAINS 29
+
+struct rtl_tcp_command {
+    uint8_t cmd;
+    uint32_t param;
+};
+
+struct rtl_tcp_server;
+
+/*
+ * Listen on addr:port and serve clients from a background thread.
+ * queue_size is the per-client send queue in bytes.
+ */
+struct rtl_tcp_server *rtl_tcp_start(const char *addr, unsigned int port,
+                                     size_t queue_size);
+void rtl_tcp_stop(struct rtl_tcp_server *srv);
+
+// Number of connected clients
+unsigned int rtl_tcp_clients(struct rtl_tcp_server *srv);
+
+// Queue len bytes for every client; never blocks
+void rtl_tcp_broadcast(struct rtl_tcp_server *srv, const uint8_t *data,
+                       size_t len);
+
+// Pop the next command received from any client. Returns 1 if one was read.
+int rtl_tcp_next_command(struct rtl_tcp_server *srv,
+                         struct rtl_tcp_command *cmd);
+
+// Gain in tenths of dB for each R820T gain index, as rtl_tcp clients expect
+extern const int rtl_tcp_r820t_gains[RTL_TCP_R820T_GAINS];
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
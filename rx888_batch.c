@@ -0,0 +1,460 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+/*
+ * rx888_batch - process a recorded raw capture offline with the kernels
+ * of the live path, on every core. The capture is mapped and cut into
+ * chunks; worker threads take the next chunk as they free up, and the
+ * results are written in chunk order, so the output does not depend on
+ * the number of threads.
+ *
+ *   rx888_batch -r -o clean.raw capture.raw
+ *   rx888_batch -s 64000000 -m ddc -F 7100000 -d 256 -o 40m.cf32 capture.raw
+ *   rx888_batch -s 64000000 -m spectrum -n 8192 -o waterfall.f32 capture.raw
+ */
+
+#define _GNU_SOURCE
+#include "dsp.h"
+#include "kernels.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DDC_BLOCK 65536 // ddc max_in, samples
+
+enum mode {
+    MODE_RAW,      // int16, as captured (derandomized with -r)
+    MODE_F32,      // float, full scale +-1.0
+    MODE_DDC,      // interleaved float I/Q
+    MODE_SPECTRUM, // frames of size / 2 + 1 float bins in dBFS
+};
+
+static enum mode mode = MODE_RAW;
+static bool derandomize;
+static double samplerate = 32000000;
+static double ddc_freq;
+static unsigned int ddc_decim = 16;
+static unsigned int fft_size = 4096;
+static unsigned int fft_averages = 8;
+static double frame_rate = 10;
+
+// One chunk's result, waiting to be written
+struct slot {
+    unsigned char *buf;
+    size_t len;
+    bool ready;
+};
+
+static struct {
+    const int16_t *in;
+    uint64_t nsamples;
+    uint64_t chunk;   // samples per chunk
+    uint64_t nchunks;
+    size_t settle;    // ddc: samples processed ahead of a chunk and discarded
+    size_t out_max;   // largest result of one chunk, bytes
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct slot *slots; // chunk c goes to slot c % nslots
+    unsigned int nslots;
+    uint64_t next;      // next chunk to hand out
+    uint64_t written;   // chunks written so far
+    bool failed;
+} work = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+
+// Per worker scratch space
+struct worker {
+    pthread_t thread;
+    int16_t *samples; // derandomized input
+};
+
+/*
+ * Process chunk c into out and return the result length in bytes. A ddc
+ * starts settle samples early so that its filters are primed the way a
+ * single pass over the capture would have left them; the outputs from
+ * that stretch are dropped. Spectrum chunks are whole frame periods, so
+ * they need no history at all.
+ */
+static ssize_t process_chunk(struct worker *w, uint64_t c, unsigned char *out) {
+    uint64_t start = c * work.chunk;
+    uint64_t end = start + work.chunk < work.nsamples ? start + work.chunk : work.nsamples;
+    uint64_t from = mode == MODE_DDC && start > work.settle ? start - work.settle : 0;
+    const int16_t *src;
+    size_t n;
+
+    if (mode != MODE_DDC)
+        from = start;
+    n = end - from;
+    src = work.in + from;
+    madvise((void *)((uintptr_t)src & ~(uintptr_t)(getpagesize() - 1)),
+            n * sizeof(int16_t) + getpagesize(), MADV_WILLNEED);
+
+    if (mode == MODE_RAW) {
+        memcpy(out, src, n * sizeof(int16_t));
+        if (derandomize)
+            kernel_derandomize((int16_t *)out, n);
+        return n * sizeof(int16_t);
+    }
+    if (derandomize) {
+        memcpy(w->samples, src, n * sizeof(int16_t));
+        kernel_derandomize(w->samples, n);
+        src = w->samples;
+    }
+
+    switch (mode) {
+    case MODE_F32:
+        kernel_s16_to_f32(src, (float *)out, n);
+        return n * sizeof(float);
+
+    case MODE_DDC: {
+        struct ddc *ddc = ddc_create(samplerate, ddc_freq, ddc_decim, DDC_BLOCK);
+        if (ddc == NULL)
+            return -1;
+        ddc_seek(ddc, from);
+        size_t m = ddc_process(ddc, src, n, (float *)out);
+        size_t skip = (start - from) / ddc_decim;
+        ddc_free(ddc);
+        if (skip > m)
+            skip = m;
+        memmove(out, out + skip * 2 * sizeof(float), (m - skip) * 2 * sizeof(float));
+        return (m - skip) * 2 * sizeof(float);
+    }
+
+    case MODE_SPECTRUM: {
+        struct spectrum *sp = spectrum_create(samplerate, fft_size, fft_averages, frame_rate);
+        if (sp == NULL)
+            return -1;
+        unsigned int bins = spectrum_bins(sp);
+        size_t frames = spectrum_process(sp, src, n, (float *)out,
+                                         work.out_max / (bins * sizeof(float)));
+        spectrum_free(sp);
+        return frames * bins * sizeof(float);
+    }
+
+    default:
+        return -1;
+    }
+}
+
+static void *worker(void *arg) {
+    struct worker *w = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&work.lock);
+        // Stay within nslots of the writer, so results wait in bounded memory
+        while (!work.failed && work.next < work.nchunks &&
+               work.next - work.written >= work.nslots)
+            pthread_cond_wait(&work.cond, &work.lock);
+        if (work.failed || work.next >= work.nchunks) {
+            pthread_mutex_unlock(&work.lock);
+            return NULL;
+        }
+        uint64_t c = work.next++;
+        struct slot *s = &work.slots[c % work.nslots];
+        pthread_mutex_unlock(&work.lock);
+
+        ssize_t len = process_chunk(w, c, s->buf);
+
+        pthread_mutex_lock(&work.lock);
+        if (len < 0) {
+            fprintf(stderr, "Out of memory processing chunk %" PRIu64 "\n", c);
+            work.failed = true;
+        }
+        s->len = len < 0 ? 0 : len;
+        s->ready = true;
+        pthread_cond_broadcast(&work.cond);
+        pthread_mutex_unlock(&work.lock);
+    }
+}
+
+static int write_full(int fd, const unsigned char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t ret = write(fd, buf, len);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0)
+            return -1;
+        buf += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+// Chunk length in samples and the largest result of one chunk for the mode
+static int plan(uint64_t chunk) {
+    switch (mode) {
+    case MODE_RAW:
+        work.out_max = chunk * sizeof(int16_t);
+        break;
+    case MODE_F32:
+        work.out_max = chunk * sizeof(float);
+        break;
+    case MODE_DDC: {
+        struct ddc *ddc = ddc_create(samplerate, ddc_freq, ddc_decim, DDC_BLOCK);
+        if (ddc == NULL) {
+            fprintf(stderr, "Invalid decimation %u, a power of two >= 2 is needed\n", ddc_decim);
+            return -1;
+        }
+        work.settle = ddc_settle(ddc);
+        ddc_free(ddc);
+        // Chunks start on an output sample, as they would in one pass
+        chunk = (chunk + ddc_decim - 1) / ddc_decim * ddc_decim;
+        work.out_max = ((chunk + work.settle) / ddc_decim + 1) * 2 * sizeof(float);
+        break;
+    }
+    case MODE_SPECTRUM: {
+        struct spectrum *sp = spectrum_create(samplerate, fft_size, fft_averages, frame_rate);
+        if (sp == NULL) {
+            fprintf(stderr, "Invalid spectrum settings, the FFT size must be a power of two >= 16\n");
+            return -1;
+        }
+        uint64_t period = spectrum_period(sp);
+        // Chunks start on a frame, as they would in one pass
+        chunk = (chunk + period - 1) / period * period;
+        work.out_max = (chunk / period + 1) * spectrum_bins(sp) * sizeof(float);
+        spectrum_free(sp);
+        break;
+    }
+    }
+    work.chunk = chunk;
+    return 0;
+}
+
+static void printhelp(void) {
+    fprintf(stderr, "Usage: rx888_batch [options] CAPTURE\n");
+    fprintf(stderr, " -o FILE   Write the result to FILE instead of stdout\n");
+    fprintf(stderr, " -r        Undo the ADC randomizer (capture made with --rand)\n");
+    fprintf(stderr, " -s RATE   Sample rate of the capture, default 32000000\n");
+    fprintf(stderr, " -m MODE   raw (default, int16), f32 (float), ddc (float I/Q) or\n");
+    fprintf(stderr, "           spectrum (float dBFS frames)\n");
+    fprintf(stderr, " -F FREQ   ddc: frequency to tune to in Hz, default 0\n");
+    fprintf(stderr, " -d DECIM  ddc: decimation, a power of two, default 16\n");
+    fprintf(stderr, " -n SIZE   spectrum: FFT size, default 4096\n");
+    fprintf(stderr, " -a AVG    spectrum: FFTs averaged per frame, default 8\n");
+    fprintf(stderr, " -R RATE   spectrum: frames per second of capture, default 10\n");
+    fprintf(stderr, " -j N      Worker threads, default one per online CPU\n");
+    fprintf(stderr, " -c MiB    Input per chunk, default 16\n");
+}
+
+int main(int argc, char **argv) {
+    const char *out_path = NULL;
+    int out = STDOUT_FILENO;
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned long chunk_mb = 16;
+    struct timespec t0, t1;
+    uint64_t bytes = 0;
+    int ret = 0, opt;
+
+    while ((opt = getopt(argc, argv, "o:rs:m:F:d:n:a:R:j:c:h")) != -1) {
+        switch (opt) {
+        case 'o':
+            out_path = optarg;
+            break;
+        case 'r':
+            derandomize = true;
+            break;
+        case 's':
+            samplerate = strtod(optarg, NULL);
+            break;
+        case 'm':
+            if (strcmp(optarg, "raw") == 0)
+                mode = MODE_RAW;
+            else if (strcmp(optarg, "f32") == 0)
+                mode = MODE_F32;
+            else if (strcmp(optarg, "ddc") == 0)
+                mode = MODE_DDC;
+            else if (strcmp(optarg, "spectrum") == 0)
+                mode = MODE_SPECTRUM;
+            else {
+                fprintf(stderr, "Unknown mode %s\n", optarg);
+                printhelp();
+                return 1;
+            }
+            break;
+        case 'F':
+            ddc_freq = strtod(optarg, NULL);
+            break;
+        case 'd':
+            ddc_decim = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            fft_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'a':
+            fft_averages = strtoul(optarg, NULL, 10);
+            break;
+        case 'R':
+            frame_rate = strtod(optarg, NULL);
+            break;
+        case 'j':
+            nthreads = strtol(optarg, NULL, 10);
+            break;
+        case 'c':
+            chunk_mb = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            printhelp();
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1) {
+        printhelp();
+        return 1;
+    }
+    if (samplerate <= 0 || nthreads < 1 || chunk_mb < 1 || chunk_mb > 1024) {
+        fprintf(stderr, "Invalid sample rate, thread count or chunk size\n");
+        return 1;
+    }
+    if (plan(((uint64_t)chunk_mb << 20) / sizeof(int16_t)) != 0)
+        return 1;
+
+    const char *in_path = argv[optind];
+    int in = open(in_path, O_RDONLY);
+    struct stat st;
+    if (in < 0 || fstat(in, &st) != 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", in_path, strerror(errno));
+        return 1;
+    }
+    work.nsamples = st.st_size / sizeof(int16_t);
+    if (work.nsamples == 0) {
+        fprintf(stderr, "%s holds no samples\n", in_path);
+        return 1;
+    }
+    work.in = mmap(NULL, work.nsamples * sizeof(int16_t), PROT_READ, MAP_SHARED, in, 0);
+    if (work.in == MAP_FAILED) {
+        fprintf(stderr, "Cannot map %s: %s\n", in_path, strerror(errno));
+        return 1;
+    }
+    close(in);
+    madvise((void *)work.in, work.nsamples * sizeof(int16_t), MADV_SEQUENTIAL);
+    work.nchunks = (work.nsamples + work.chunk - 1) / work.chunk;
+
+    if (out_path) {
+        out = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out < 0) {
+            fprintf(stderr, "Cannot open %s: %s\n", out_path, strerror(errno));
+            return 1;
+        }
+    }
+
+    if ((uint64_t)nthreads > work.nchunks)
+        nthreads = work.nchunks;
+    work.nslots = 2 * nthreads;
+    work.slots = calloc(work.nslots, sizeof(struct slot));
+    struct worker *workers = calloc(nthreads, sizeof(struct worker));
+    if (work.slots == NULL || workers == NULL)
+        return 1;
+    for (unsigned int i = 0; i < work.nslots; i++) {
+        work.slots[i].buf = malloc(work.out_max);
+        if (work.slots[i].buf == NULL) {
+            fprintf(stderr, "Out of memory for %u chunk results\n", work.nslots);
+            return 1;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (long i = 0; i < nthreads; i++) {
+        if (derandomize && mode != MODE_RAW) {
+            workers[i].samples = malloc((work.chunk + work.settle) * sizeof(int16_t));
+            if (workers[i].samples == NULL)
+                return 1;
+        }
+        if (pthread_create(&workers[i].thread, NULL, worker, &workers[i]) != 0) {
+            fprintf(stderr, "Could not start worker threads\n");
+            return 1;
+        }
+    }
+
+    // Write the results in chunk order
+    for (uint64_t c = 0; c < work.nchunks; c++) {
+        struct slot *s = &work.slots[c % work.nslots];
+
+        pthread_mutex_lock(&work.lock);
+        while (!s->ready)
+            pthread_cond_wait(&work.cond, &work.lock);
+        bool failed = work.failed;
+        pthread_mutex_unlock(&work.lock);
+        if (failed) {
+            ret = 1;
+            break;
+        }
+
+        if (write_full(out, s->buf, s->len) != 0) {
+            fprintf(stderr, "Error writing output: %s\n", strerror(errno));
+            ret = 1;
+        }
+        bytes += s->len;
+
+        pthread_mutex_lock(&work.lock);
+        s->ready = false;
+        work.written++;
+        if (ret != 0)
+            work.failed = true;
+        pthread_cond_broadcast(&work.cond);
+        pthread_mutex_unlock(&work.lock);
+        if (ret != 0)
+            break;
+    }
+    if (ret != 0) {
+        // Let workers waiting on a slot see the failure
+        pthread_mutex_lock(&work.lock);
+        work.failed = true;
+        pthread_cond_broadcast(&work.cond);
+        pthread_mutex_unlock(&work.lock);
+    }
+    for (long i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        free(workers[i].samples);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    double rate = secs > 0 ? work.nsamples / secs : 0;
+    fprintf(stderr, "%" PRIu64 " samples in %" PRIu64 " chunks on %ld threads in %.2f s: "
+            "%.1f MS/s, %.1fx real time, %" PRIu64 " bytes out\n", work.nsamples,
+            work.nchunks, nthreads, secs, rate / 1e6, rate / samplerate, bytes);
+
+    for (unsigned int i = 0; i < work.nslots; i++)
+        free(work.slots[i].buf);
+    free(work.slots);
+    free(workers);
+    munmap((void *)work.in, work.nsamples * sizeof(int16_t));
+    if (out != STDOUT_FILENO && close(out) != 0) {
+        fprintf(stderr, "Error writing output: %s\n", strerror(errno));
+        ret = 1;
+    }
+    return ret;
+}
@@ -0,0 +1,581 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+/*
+ * rx888_gadget - RX888 emulator on the device side of the USB stack.
+ *
+ * Runs a FunctionFS function in a configfs gadget, normally on dummy_hcd
+ * so host and device are the same machine (see rx888_gadget.sh). It
+ * enumerates as the FX3 bootloader, takes the firmware upload that
+ * rx888_stream sends, re-enumerates with the SDDC firmware PID, answers
+ * the vendor requests from rx888.h and streams a sample counter ramp on
+ * its bulk IN endpoint at the STARTADC rate. rx888_stream runs unmodified
+ * against it, through libusb and usbfs.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/usb/ch9.h>
+#include <linux/usb/functionfs.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rx888.h"
+
+#define PID_BOOT 0x00f3
+#define PID_STREAM 0x00f1
+#define RW_INTERNAL 0xA0 // FX3 bootloader RAM access, as in ezusb.c
+#define FW_CHUNK 4096
+#define NUM_ARGS 16
+
+static const char *ffs_path = "/dev/ffs-rx888";
+static const char *gadget_path = "/sys/kernel/config/usb_gadget/rx888";
+static const char *udc_name = NULL;
+static size_t chunk = 131072; // bytes per bulk write
+static int boot = 1;
+static int verbose;
+
+static volatile sig_atomic_t do_exit;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool enabled;   // host has configured the function
+    bool streaming; // STARTFX3 seen
+    uint32_t samplerate;
+    uint32_t gpio;
+    uint16_t args[NUM_ARGS];
+
+    unsigned char fw_chunk[FW_CHUNK];
+    uint32_t fw_addr;
+    uint16_t fw_len;
+
+    uint64_t fw_bytes;
+    uint64_t bytes;
+    uint64_t lost_samples;
+} dev = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static int ep0 = -1;
+static int ep1 = -1;
+
+struct ffs_descs {
+    struct usb_functionfs_descs_head_v2 header;
+    __le32 fs_count;
+    __le32 hs_count;
+    __le32 ss_count;
+    struct {
+        struct usb_interface_descriptor intf;
+        struct usb_endpoint_descriptor_no_audio bulk;
+    } __attribute__((packed)) fs, hs;
+    struct {
+        struct usb_interface_descriptor intf;
+        struct usb_endpoint_descriptor_no_audio bulk;
+        struct usb_ss_ep_comp_descriptor comp;
+    } __attribute__((packed)) ss;
+} __attribute__((packed));
+
+struct ffs_strings {
+    struct usb_functionfs_strings_head header;
+    struct {
+        __le16 code;
+        const char str[sizeof("RX888 emulator")];
+    } __attribute__((packed)) lang;
+} __attribute__((packed));
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t t) {
+    struct timespec ts = {.tv_sec = t / 1000000000ULL, .tv_nsec = t % 1000000000ULL};
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+static void fill_interface(struct usb_interface_descriptor *intf) {
+    intf->bLength = sizeof(*intf);
+    intf->bDescriptorType = USB_DT_INTERFACE;
+    intf->bNumEndpoints = 1;
+    intf->bInterfaceClass = USB_CLASS_VENDOR_SPEC;
+    intf->iInterface = 1;
+}
+
+static void fill_bulk(struct usb_endpoint_descriptor_no_audio *ep, uint16_t maxpacket) {
+    ep->bLength = sizeof(*ep);
+    ep->bDescriptorType = USB_DT_ENDPOINT;
+    ep->bEndpointAddress = 1 | USB_DIR_IN; // rx888_stream expects 0x81
+    ep->bmAttributes = USB_ENDPOINT_XFER_BULK;
+    ep->wMaxPacketSize = htole16(maxpacket);
+}
+
+/*
+ * One vendor interface with one bulk IN endpoint, 1024 byte packets and
+ * bursts of 16 at SuperSpeed like the FX3. ALL_CTRL_RECIP routes the
+ * device-recipient vendor requests the FX3 uses to us.
+ */
+static int write_descriptors(void) {
+    struct ffs_descs d;
+    struct ffs_strings s;
+
+    memset(&d, 0, sizeof(d));
+    d.header.magic = htole32(FUNCTIONFS_DESCRIPTORS_MAGIC_V2);
+    d.header.flags = htole32(FUNCTIONFS_HAS_FS_DESC | FUNCTIONFS_HAS_HS_DESC |
+                             FUNCTIONFS_HAS_SS_DESC | FUNCTIONFS_ALL_CTRL_RECIP |
+                             FUNCTIONFS_CONFIG0_SETUP);
+    d.header.length = htole32(sizeof(d));
+    d.fs_count = htole32(2);
+    d.hs_count = htole32(2);
+    d.ss_count = htole32(3);
+    fill_interface(&d.fs.intf);
+    fill_bulk(&d.fs.bulk, 64);
+    fill_interface(&d.hs.intf);
+    fill_bulk(&d.hs.bulk, 512);
+    fill_interface(&d.ss.intf);
+    fill_bulk(&d.ss.bulk, 1024);
+    d.ss.comp.bLength = USB_DT_SS_EP_COMP_SIZE;
+    d.ss.comp.bDescriptorType = USB_DT_SS_ENDPOINT_COMP;
+    d.ss.comp.bMaxBurst = 15;
+
+    memset(&s, 0, sizeof(s));
+    s.header.magic = htole32(FUNCTIONFS_STRINGS_MAGIC);
+    s.header.length = htole32(sizeof(s));
+    s.header.str_count = htole32(1);
+    s.header.lang_count = htole32(1);
+    s.lang.code = htole16(0x0409);
+    memcpy((char *)s.lang.str, "RX888 emulator", sizeof(s.lang.str));
+
+    if (write(ep0, &d, sizeof(d)) != sizeof(d)) {
+        fprintf(stderr, "Writing FunctionFS descriptors: %s\n", strerror(errno));
+        return -1;
+    }
+    if (write(ep0, &s, sizeof(s)) != sizeof(s)) {
+        fprintf(stderr, "Writing FunctionFS strings: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int write_attr(const char *name, const char *value) {
+    char path[512];
+    int fd, ret = 0;
+
+    snprintf(path, sizeof(path), "%s/%s", gadget_path, name);
+    fd = open(path, O_WRONLY);
+    if (fd < 0 || write(fd, value, strlen(value)) < 0) {
+        fprintf(stderr, "Writing %s: %s\n", path, strerror(errno));
+        ret = -1;
+    }
+    if (fd >= 0)
+        close(fd);
+    return ret;
+}
+
+// Bind the gadget to the UDC with the PID of the current mode
+static int attach(void) {
+    char pid[16];
+
+    snprintf(pid, sizeof(pid), "0x%04x", boot ? PID_BOOT : PID_STREAM);
+    if (write_attr("idProduct", pid) != 0)
+        return -1;
+    fprintf(stderr, "Attaching as 04b4:%04x (%s)\n", boot ? PID_BOOT : PID_STREAM,
+            boot ? "bootloader" : "firmware");
+    return write_attr("UDC", udc_name);
+}
+
+// Like the FX3: drop off the bus and come back with the other PID
+static void *reenumerate(void *arg) {
+    (void)arg;
+    usleep(100000); // let the status stage of the request finish
+    write_attr("UDC", "\n");
+    usleep(500000);
+    attach();
+    return NULL;
+}
+
+static void schedule_reenumerate(void) {
+    pthread_t t;
+    if (pthread_create(&t, NULL, reenumerate, NULL) == 0)
+        pthread_detach(t);
+}
+
+static uint32_t get_u32(const unsigned char *data, uint16_t length) {
+    uint32_t v = 0;
+    if (length >= sizeof(v))
+        memcpy(&v, data, sizeof(v));
+    return le32toh(v);
+}
+
+static void stall(const struct usb_ctrlrequest *setup) {
+    // FunctionFS stalls a request when ep0 is used in the wrong direction
+    if (setup->bRequestType & USB_DIR_IN) {
+        if (read(ep0, NULL, 0) < 0 && verbose)
+            fprintf(stderr, "Stalled request 0x%02x\n", setup->bRequest);
+    } else {
+        if (write(ep0, NULL, 0) < 0 && verbose)
+            fprintf(stderr, "Stalled request 0x%02x\n", setup->bRequest);
+    }
+}
+
+static bool known_request(bool in, uint8_t request) {
+    if (boot)
+        return request == RW_INTERNAL;
+    if (in)
+        return request == TESTFX3 || request == I2CRFX3 || request == READINFODEBUG;
+    switch (request) {
+    case STARTFX3:
+    case STOPFX3:
+    case GPIOFX3:
+    case I2CWFX3:
+    case RESETFX3:
+    case SETARGFX3:
+    case STARTADC:
+    case TUNERINIT:
+    case TUNERTUNE:
+    case TUNERSTDBY:
+        return true;
+    }
+    return false;
+}
+
+static void handle_out(uint8_t request, uint16_t value, uint16_t index,
+                       const unsigned char *data, uint16_t length) {
+    uint32_t addr = value | (uint32_t)index << 16;
+
+    pthread_mutex_lock(&dev.lock);
+    if (boot) {
+        if (length == 0) {
+            fprintf(stderr, "Firmware jump to 0x%08x after %llu bytes\n", addr,
+                    (unsigned long long)dev.fw_bytes);
+            boot = 0;
+            schedule_reenumerate();
+        } else if (length <= FW_CHUNK) {
+            memcpy(dev.fw_chunk, data, length);
+            dev.fw_addr = addr;
+            dev.fw_len = length;
+            dev.fw_bytes += length;
+        }
+        pthread_mutex_unlock(&dev.lock);
+        return;
+    }
+
+    switch (request) {
+    case STARTFX3:
+        dev.streaming = true;
+        break;
+    case STOPFX3:
+        dev.streaming = false;
+        break;
+    case GPIOFX3:
+        dev.gpio = get_u32(data, length);
+        break;
+    case STARTADC:
+        dev.samplerate = get_u32(data, length);
+        fprintf(stderr, "ADC at %u Hz\n", dev.samplerate);
+        break;
+    case SETARGFX3:
+        if (index < NUM_ARGS)
+            dev.args[index] = value;
+        break;
+    case RESETFX3:
+        dev.streaming = false;
+        boot = 1;
+        schedule_reenumerate();
+        break;
+    }
+    if (verbose)
+        fprintf(stderr, "Request 0x%02x value 0x%04x index 0x%04x length %u\n",
+                request, value, index, length);
+    pthread_cond_broadcast(&dev.cond);
+    pthread_mutex_unlock(&dev.lock);
+}
+
+static int handle_in(uint8_t request, uint16_t value, uint16_t index,
+                     unsigned char *data, uint16_t length) {
+    uint32_t addr = value | (uint32_t)index << 16;
+    int n = length;
+
+    memset(data, 0, length);
+    pthread_mutex_lock(&dev.lock);
+    if (boot) {
+        if (addr == dev.fw_addr && length <= dev.fw_len)
+            memcpy(data, dev.fw_chunk, length);
+    } else if (request == READINFODEBUG) {
+        n = 0;
+    }
+    pthread_mutex_unlock(&dev.lock);
+    return n;
+}
+
+static void handle_setup(const struct usb_ctrlrequest *setup) {
+    static unsigned char buf[FW_CHUNK];
+    bool in = setup->bRequestType & USB_DIR_IN;
+    uint16_t value = le16toh(setup->wValue);
+    uint16_t index = le16toh(setup->wIndex);
+    uint16_t length = le16toh(setup->wLength);
+
+    if ((setup->bRequestType & USB_TYPE_MASK) != USB_TYPE_VENDOR ||
+        length > sizeof(buf) || !known_request(in, setup->bRequest)) {
+        stall(setup);
+        return;
+    }
+
+    if (in) {
+        int n = handle_in(setup->bRequest, value, index, buf, length);
+        if (write(ep0, buf, n) < 0)
+            fprintf(stderr, "ep0 write: %s\n", strerror(errno));
+    } else {
+        // Reading the data stage also acknowledges the request
+        ssize_t n = read(ep0, buf, length);
+        if (n < 0) {
+            fprintf(stderr, "ep0 read: %s\n", strerror(errno));
+            return;
+        }
+        handle_out(setup->bRequest, value, index, buf, n);
+    }
+}
+
+// Sample counter ramp, through the ADC randomizer if it is enabled
+static void fill(int16_t *samples, size_t n, uint64_t first, bool randomize) {
+    for (size_t i = 0; i < n; i++) {
+        uint16_t v = (uint16_t)(first + i);
+        if (randomize && (v & 1))
+            v ^= 0xfffe;
+        samples[i] = (int16_t)v;
+    }
+}
+
+/*
+ * The GPIF engine. Writes block until the host reads; falling behind the
+ * ADC clock by more than a chunk means the FX3 FIFO overflowed, and the
+ * ramp skips the samples that were lost.
+ */
+static void *streamer(void *arg) {
+    unsigned char *buf = malloc(chunk);
+    uint64_t sample = 0, t = 0;
+    size_t n = chunk / sizeof(int16_t);
+
+    (void)arg;
+    if (buf == NULL)
+        return NULL;
+    while (!do_exit) {
+        pthread_mutex_lock(&dev.lock);
+        if (!(dev.enabled && dev.streaming && dev.samplerate)) {
+            pthread_cond_wait(&dev.cond, &dev.lock);
+            pthread_mutex_unlock(&dev.lock);
+            t = now_ns();
+            continue;
+        }
+        uint32_t rate = dev.samplerate;
+        bool randomize = dev.gpio & RANDO;
+        pthread_mutex_unlock(&dev.lock);
+
+        uint64_t period = n * 1000000000ULL / rate;
+        uint64_t now = now_ns();
+        if (now > t + period) {
+            uint64_t lost = (now - t) * rate / 1000000000ULL;
+            sample += lost;
+            t = now;
+            pthread_mutex_lock(&dev.lock);
+            dev.lost_samples += lost;
+            pthread_mutex_unlock(&dev.lock);
+        }
+        sleep_until(t);
+        t += period;
+
+        fill((int16_t *)buf, n, sample, randomize);
+        ssize_t ret = write(ep1, buf, chunk);
+        if (ret < 0) {
+            // ESHUTDOWN while the host has the function disabled
+            if (errno != EINTR)
+                usleep(10000);
+            continue;
+        }
+        sample += ret / sizeof(int16_t);
+        pthread_mutex_lock(&dev.lock);
+        dev.bytes += ret;
+        pthread_mutex_unlock(&dev.lock);
+    }
+    free(buf);
+    return NULL;
+}
+
+static const char *find_udc(void) {
+    static char name[256];
+    DIR *dir = opendir("/sys/class/udc");
+    struct dirent *e;
+
+    if (dir == NULL)
+        return NULL;
+    while ((e = readdir(dir)) != NULL) {
+        if (e->d_name[0] != '.') {
+            snprintf(name, sizeof(name), "%s", e->d_name);
+            closedir(dir);
+            return name;
+        }
+    }
+    closedir(dir);
+    return NULL;
+}
+
+static void sig_stop(int signum) {
+    (void)signum;
+    do_exit = 1;
+}
+
+static void printhelp(void) {
+    fprintf(stderr, "Usage: rx888_gadget [options], normally started by rx888_gadget.sh\n");
+    fprintf(stderr, " -f PATH   FunctionFS mount point (default %s)\n", ffs_path);
+    fprintf(stderr, " -g PATH   configfs gadget directory (default %s)\n", gadget_path);
+    fprintf(stderr, " -u UDC    UDC to bind to (default: the first in /sys/class/udc)\n");
+    fprintf(stderr, " -b 0|1    Start in bootloader mode (default 1)\n");
+    fprintf(stderr, " -c BYTES  Bulk write size (default %zu)\n", chunk);
+    fprintf(stderr, " -v        Log every vendor request\n");
+}
+
+int main(int argc, char **argv) {
+    struct sigaction sigact = {.sa_handler = sig_stop};
+    char path[512];
+    pthread_t thread;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:g:u:b:c:vh")) != -1) {
+        switch (opt) {
+        case 'f':
+            ffs_path = optarg;
+            break;
+        case 'g':
+            gadget_path = optarg;
+            break;
+        case 'u':
+            udc_name = optarg;
+            break;
+        case 'b':
+            boot = strtol(optarg, NULL, 10) != 0;
+            break;
+        case 'c':
+            chunk = strtoul(optarg, NULL, 10);
+            if (chunk < 1024 || chunk % 1024) {
+                fprintf(stderr, "Invalid write size %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            printhelp();
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (udc_name == NULL && (udc_name = find_udc()) == NULL) {
+        fprintf(stderr, "No UDC found, is dummy_hcd loaded?\n");
+        return 1;
+    }
+
+    // No SA_RESTART: the blocking ep0 read has to return on a signal
+    sigemptyset(&sigact.sa_mask);
+    sigaction(SIGINT, &sigact, NULL);
+    sigaction(SIGTERM, &sigact, NULL);
+
+    snprintf(path, sizeof(path), "%s/ep0", ffs_path);
+    ep0 = open(path, O_RDWR);
+    if (ep0 < 0) {
+        fprintf(stderr, "Opening %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    if (write_descriptors() != 0)
+        return 1;
+    // ep1 exists once the descriptors are in
+    snprintf(path, sizeof(path), "%s/ep1", ffs_path);
+    ep1 = open(path, O_RDWR);
+    if (ep1 < 0) {
+        fprintf(stderr, "Opening %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    if (pthread_create(&thread, NULL, streamer, NULL) != 0)
+        return 1;
+    if (attach() != 0)
+        do_exit = 1;
+
+    while (!do_exit) {
+        struct usb_functionfs_event events[4];
+        ssize_t ret = read(ep0, events, sizeof(events));
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "ep0 read: %s\n", strerror(errno));
+            break;
+        }
+        for (size_t i = 0; i < ret / sizeof(events[0]); i++) {
+            switch (events[i].type) {
+            case FUNCTIONFS_ENABLE:
+            case FUNCTIONFS_DISABLE:
+                pthread_mutex_lock(&dev.lock);
+                dev.enabled = events[i].type == FUNCTIONFS_ENABLE;
+                if (!dev.enabled)
+                    dev.streaming = false;
+                pthread_cond_broadcast(&dev.cond);
+                pthread_mutex_unlock(&dev.lock);
+                if (verbose)
+                    fprintf(stderr, "Function %s\n", dev.enabled ? "enabled" : "disabled");
+                break;
+            case FUNCTIONFS_SETUP:
+                handle_setup(&events[i].u.setup);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    do_exit = 1;
+    write_attr("UDC", "\n");
+    pthread_mutex_lock(&dev.lock);
+    pthread_cond_broadcast(&dev.cond);
+    pthread_mutex_unlock(&dev.lock);
+    pthread_join(thread, NULL);
+    fprintf(stderr, "Streamed %llu bytes, %llu samples lost, %llu firmware bytes\n",
+            (unsigned long long)dev.bytes, (unsigned long long)dev.lost_samples,
+            (unsigned long long)dev.fw_bytes);
+    close(ep1);
+    close(ep0);
+    return 0;
+}
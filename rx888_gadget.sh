@@ -0,0 +1,53 @@
+#!/bin/sh
+#
+# Run rx888_gadget on dummy_hcd, so rx888_stream on the same machine sees
+# an RX888 on a SuperSpeed port. Needs root, configfs and FunctionFS.
+#
+#   sudo ./rx888_gadget.sh start [rx888_gadget options]
+#   ./rx888_stream -f SDDC_FX3.img -s 32000000 -o /dev/null
+#   sudo ./rx888_gadget.sh stop
+#
+set -e
+
+CONFIGFS=/sys/kernel/config
+G=$CONFIGFS/usb_gadget/rx888
+FFS=/dev/ffs-rx888
+
+case "$1" in
+start)
+    shift
+    # librx888 needs the SuperSpeed endpoint companion descriptor
+    modprobe dummy_hcd is_super_speed=1
+    modprobe libcomposite
+    mountpoint -q $CONFIGFS || mount -t configfs none $CONFIGFS
+
+    mkdir -p $G
+    echo 0x04b4 > $G/idVendor
+    echo 0x00f3 > $G/idProduct
+    echo 0x0300 > $G/bcdUSB
+    mkdir -p $G/strings/0x409
+    echo "Cypress" > $G/strings/0x409/manufacturer
+    echo "RX888 emulator" > $G/strings/0x409/product
+    mkdir -p $G/configs/c.1/strings/0x409
+    echo "RX888" > $G/configs/c.1/strings/0x409/configuration
+    echo 500 > $G/configs/c.1/MaxPower
+    mkdir -p $G/functions/ffs.rx888
+    [ -e $G/configs/c.1/ffs.rx888 ] || ln -s $G/functions/ffs.rx888 $G/configs/c.1/
+
+    mkdir -p $FFS
+    mountpoint -q $FFS || mount -t functionfs rx888 $FFS
+    exec "$(dirname "$0")/rx888_gadget" -f $FFS -g $G "$@"
+    ;;
+stop)
+    [ -d $G ] || exit 0
+    echo "" > $G/UDC 2>/dev/null || true
+    mountpoint -q $FFS && umount $FFS
+    rm -f $G/configs/c.1/ffs.rx888
+    rmdir $G/configs/c.1/strings/0x409 $G/configs/c.1 $G/functions/ffs.rx888 \
+        $G/strings/0x409 $G
+    ;;
+*)
+    echo "Usage: $0 start [rx888_gadget options] | stop" >&2
+    exit 1
+    ;;
+esac
@@ -0,0 +1,374 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+/*
+ * rx888_journal - summarize a per-transfer journal written by
+ * rx888_stream --journal: failures by status, gaps in the sample stream,
+ * completion jitter, time spent in the completion path and held by the
+ * application, queue occupancy, and clusters of failed transfers.
+ *
+ *   rx888_journal capture.jnl
+ *   rx888_journal -g 50 -l capture.jnl
+ */
+
+#include "journal.h"
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LISTED 20 // clusters and gaps shown without -l
+
+static const char *status_name(int32_t status) {
+    // enum libusb_transfer_status
+    static const char *const names[] = {
+        "COMPLETED", "ERROR", "TIMED_OUT", "CANCELLED", "STALL", "NO_DEVICE", "OVERFLOW",
+    };
+    if (status >= 0 && status < (int32_t)(sizeof(names) / sizeof(names[0])))
+        return names[status];
+    return "UNKNOWN";
+}
+
+#define STATUSES 8 // counted per status, the last for unknown ones
+
+static unsigned int status_slot(int32_t status) {
+    return status >= 0 && status < STATUSES - 1 ? (unsigned int)status : STATUSES - 1;
+}
+
+static int compare_time(const void *a, const void *b) {
+    const struct journal_record *x = a, *y = b;
+    if (x->time_ns != y->time_ns)
+        return (x->time_ns > y->time_ns) - (x->time_ns < y->time_ns);
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Sorts v
+static uint64_t quantile(uint64_t *v, size_t n, double q) {
+    if (n == 0)
+        return 0;
+    qsort(v, n, sizeof(*v), compare_u64);
+    size_t i = (size_t)(q * (n - 1) + 0.5);
+    return v[i];
+}
+
+static void print_us(const char *what, uint64_t *v, size_t n) {
+    printf("%-20s p50 %9.1f us  p99 %9.1f us  max %9.1f us\n", what,
+           quantile(v, n, 0.5) / 1e3, quantile(v, n, 0.99) / 1e3, quantile(v, n, 1.0) / 1e3);
+}
+
+static void print_statuses(const uint64_t *count) {
+    bool first = true;
+    for (unsigned int s = 1; s < STATUSES; s++) {
+        if (count[s] == 0)
+            continue;
+        printf("%s%s %" PRIu64, first ? "" : ", ",
+               s == STATUSES - 1 ? "UNKNOWN" : status_name(s), count[s]);
+        first = false;
+    }
+}
+
+/*
+ * Good transfers whose first sample is not where the one before ended,
+ * where the synthetic source or an overrun lost samples. Lists the first
+ * list of them; returns how many there are, the samples lost in *samples
+ * and the sequence numbers with no record in *missing.
+ */
+static uint64_t sample_gaps(const struct journal_record *recs, size_t n, uint64_t list,
+                            uint64_t *samples, uint64_t *missing) {
+    const struct journal_record *prev = NULL;
+    uint64_t gaps = 0;
+
+    *samples = *missing = 0;
+    for (size_t i = 0; i < n; i++) {
+        const struct journal_record *r = &recs[i];
+        if (r->status != 0)
+            continue;
+        if (prev && r->seq > prev->seq + 1)
+            *missing += r->seq - prev->seq - 1;
+        uint64_t expect = prev ? prev->sample_index + prev->length / 2 : r->sample_index;
+        if (prev && r->sample_index > expect) {
+            if (gaps++ < list)
+                printf("  gap at %+.6f s: %" PRIu64 " samples before seq %" PRIu64 "\n",
+                       (r->time_ns - recs[0].time_ns) / 1e9, r->sample_index - expect, r->seq);
+            *samples += r->sample_index - expect;
+        }
+        prev = r;
+    }
+    return gaps;
+}
+
+/*
+ * Completions more than limit_ns after the one before while streaming:
+ * with every transfer in flight still queued, the device was not sending,
+ * which on the RX888 means its buffer overflowed and samples were lost.
+ */
+static uint64_t late_completions(const struct journal_record *recs, size_t n, uint64_t limit_ns,
+                                 uint64_t list, uint64_t *longest) {
+    uint64_t late = 0;
+
+    *longest = 0;
+    for (size_t i = 1; i < n; i++) {
+        uint64_t d = recs[i].time_ns - recs[i - 1].time_ns;
+        if (d <= limit_ns || (recs[i].flags & JOURNAL_DRAINING))
+            continue;
+        if (late++ < list)
+            printf("  %.3f ms without a completion before %+.6f s, %u in flight\n", d / 1e6,
+                   (recs[i].time_ns - recs[0].time_ns) / 1e9, recs[i].in_flight + 1);
+        if (d > *longest)
+            *longest = d;
+    }
+    return late;
+}
+
+// Runs of failed transfers less than limit_ns apart
+static uint64_t stall_clusters(const struct journal_record *recs, size_t n, uint64_t limit_ns,
+                               uint64_t list) {
+    uint64_t clusters = 0;
+
+    for (size_t i = 0; i < n;) {
+        if (recs[i].status == 0) {
+            i++;
+            continue;
+        }
+        uint64_t start = recs[i].time_ns, end = start, failed = 0, count[STATUSES] = {0};
+        size_t j = i;
+        for (; j < n; j++) {
+            if (recs[j].status == 0)
+                continue;
+            if (recs[j].time_ns - end > limit_ns)
+                break;
+            end = recs[j].time_ns;
+            failed++;
+            count[status_slot(recs[j].status)]++;
+        }
+        if (clusters++ < list) {
+            printf("  stall at %+.6f s, %.3f ms: %" PRIu64 " failed (",
+                   (start - recs[0].time_ns) / 1e9, (end - start) / 1e6, failed);
+            print_statuses(count);
+            printf(")\n");
+        }
+        i = j;
+    }
+    return clusters;
+}
+
+static struct journal_record *read_journal(const char *path, struct journal_header *hdr,
+                                           size_t *count) {
+    struct journal_record *recs = NULL;
+    size_t n = 0, cap = 0;
+    FILE *f = fopen(path, "rb");
+
+    if (f == NULL) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (fread(hdr, sizeof(*hdr), 1, f) != 1 ||
+        memcmp(hdr->magic, JOURNAL_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != JOURNAL_VERSION || hdr->record_size != sizeof(*recs)) {
+        fprintf(stderr, "%s: not a version %d journal\n", path, JOURNAL_VERSION);
+        fclose(f);
+        return NULL;
+    }
+    for (;;) {
+        if (n == cap) {
+            cap = cap ? 2 * cap : 65536;
+            struct journal_record *r = realloc(recs, cap * sizeof(*recs));
+            if (r == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                free(recs);
+                fclose(f);
+                return NULL;
+            }
+            recs = r;
+        }
+        size_t got = fread(recs + n, sizeof(*recs), cap - n, f);
+        n += got;
+        if (got == 0)
+            break;
+    }
+    if (ferror(f))
+        fprintf(stderr, "%s: %s, using the first %zu records\n", path, strerror(errno), n);
+    fclose(f);
+    *count = n;
+    return recs;
+}
+
+static void printhelp(void) {
+    fprintf(stderr, "Usage: rx888_journal [-g MS] [-l] JOURNAL\n");
+    fprintf(stderr, " -g MS  Failed transfers less than MS apart form one stall cluster, "
+            "default 10\n");
+    fprintf(stderr, " -l     List every stall cluster and sample gap, not just the first %d\n",
+            LISTED);
+    fprintf(stderr, " -h     Print this help\n");
+}
+
+int main(int argc, char **argv) {
+    struct journal_header hdr;
+    struct journal_record *recs;
+    double cluster_ms = 10;
+    bool list_all = false;
+    size_t n;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "g:lh")) != -1) {
+        switch (opt) {
+        case 'g':
+            cluster_ms = strtod(optarg, NULL);
+            break;
+        case 'l':
+            list_all = true;
+            break;
+        default:
+            printhelp();
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (argc - optind != 1 || !(cluster_ms > 0)) {
+        printhelp();
+        return 1;
+    }
+    recs = read_journal(argv[optind], &hdr, &n);
+    if (recs == NULL)
+        return 1;
+    if (n == 0) {
+        printf("%s: no transfers\n", argv[optind]);
+        return 0;
+    }
+
+    // Written in release order: put them back in completion order
+    qsort(recs, n, sizeof(*recs), compare_time);
+    uint64_t t0 = recs[0].time_ns;
+    double span = (recs[n - 1].time_ns - t0) / 1e9;
+    double period_ns = hdr.samplerate ? hdr.block_size / 2 * 1e9 / hdr.samplerate : 0;
+
+    printf("%s: %zu transfers over %.3f s, %u S/s, %u byte blocks, queue depth %u\n",
+           argv[optind], n, span, hdr.samplerate, hdr.block_size, hdr.queuedepth);
+
+    uint64_t *complete = malloc(n * sizeof(uint64_t));
+    uint64_t *hold = malloc(n * sizeof(uint64_t));
+    uint64_t *interval = malloc(n * sizeof(uint64_t));
+    if (complete == NULL || hold == NULL || interval == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    // Failures and short transfers; completion path and hold times of the good ones
+    uint64_t status[STATUSES] = {0}, shorts = 0, good = 0, draining = 0;
+    unsigned int in_flight_min = UINT16_MAX, ready_max = 0;
+    uint64_t in_flight_min_ns = 0, in_flight_sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        const struct journal_record *r = &recs[i];
+        if (i > 0)
+            interval[i - 1] = r->time_ns - recs[i - 1].time_ns;
+        if (r->flags & JOURNAL_DRAINING) {
+            draining++;
+        } else {
+            in_flight_sum += r->in_flight;
+            if (r->in_flight < in_flight_min) {
+                in_flight_min = r->in_flight;
+                in_flight_min_ns = r->time_ns - t0;
+            }
+            if (r->ready > ready_max)
+                ready_max = r->ready;
+        }
+        if (r->status != 0) {
+            status[status_slot(r->status)]++;
+            continue;
+        }
+        shorts += r->length < hdr.block_size;
+        complete[good] = r->complete_ns;
+        hold[good++] = r->hold_ns;
+    }
+    printf("Transfers: %" PRIu64 " completed (%" PRIu64 " short), %zu failed", good, shorts,
+           (size_t)(n - good));
+    if (good < n) {
+        printf(": ");
+        print_statuses(status);
+    }
+    printf("; %" PRIu64 " after the stop\n", draining);
+    if (hdr.lost)
+        printf("Records lost with the journal ring full: %" PRIu64 "\n", hdr.lost);
+
+    uint64_t list = list_all ? UINT64_MAX : LISTED, more = 0;
+    uint64_t samples, missing;
+    uint64_t gaps = sample_gaps(recs, n, 0, &samples, &missing);
+    printf("Sample gaps: %" PRIu64 ", %" PRIu64 " samples", gaps, samples);
+    if (hdr.samplerate)
+        printf(" (%.3f ms)", samples * 1e3 / hdr.samplerate);
+    printf("; good transfers with no record: %" PRIu64 "\n", missing);
+    sample_gaps(recs, n, list, &samples, &missing);
+    more += gaps > list;
+
+    if (n > 1) {
+        double sum = 0, sq = 0;
+        for (size_t i = 0; i + 1 < n; i++) {
+            sum += interval[i];
+            sq += (double)interval[i] * interval[i];
+        }
+        double mean = sum / (n - 1);
+        double sd = sqrt(fmax(sq / (n - 1) - mean * mean, 0));
+        printf("Completion interval: mean %.1f us (block period %.1f us), jitter %.1f us rms\n",
+               mean / 1e3, period_ns / 1e3, sd / 1e3);
+        print_us("  interval", interval, n - 1);
+    }
+    if (period_ns > 0) {
+        uint64_t longest, limit = 2 * period_ns;
+        uint64_t late = late_completions(recs, n, limit, 0, &longest);
+        printf("Late completions: %" PRIu64 " over %.1f us apart, longest %.3f ms\n", late,
+               limit / 1e3, longest / 1e6);
+        late_completions(recs, n, limit, list, &longest);
+        more += late > list;
+    }
+    print_us("Completion path", complete, good);
+    print_us("Held by application", hold, good);
+    if (draining < n)
+        printf("Queue while streaming: in flight mean %.1f, fewest %u (at %+.6f s), "
+               "most waiting to be leased %u\n", (double)in_flight_sum / (n - draining),
+               in_flight_min, in_flight_min_ns / 1e9, ready_max);
+
+    uint64_t clusters = stall_clusters(recs, n, cluster_ms * 1e6, 0);
+    printf("Stall clusters: %" PRIu64 " (failures less than %g ms apart)\n", clusters,
+           cluster_ms);
+    stall_clusters(recs, n, cluster_ms * 1e6, list);
+    more += clusters > list;
+    if (more)
+        printf("Use -l to list them all\n");
+
+    free(complete);
+    free(hold);
+    free(interval);
+    free(recs);
+    return 0;
+}
@@ -23,111 +23,1122 @@ SOFTWARE.
 
 */
 
-#include "ezusb.h"
+#define _GNU_SOURCE // sync_file_range
+#include "daemon.h"
+#include "dsp.h"
+#include "elastic.h"
+#include "gaincal.h"
+#include "kernels.h"
+#include "librx888.h"
+#include "rtl_tcp.h"
+#include "sink.h"
+#include "sweep.h"
+#include "trace.h"
+#include "usb.h"
+#include "vrt.h"
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
-#include <libusb.h>
+#include <limits.h>
+#include <math.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
-#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
-unsigned int queuedepth = 16; // Number of requests to queue
-unsigned int reqsize = 8;     // Request size in number of packets
-unsigned int duration = 100;  // Duration of the test in seconds
+static int randomizer;
+static int dither;
+static int has_firmware;
+static int refclock_10M;
 
-const char *firmware = NULL;
+static rx888_t *dev = NULL;
 
-static unsigned int ep = 1 | LIBUSB_ENDPOINT_IN;
+#define MAX_SINKS 5 // not counting stripe targets
 
-static int interface_number = 0;
-static struct libusb_device_handle *dev_handle = NULL;
-unsigned int pktsize;
-unsigned int success_count = 0;  // Number of successful transfers
-unsigned int failure_count = 0;  // Number of failed transfers
-unsigned int transfer_size = 0;  // Size of data transfers performed so far
-unsigned int transfer_index = 0; // Write index into the transfer_size array
-volatile bool stop_transfers = false; // Request to stop data transfers
-volatile int xfers_in_progress = 0;
+static const char *output_path = NULL; // raw samples, "-" for stdout
+static unsigned int writeback_mb = 0;  // > 0: raw file writeback window in MiB
+static unsigned int elastic_mb = 0;    // > 0: elastic buffer in front of the raw output
+static const char *spill_dir = "/var/tmp";
+static struct elastic *elastic;
+static const char *degrade_path = NULL; // rate change log, NULL: raw output always at full rate
+static const char *checksum_path = NULL; // raw output CRC32C sidecar, NULL: no checksums
+static const char *tags_path = NULL; // configuration change log, NULL: none
 
-volatile int sleep_time = 0;
+#define RTLTCP_RATE 2048000             // initial rtl_tcp output rate
+#define RTLTCP_QUEUE (8 * 1024 * 1024)  // per-client send queue in bytes
 
-int verbose;
-static int randomizer;
-static int dither;
-static int has_firmware;
-static int refclock_10M;
+static const char *rtltcp_addr = "127.0.0.1";
+static unsigned int rtltcp_port = 0; // 0: rtl_tcp server disabled
 
-static void transfer_callback(struct libusb_transfer *transfer) {
-    int size = 0;
-    int ret = 0;
+static const char *daemon_path = NULL; // Unix socket, NULL: not a daemon
 
-    xfers_in_progress--;
+static const char *vrt_host = NULL; // VITA-49 destination, NULL: disabled
+static unsigned int vrt_port = 4991;
+static struct vrt_config vrt_cfg = {.stream_id = 1};
 
-    if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
-        failure_count++;
-        fprintf(stderr, "Transfer callback status %s received %d \
-	   bytes.\n",
-                libusb_error_name(transfer->status), transfer->actual_length);
-    } else {
-        size = transfer->actual_length;
-        success_count++;
-        uint16_t *samples = (uint16_t *)transfer->buffer;
-        if (randomizer) {
-            for (int i = 0; i < size / 2; i++) {
-                samples[i] ^= 0xfffe * (samples[i] & 1);
-            }
+static const char *vhf_spec = NULL; // R82XX tuner frequencies, NULL: HF input
+static unsigned int dwell_ms = 10;
+static const char *sweep_path = NULL; // dwell tags, with more than one frequency
+
+/*
+ * VHF sweep: with several --vhf frequencies the raw output gets only the
+ * settled samples of each dwell, and a tag file says where each dwell
+ * starts in it, see sweep.h.
+ */
+static struct {
+    uint64_t *freqs;
+    unsigned int count;
+    struct sweep *sweep;
+    FILE *tags;
+    uint64_t written; // raw output bytes
+} vhf;
+
+// dB of the gain settings: the cached measured table, or the nominal curves without one
+static struct gaincal gaincal;
+static const char *gain_table_path = NULL; // NULL: gaincal_default_path()
+static bool calibrate = false;             // measure the table, write it and exit
+
+static const char *journal_path = NULL; // per-transfer journal, see journal.h
+
+static double synthetic_seconds = 0; // > 0: run the synthetic source this long, no device
+static unsigned int synthetic_pktsize = 0;
+static const char *sim_spec = NULL; // simulated FX3 options, NULL: real device
+
+#define TRACE_EVENTS 65536 // events kept per thread, several seconds of blocks
+static const char *trace_path = NULL; // Chrome trace output, NULL: no tracing
+static volatile sig_atomic_t trace_dump;
+
+// Options without a short form
+enum {
+    OPT_VRT_GSO = 256,
+    OPT_VRT_PAYLOAD,
+    OPT_SYNTHETIC,
+    OPT_PKTSIZE,
+    OPT_SIM,
+    OPT_TRACE,
+    OPT_WRITEBACK,
+    OPT_STRIPE,
+    OPT_STRIPE_MANIFEST,
+    OPT_ELASTIC,
+    OPT_SPILL_DIR,
+    OPT_DEGRADE,
+    OPT_CHECKSUM,
+    OPT_VHF,
+    OPT_DWELL,
+    OPT_TAGS,
+    OPT_CALIBRATE,
+    OPT_GAIN_TABLE,
+    OPT_JOURNAL,
+};
+
+#define WRITE_IOV 64 // blocks per writev() call, well under IOV_MAX
+
+// File written from a sink thread: the raw output or one stripe target
+struct file_out {
+    const char *name;
+    int fd;
+    atomic_uint_fast64_t syscalls;
+    atomic_uint_fast64_t bytes;
+
+    // Writeback windows on a regular file, see writeback()
+    off_t window; // 0: leave it to the kernel
+    off_t base;   // file offset the capture started at
+    off_t offset;
+    off_t flushed; // windows before this have had writeback started
+    atomic_uint_fast64_t windows;
+    atomic_uint_fast64_t max_wait_ns;
+
+    FILE *crc; // CRC32C sidecar, see checksum_open()
+    size_t crc_block;
+};
+
+static struct file_out raw = {.name = "raw", .fd = -1};
+
+/*
+ * Graceful degradation of the raw output: a consumer that stays behind
+ * gets the stream low-passed and decimated by 2, then by 4, instead of
+ * losing blocks, and full rate back once it keeps up again. Every change
+ * goes to the rate log with the output byte offset it starts at.
+ */
+#define DEGRADE_LEVELS 2              // 1/2 and 1/4 rate
+#define DEGRADE_WINDOW_NS 500000000ULL
+#define DEGRADE_BUSY 0.95             // writing this much of a window: halve the rate
+#define DEGRADE_IDLE 0.35             // writing less than this ...
+#define DEGRADE_IDLE_WINDOWS 10       // ... for this many windows: double it back
+static struct {
+    FILE *log;
+    sink_batch_fn write;      // block writer for full rate
+    unsigned int level;       // output decimated by 1 << level
+    bool started;
+    struct decimator *dec[DEGRADE_LEVELS + 1];
+    int16_t *buf;
+    uint64_t window_start;
+    uint64_t write_ns;        // spent in writes this window
+    unsigned int idle_windows;
+    uint64_t last_ns;
+    atomic_uint current;
+    atomic_uint_fast64_t changes;
+    atomic_uint_fast64_t degraded_ns;
+} degrade;
+
+/*
+ * Striped capture: block n goes to target n % count, each target on its
+ * own thread, so the disks add up. The manifest records what it takes to
+ * interleave the targets back exactly; see rx888_unstripe.c.
+ */
+#define MAX_STRIPES 8
+static struct {
+    unsigned int count;
+    const char *paths[MAX_STRIPES];
+    const char *manifest_path;
+    struct file_out out[MAX_STRIPES];
+    char names[MAX_STRIPES][16];
+    struct sink *sinks[MAX_STRIPES];
+    FILE *manifest;
+    uint64_t blocks; // blocks dealt out so far, including dropped ones
+} stripe = {.manifest_path = "capture.stripe"};
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Keep a long capture from filling the page cache with dirty pages that
+ * the kernel then flushes in one stall. Every full window gets its
+ * writeback started right away; the window before it has had a window's
+ * worth of time to reach the disk, so waiting for it is normally free,
+ * and its pages are dropped from the cache. At most two windows are
+ * dirty or cached at any time.
+ */
+static void writeback(struct file_out *out) {
+    while (out->offset - out->flushed >= out->window) {
+        off_t start = out->flushed;
+
+        sync_file_range(out->fd, start, out->window, SYNC_FILE_RANGE_WRITE);
+        if (start - out->window >= out->base) {
+            uint64_t t0 = mono_ns();
+            sync_file_range(out->fd, start - out->window, out->window,
+                            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                            SYNC_FILE_RANGE_WAIT_AFTER);
+            posix_fadvise(out->fd, start - out->window, out->window, POSIX_FADV_DONTNEED);
+            uint64_t wait = mono_ns() - t0;
+            if (wait > atomic_load(&out->max_wait_ns))
+                atomic_store(&out->max_wait_ns, wait);
         }
-        ret = write(STDOUT_FILENO, transfer->buffer, transfer->actual_length);
+        out->flushed += out->window;
+        atomic_fetch_add(&out->windows, 1);
+    }
+}
+
+// Turn on windowed writeback if the output is a regular file
+static void writeback_open(struct file_out *out) {
+    struct stat st;
+
+    if (writeback_mb == 0)
+        return;
+    if (fstat(out->fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        fprintf(stderr, "Output %s is not a regular file, --writeback ignored\n", out->name);
+        return;
+    }
+    out->base = lseek(out->fd, 0, SEEK_CUR);
+    if (out->base < 0)
+        out->base = 0;
+    out->offset = out->flushed = out->base;
+    out->window = (off_t)writeback_mb << 20;
+}
+
+// Flush the tail and drop the whole capture from the page cache
+static void writeback_close(struct file_out *out) {
+    if (out->window == 0)
+        return;
+    fdatasync(out->fd);
+    posix_fadvise(out->fd, out->base, 0, POSIX_FADV_DONTNEED);
+}
+
+/*
+ * CRC32C sidecar: a header naming the file, then one line per write
+ * unit (a transfer block, an elastic buffer chunk or a decimated batch)
+ * in file order, the CRC in hex followed by the length when it is not
+ * block_size, and a closing line with the total. rx888_verify checks it.
+ */
+static int checksum_open(struct file_out *out, const char *path, const char *file) {
+    char abs[PATH_MAX];
+
+    out->crc = fopen(path, "w");
+    if (out->crc == NULL) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    out->crc_block = rx888_block_size(dev);
+    // A pipe has no path: the verifier is then told where the data went
+    fprintf(out->crc, "rx888-crc32c 1\nfile %s\nblock_size %zu\n",
+            realpath(file, abs) ? abs : "-", out->crc_block);
+    return 0;
+}
+
+static void checksum_close(struct file_out *out) {
+    if (out->crc == NULL)
+        return;
+    fprintf(out->crc, "end %llu\n", (unsigned long long)atomic_load(&out->bytes));
+    fclose(out->crc);
+    out->crc = NULL;
+}
+
+static void checksum_line(struct file_out *out, uint32_t crc, size_t len) {
+    if (len == out->crc_block)
+        fprintf(out->crc, "%08x\n", crc);
+    else
+        fprintf(out->crc, "%08x %zu\n", crc, len);
+}
+
+// Checksum data that is not a whole transfer block, once it is written
+static void checksum_data(struct file_out *out, const void *data, size_t len) {
+    checksum_line(out, kernel_crc32c(0, data, len), len);
+}
+
+// Write all of iov, however many calls it takes
+static int writev_all(struct file_out *out, struct iovec *v, unsigned int cnt) {
+    while (cnt > 0) {
+        ssize_t ret = writev(out->fd, v, cnt);
+        atomic_fetch_add(&out->syscalls, 1);
         if (ret < 0) {
-            fprintf(stderr, "Error writing to stdout: %s", strerror(errno));
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Error writing %s output: %s\n", out->name, strerror(errno));
+            return -1;
+        }
+        atomic_fetch_add(&out->bytes, ret);
+        out->offset += ret;
+        // Short write: drop what went out and go again with the rest
+        while (cnt > 0 && (size_t)ret >= v->iov_len) {
+            ret -= v->iov_len;
+            v++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            v->iov_base = (char *)v->iov_base + ret;
+            v->iov_len -= ret;
         }
     }
-    if (!stop_transfers) {
-        if (libusb_submit_transfer(transfer) == 0)
-            xfers_in_progress++;
+    return 0;
+}
+
+static int file_writev(struct file_out *out, struct iovec *v, unsigned int cnt) {
+    if (writev_all(out, v, cnt) != 0)
+        return -1;
+    if (out->window)
+        writeback(out);
+    return 0;
+}
+
+// What a block writer does besides writev(), fixed per output by file_writer()
+enum {
+    WRITE_CRC = 1,       // sidecar line per block, out->crc
+    WRITE_WRITEBACK = 2, // windowed writeback, out->window
+};
+
+/*
+ * Write every block the output has queued with one writev(). The batch
+ * is whatever accumulated while the previous one was written, so a slow
+ * disk or pipe gets fewer, larger writes. ops is a constant in each
+ * instantiation below, so a batch tests no options.
+ */
+static inline __attribute__((always_inline))
+int write_blocks(struct file_out *out, struct rx888_block **blocks, unsigned int n,
+                 const unsigned int ops) {
+    struct iovec iov[WRITE_IOV];
+
+    for (unsigned int done = 0; done < n;) {
+        unsigned int cnt = 0;
+        for (; cnt < WRITE_IOV && done + cnt < n; cnt++) {
+            iov[cnt].iov_base = blocks[done + cnt]->data;
+            iov[cnt].iov_len = blocks[done + cnt]->length;
+        }
+        if (writev_all(out, iov, cnt) != 0)
+            return -1;
+        // Blocks come with their CRC from the library's per-block pass
+        if (ops & WRITE_CRC) {
+            for (unsigned int i = 0; i < cnt; i++)
+                checksum_line(out, blocks[done + i]->crc32c, blocks[done + i]->length);
+        }
+        done += cnt;
     }
+    if (ops & WRITE_WRITEBACK)
+        writeback(out);
+    return 0;
 }
 
-// Function to free data buffers and transfer structures
-static void free_transfer_buffers(unsigned char **databuffers,
-                                  struct libusb_transfer **transfers) {
-    // Free up any allocated data buffers
-    if (databuffers != NULL) {
-        for (unsigned int i = 0; i < queuedepth; i++) {
-            if (databuffers[i] != NULL) {
-                free(databuffers[i]);
-            }
-            databuffers[i] = NULL;
+#define WRITE_BATCH(ops)                                                            \
+    static int write_batch_##ops(struct rx888_block **blocks, unsigned int n, void *ctx) { \
+        return write_blocks(ctx, blocks, n, ops);                                   \
+    }
+WRITE_BATCH(0)
+WRITE_BATCH(1)
+WRITE_BATCH(2)
+WRITE_BATCH(3)
+#undef WRITE_BATCH
+
+// Block writer for an output, once its checksum and writeback are set up
+static sink_batch_fn file_writer(const struct file_out *out) {
+    static const sink_batch_fn table[4] = {
+        write_batch_0, write_batch_1, write_batch_2, write_batch_3,
+    };
+    return table[(out->crc ? WRITE_CRC : 0) | (out->window ? WRITE_WRITEBACK : 0)];
+}
+
+static int degrade_open(unsigned int depth) {
+    size_t max_in = rx888_block_size(dev) / sizeof(int16_t);
+
+    for (unsigned int i = 1; i <= DEGRADE_LEVELS; i++) {
+        degrade.dec[i] = decimator_create(1u << i, max_in);
+        if (degrade.dec[i] == NULL)
+            return -1;
+    }
+    degrade.buf = malloc(depth * (max_in / 2 + 1) * sizeof(int16_t));
+    if (degrade.buf == NULL)
+        return -1;
+    degrade.log = fopen(degrade_path, "w");
+    if (degrade.log == NULL) {
+        fprintf(stderr, "Cannot open %s: %s\n", degrade_path, strerror(errno));
+        return -1;
+    }
+    fprintf(degrade.log, "# output_byte input_sample decimation samplerate\n");
+    return 0;
+}
+
+static void degrade_close(void) {
+    for (unsigned int i = 1; i <= DEGRADE_LEVELS; i++)
+        decimator_free(degrade.dec[i]);
+    free(degrade.buf);
+    if (degrade.log)
+        fclose(degrade.log);
+}
+
+/*
+ * Output level for the next batch. The load is the share of each window
+ * the output spent blocked in writes: a consumer that cannot take the
+ * rate keeps it near 100%, while batch sizes swing with a bursty reader
+ * whatever its average. Doubling the rate doubles the load, so the rate
+ * only goes back up when twice the load would still leave headroom, and
+ * only after several such windows, so a consumer at the edge does not
+ * flap between rates.
+ */
+static unsigned int degrade_level(uint64_t now) {
+    unsigned int level = degrade.level;
+
+    if (degrade.window_start == 0)
+        degrade.window_start = now;
+    if (now - degrade.window_start < DEGRADE_WINDOW_NS)
+        return level;
+
+    double load = (double)degrade.write_ns / (now - degrade.window_start);
+    degrade.window_start = now;
+    degrade.write_ns = 0;
+    if (load >= DEGRADE_BUSY) {
+        degrade.idle_windows = 0;
+        if (level < DEGRADE_LEVELS)
+            level++;
+    } else if (load < DEGRADE_IDLE && level > 0) {
+        if (++degrade.idle_windows >= DEGRADE_IDLE_WINDOWS) {
+            degrade.idle_windows = 0;
+            level--;
         }
-        free(databuffers);
+    } else {
+        degrade.idle_windows = 0;
     }
+    return level;
+}
 
-    // Free up any allocated transfer structures
-    if (transfers != NULL) {
-        for (unsigned int i = 0; i < queuedepth; i++) {
-            if (transfers[i] != NULL) {
-                libusb_free_transfer(transfers[i]);
-            }
-            transfers[i] = NULL;
+// Raw output with --degrade: the block writer at full rate, decimated otherwise
+static int degrade_batch(struct rx888_block **blocks, unsigned int n, void *ctx) {
+    struct file_out *out = ctx;
+    uint64_t now = mono_ns();
+    unsigned int level = degrade_level(now);
+
+    if (degrade.level > 0 && degrade.last_ns)
+        atomic_fetch_add(&degrade.degraded_ns, now - degrade.last_ns);
+    degrade.last_ns = now;
+
+    if (level != degrade.level || !degrade.started) {
+        unsigned int rate = rx888_samplerate(dev) >> level;
+        fprintf(degrade.log, "%llu %llu %u %u\n", (unsigned long long)atomic_load(&out->bytes),
+                (unsigned long long)blocks[0]->sample_index, 1u << level, rate);
+        fflush(degrade.log);
+        if (degrade.started) {
+            fprintf(stderr, "Raw output %s, now at 1/%u rate (%.3f MS/s)\n",
+                    level > degrade.level ? "falling behind" : "keeping up",
+                    1u << level, rate / 1e6);
+            atomic_fetch_add(&degrade.changes, 1);
         }
-        free(transfers);
+        if (level > 0)
+            decimator_reset(degrade.dec[level]);
+        degrade.level = level;
+        degrade.started = true;
+        atomic_store(&degrade.current, level);
+    }
+    if (level == 0) {
+        int ret = degrade.write(blocks, n, ctx);
+        degrade.write_ns += mono_ns() - now;
+        return ret;
     }
+
+    size_t len = 0;
+    for (unsigned int i = 0; i < n; i++)
+        len += decimator_process(degrade.dec[level], (const int16_t *)blocks[i]->data,
+                                 blocks[i]->length / sizeof(int16_t), degrade.buf + len);
+    // Only the write counts towards the load: full rate has no filtering to do
+    struct iovec iov = {.iov_base = degrade.buf, .iov_len = len * sizeof(int16_t)};
+    uint64_t start = mono_ns();
+    int ret = file_writev(out, &iov, 1);
+    degrade.write_ns += mono_ns() - start;
+    if (ret == 0 && out->crc)
+        checksum_data(out, degrade.buf, len * sizeof(int16_t));
+    return ret;
+}
+
+/*
+ * Elastic raw output: the sink only copies blocks into the elastic
+ * buffer, so the transfers go straight back to the device however long
+ * the consumer pauses; the drain thread does the writing.
+ */
+static int elastic_batch(struct rx888_block **blocks, unsigned int n, void *ctx) {
+    (void)ctx;
+    for (unsigned int i = 0; i < n; i++) {
+        if (elastic_write(elastic, blocks[i]->data, blocks[i]->length) != 0)
+            return -1;
+    }
+    return 0;
 }
 
+static int elastic_drain(const void *data, size_t len, void *ctx) {
+    struct file_out *out = ctx;
+    struct iovec iov = {.iov_base = (void *)data, .iov_len = len};
+    if (file_writev(out, &iov, 1) != 0)
+        return -1;
+    if (out->crc)
+        checksum_data(out, data, len);
+    return 0;
+}
+
+static void print_file_stats(struct file_out *out) {
+    uint64_t calls = atomic_load(&out->syscalls);
+    if (calls)
+        fprintf(stderr, "Output %s: %llu writev calls, %.1f KiB per call\n", out->name,
+                (unsigned long long)calls, atomic_load(&out->bytes) / 1024.0 / calls);
+    if (out->window)
+        fprintf(stderr, "Output %s writeback: %llu windows of %u MiB, longest wait %.1f ms\n",
+                out->name, (unsigned long long)atomic_load(&out->windows), writeback_mb,
+                atomic_load(&out->max_wait_ns) / 1e6);
+}
+
+static void print_file_outputs(void) {
+    print_file_stats(&raw);
+    if (elastic) {
+        struct elastic_stats es;
+        elastic_get_stats(elastic, &es);
+        fprintf(stderr, "Elastic buffer: %.1f MiB in memory (high %.1f MiB of %u), "
+                "%.1f MiB spilled (high %.1f MiB, %.1f MiB total)\n",
+                es.mem_bytes / 1048576.0, es.mem_high / 1048576.0, elastic_mb,
+                es.spill_bytes / 1048576.0, es.spill_high / 1048576.0,
+                es.spilled / 1048576.0);
+    }
+    if (degrade.log)
+        fprintf(stderr, "Output raw degradation: %llu rate changes, %.1f s below full rate, "
+                "now at 1/%u\n", (unsigned long long)atomic_load(&degrade.changes),
+                atomic_load(&degrade.degraded_ns) / 1e9, 1u << atomic_load(&degrade.current));
+    for (unsigned int i = 0; i < stripe.count; i++)
+        print_file_stats(&stripe.out[i]);
+    if (vhf.sweep) {
+        struct sweep_stats ss;
+        sweep_get_stats(vhf.sweep, &ss);
+        fprintf(stderr, "VHF sweep: %llu retunes, %llu dwells kept, settle %.1f us, retune "
+                "command %.1f us average, %.1f us max, %llu late\n",
+                (unsigned long long)ss.retunes, (unsigned long long)ss.dwells,
+                ss.settle * 1e6 / rx888_samplerate(dev),
+                ss.retunes ? ss.tune_ns_sum / 1e3 / ss.retunes : 0.0, ss.tune_ns_max / 1e3,
+                (unsigned long long)ss.late);
+    }
+}
+
+// Stripe target path: a directory gets a numbered file, anything else is used as is
+static int stripe_open(unsigned int i, char *path, size_t len) {
+    struct stat st;
+
+    if (stat(stripe.paths[i], &st) == 0 && S_ISDIR(st.st_mode))
+        snprintf(path, len, "%s/rx888.stripe%u", stripe.paths[i], i);
+    else
+        snprintf(path, len, "%s", stripe.paths[i]);
+    return open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+}
+
+/*
+ * Open the targets, start a writer for each and write the manifest
+ * header. Appends the writers to sinks.
+ */
+static int stripe_start(struct sink **sinks, unsigned int *nsinks, unsigned int depth) {
+    for (unsigned int i = 0; i < stripe.count; i++)
+        stripe.out[i].fd = -1;
+    stripe.manifest = fopen(stripe.manifest_path, "w");
+    if (stripe.manifest == NULL) {
+        fprintf(stderr, "Cannot open %s: %s\n", stripe.manifest_path, strerror(errno));
+        return -1;
+    }
+    fprintf(stripe.manifest, "rx888-stripe 1\nsamplerate %u\nblock_size %zu\ntargets %u\n",
+            rx888_samplerate(dev), rx888_block_size(dev), stripe.count);
+
+    for (unsigned int i = 0; i < stripe.count; i++) {
+        char path[4096];
+        struct file_out *out = &stripe.out[i];
+
+        snprintf(stripe.names[i], sizeof(stripe.names[i]), "stripe%u", i);
+        out->name = stripe.names[i];
+        out->fd = stripe_open(i, path, sizeof(path));
+        if (out->fd < 0) {
+            fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+        writeback_open(out);
+        if (checksum_path) {
+            // Next to the manifest: a target may be a raw device
+            char crc_path[4096];
+            snprintf(crc_path, sizeof(crc_path), "%s.%u.crc", stripe.manifest_path, i);
+            if (checksum_open(out, crc_path, path) != 0)
+                return -1;
+        }
+        // Absolute, so the manifest works from any directory
+        char abs[PATH_MAX];
+        fprintf(stripe.manifest, "target %u %s\n", i, realpath(path, abs) ? abs : path);
+        stripe.sinks[i] = sink_start_batch(dev, out->name, file_writer(out), out, depth);
+        if (stripe.sinks[i] == NULL)
+            return -1;
+        sinks[(*nsinks)++] = stripe.sinks[i];
+    }
+    fflush(stripe.manifest);
+    return 0;
+}
+
+/*
+ * Deal a block to its target. Blocks are dealt whole, so the targets stay
+ * raw sample files; a short or dropped block is noted in the manifest,
+ * which is all reassembly needs to find the block boundaries.
+ */
+static void stripe_push(struct rx888_block *block) {
+    uint64_t n = stripe.blocks++;
+
+    if (sink_push(stripe.sinks[n % stripe.count], block) != 0)
+        fprintf(stripe.manifest, "drop %llu\n", (unsigned long long)n);
+    else if (block->length != rx888_block_size(dev))
+        fprintf(stripe.manifest, "short %llu %zu\n", (unsigned long long)n, block->length);
+}
+
+// Call after the writers have stopped
+static void stripe_close(void) {
+    for (unsigned int i = 0; i < stripe.count; i++) {
+        if (stripe.out[i].fd < 0)
+            continue;
+        writeback_close(&stripe.out[i]);
+        checksum_close(&stripe.out[i]);
+        close(stripe.out[i].fd);
+    }
+    if (stripe.manifest) {
+        fprintf(stripe.manifest, "blocks %llu\n", (unsigned long long)stripe.blocks);
+        fclose(stripe.manifest);
+    }
+}
+
+static int vhf_open(void) {
+    vhf.tags = fopen(sweep_path, "w");
+    if (vhf.tags == NULL) {
+        fprintf(stderr, "Cannot open %s: %s\n", sweep_path, strerror(errno));
+        return -1;
+    }
+    struct sweep_config sc = {
+        .freqs = vhf.freqs,
+        .count = vhf.count,
+        .dwell = (uint64_t)rx888_samplerate(dev) * dwell_ms / 1000,
+        .calibrate = 1,
+    };
+    fprintf(vhf.tags, "rx888-sweep 1\nsamplerate %u\ndwell %llu\n", rx888_samplerate(dev),
+            (unsigned long long)sc.dwell);
+    vhf.sweep = sweep_start(dev, &sc);
+    return vhf.sweep ? 0 : -1;
+}
+
+// Raw output while sweeping: the settled part of each dwell, tagged as it starts
+static int vhf_block(struct rx888_block *block, void *ctx) {
+    struct file_out *out = ctx;
+    struct sweep_span spans[SWEEP_SPANS];
+    struct iovec iov[SWEEP_SPANS];
+    unsigned int n = sweep_block(vhf.sweep, block, spans, SWEEP_SPANS);
+
+    for (unsigned int i = 0; i < n; i++) {
+        if (spans[i].first)
+            fprintf(vhf.tags, "%llu %llu %llu\n", (unsigned long long)spans[i].freq,
+                    (unsigned long long)spans[i].sample_index,
+                    (unsigned long long)vhf.written);
+        iov[i].iov_base = block->data + spans[i].offset * sizeof(int16_t);
+        iov[i].iov_len = spans[i].count * sizeof(int16_t);
+        vhf.written += iov[i].iov_len;
+    }
+    if (n > 0)
+        return file_writev(out, iov, n);
+    return 0;
+}
+
+// Call after the writer has stopped
+static void vhf_close(void) {
+    if (vhf.tags) {
+        struct sweep_stats ss = {0};
+        if (vhf.sweep)
+            sweep_get_stats(vhf.sweep, &ss);
+        fprintf(vhf.tags, "settle %llu\nend %llu\n", (unsigned long long)ss.settle,
+                (unsigned long long)vhf.written);
+        fclose(vhf.tags);
+        vhf.tags = NULL;
+    }
+    sweep_stop(vhf.sweep);
+    vhf.sweep = NULL;
+    free(vhf.freqs);
+}
+
+/*
+ * Only async-signal-safe calls here: the signal can land inside a stdio
+ * call on stderr, and with SIGPIPE a closed stderr raises it again on
+ * every write, so the message goes out once.
+ */
 static void sig_stop(int signum) {
+    static volatile sig_atomic_t stopping;
+    static const char msg[] = "\nAbort. Stopping transfers\n";
 
     (void)signum;
-    fprintf(stderr, "\nAbort. Stopping transfers\n");
-    stop_transfers = true;
+    if (!stopping) {
+        stopping = 1;
+        if (write(STDERR_FILENO, msg, sizeof(msg) - 1) < 0) {
+            // Nowhere left to report it
+        }
+    }
+    if (dev)
+        rx888_stop(dev);
+}
+
+// SIGUSR1: write the trace so far without stopping
+static void sig_trace(int signum) {
+    (void)signum;
+    trace_dump = 1;
 }
+
+// Where a change tag takes effect in the stream: the measured step, else the acknowledgement
+static uint64_t tag_index(const struct rx888_tag *tag) {
+    return tag->effect != RX888_TAG_NO_STEP ? tag->effect : tag->acked;
+}
+
+// Apply a change tag to the settings it describes; false if it does not describe one
+static bool tag_apply(const struct rx888_tag *tag, unsigned int *gain, unsigned int *att,
+                      unsigned int *samplerate) {
+    if (tag->status != RX888_OK)
+        return false;
+    if (tag->request == SETARGFX3 && tag->argument == AD8340_VGA)
+        *gain = tag->value;
+    else if (tag->request == SETARGFX3 && tag->argument == DAT31_ATT)
+        *att = tag->value;
+    else if (tag->request == STARTADC)
+        *samplerate = tag->value;
+    else
+        return false;
+    return true;
+}
+
+struct vrt_state {
+    struct vrt_sink *sink;
+    unsigned int gain; // settings as of the context sent last
+    unsigned int att;
+    unsigned int samplerate;
+    uint64_t next_context; // sample index of the next periodic context packet
+    uint64_t next_tag;
+    uint64_t failures;
+};
+
+static void vrt_context(struct vrt_state *st, uint64_t sample_index) {
+    struct rx888_stats stats;
+    struct vrt_context vc = {
+        .samplerate = st->samplerate,
+        .gain_db = gaincal_db(&gaincal, st->gain, st->att),
+        // No lock readback from the firmware: the lock indicator stays disabled
+        .ref_known = false,
+    };
+    rx888_get_stats(dev, &stats);
+    vc.sample_loss = stats.failure_count != st->failures;
+    st->failures = stats.failure_count;
+    vrt_send_context(st->sink, &vc, sample_index);
+}
+
+/*
+ * Send a block as VRT data packets, with a context packet once a second
+ * and one for every gain or sample rate change, timestamped where it took
+ * effect. A change is only known once its step has been measured, so its
+ * context packet trails the data packets around it.
+ */
+static int vrt_block(struct rx888_block *block, void *ctx) {
+    struct vrt_state *st = ctx;
+    struct rx888_tag tags[16];
+    unsigned int n;
+
+    while (st->next_tag < block->tags &&
+           (n = rx888_get_tags(dev, st->next_tag, tags, 16)) > 0) {
+        for (unsigned int i = 0; i < n; i++) {
+            if (tag_apply(&tags[i], &st->gain, &st->att, &st->samplerate))
+                vrt_context(st, tag_index(&tags[i]));
+        }
+        st->next_tag = tags[n - 1].id + 1;
+    }
+    if (block->sample_index >= st->next_context) {
+        vrt_context(st, block->sample_index);
+        st->next_context = block->sample_index + st->samplerate;
+    }
+    vrt_send(st->sink, (const int16_t *)block->data, block->length / sizeof(int16_t),
+             block->sample_index);
+    return 0;
+}
+
+// Name of the setting a tag changes, for the tag log
+static const char *tag_name(const struct rx888_tag *tag) {
+    if (tag->request == SETARGFX3) {
+        switch (tag->argument) {
+        case R82XX_ATTENUATOR: return "r82xx_att";
+        case R82XX_VGA: return "r82xx_vga";
+        case R82XX_SIDEBAND: return "r82xx_sideband";
+        case R82XX_HARMONIC: return "r82xx_harmonic";
+        case DAT31_ATT: return "att";
+        case AD8340_VGA: return "gain";
+        case PRESELECTOR: return "preselector";
+        case VHF_ATTENUATOR: return "vhf_att";
+        }
+        return "argument";
+    }
+    switch (tag->request) {
+    case STARTADC: return "samplerate";
+    case GPIOFX3: return "gpio";
+    case TUNERTUNE: return "tune";
+    case TUNERINIT: return "tuner_init";
+    case TUNERSTDBY: return "tuner_standby";
+    }
+    return "command";
+}
+
+static struct {
+    FILE *file;
+    uint64_t next;
+} tag_log;
+
+static int tag_log_open(void) {
+    tag_log.file = fopen(tags_path, "w");
+    if (tag_log.file == NULL) {
+        fprintf(stderr, "Cannot open %s: %s\n", tags_path, strerror(errno));
+        return -1;
+    }
+    fprintf(tag_log.file, "# issued acked effect step_db setting value status\n");
+    fflush(tag_log.file);
+    return 0;
+}
+
+// Log the configuration changes complete by this block
+static int tag_log_block(struct rx888_block *block, void *ctx) {
+    struct rx888_tag tags[16];
+    unsigned int n;
+
+    (void)ctx;
+    while (tag_log.next < block->tags &&
+           (n = rx888_get_tags(dev, tag_log.next, tags, 16)) > 0) {
+        for (unsigned int i = 0; i < n; i++) {
+            const struct rx888_tag *t = &tags[i];
+            fprintf(tag_log.file, "%llu %llu ", (unsigned long long)t->issued,
+                    (unsigned long long)t->acked);
+            if (t->effect != RX888_TAG_NO_STEP)
+                fprintf(tag_log.file, "%llu %.2f", (unsigned long long)t->effect, t->step_db);
+            else
+                fprintf(tag_log.file, "- -");
+            fprintf(tag_log.file, " %s %llu %s\n", tag_name(t), (unsigned long long)t->value,
+                    t->status == RX888_OK ? "ok" : "failed");
+        }
+        tag_log.next = tags[n - 1].id + 1;
+        fflush(tag_log.file);
+    }
+    return 0;
+}
+
+/*
+ * Largest power of two decimation that keeps the ADC at or below max_adc
+ * while delivering rate complex samples per second, 0 if none does.
+ */
+static unsigned int rtltcp_decimation(unsigned int rate, unsigned int max_adc) {
+    unsigned int decim = 0;
+
+    for (uint64_t d = 2; (uint64_t)rate * d <= max_adc; d *= 2)
+        decim = d;
+    return decim;
+}
+
+/*
+ * rtl_tcp gain in tenths of dB above the lowest of the gain mode to the
+ * AD8340 VGA value closest to it in the gain table, keeping the mode
+ */
+static unsigned int rtltcp_vga_code(unsigned int gain, int tenth_db) {
+    unsigned int mode = gain & 0x80;
+    double low = gaincal.vga[mode];
+
+    for (unsigned int v = mode + 1; v < mode + 0x80; v++)
+        low = fmin(low, gaincal.vga[v]);
+    return gaincal_vga(&gaincal, mode, low + tenth_db / 10.0);
+}
+
+struct rtltcp_state {
+    struct rtl_tcp_server *srv;
+    struct ddc *ddc;
+    unsigned int max_adc;  // -s, the ceiling for the ADC rate
+    unsigned int adc_rate;
+    bool shared;           // other outputs use the ADC rate: clients cannot change it
+    unsigned int gain;
+    double freq;
+    size_t max_in;
+    float *iq;
+    uint8_t *u8;
+};
+
+static void rtltcp_command(struct rtltcp_state *st, const struct rtl_tcp_command *cmd) {
+    switch (cmd->cmd) {
+    case RTL_TCP_SET_FREQ:
+        st->freq = cmd->param;
+        ddc_set_freq(st->ddc, fmod(st->freq, st->adc_rate));
+        if (verbose)
+            fprintf(stderr, "rtl_tcp: frequency %u Hz\n", cmd->param);
+        break;
+
+    case RTL_TCP_SET_SAMPLE_RATE: {
+        // Shared, only rates the current ADC rate decimates to exactly
+        unsigned int max_adc = st->shared ? st->adc_rate : st->max_adc;
+        unsigned int decim = rtltcp_decimation(cmd->param, max_adc);
+        if (cmd->param == 0 || decim == 0 ||
+            (st->shared && (uint64_t)cmd->param * decim != st->adc_rate)) {
+            if (st->shared)
+                fprintf(stderr, "rtl_tcp: sample rate %u refused, other outputs use the "
+                        "ADC at %u\n", cmd->param, st->adc_rate);
+            else
+                fprintf(stderr, "rtl_tcp: sample rate %u not reachable with ADC at most %u\n",
+                        cmd->param, st->max_adc);
+            break;
+        }
+        struct ddc *ddc = ddc_create(cmd->param * decim, fmod(st->freq, cmd->param * decim),
+                                     decim, st->max_in);
+        if (ddc == NULL || (cmd->param * decim != st->adc_rate &&
+                            rx888_set_samplerate(dev, cmd->param * decim) != RX888_OK)) {
+            ddc_free(ddc);
+            break;
+        }
+        ddc_free(st->ddc);
+        st->ddc = ddc;
+        st->adc_rate = cmd->param * decim;
+        fprintf(stderr, "rtl_tcp: sample rate %u, ADC %u, decimation %u\n",
+                cmd->param, st->adc_rate, decim);
+        break;
+    }
+
+    case RTL_TCP_SET_GAIN:
+        st->gain = rtltcp_vga_code(st->gain, (int)cmd->param);
+        rx888_set_gain(dev, st->gain);
+        break;
+
+    case RTL_TCP_SET_TUNER_GAIN_BY_INDEX:
+        if (cmd->param < RTL_TCP_R820T_GAINS) {
+            st->gain = rtltcp_vga_code(st->gain, rtl_tcp_r820t_gains[cmd->param]);
+            rx888_set_gain(dev, st->gain);
+        }
+        break;
+
+    default:
+        // Gain mode, AGC, PPM, xtal and bias tee have no RX888 HF equivalent
+        if (verbose)
+            fprintf(stderr, "rtl_tcp: ignoring command 0x%02x (%u)\n", cmd->cmd,
+                    cmd->param);
+        break;
+    }
+}
+
+static int rtltcp_open(struct rtltcp_state *st, const struct rx888_config *cfg,
+                       unsigned int max_adc) {
+    st->max_adc = max_adc;
+    st->adc_rate = cfg->samplerate;
+    st->gain = cfg->gain;
+    st->max_in = rx888_block_size(dev) / sizeof(int16_t);
+    st->ddc = ddc_create(st->adc_rate, 0, st->adc_rate / RTLTCP_RATE, st->max_in);
+    st->iq = malloc((st->max_in / 2 + 1) * 2 * sizeof(float));
+    st->u8 = malloc((st->max_in / 2 + 1) * 2);
+    st->srv = rtl_tcp_start(rtltcp_addr, rtltcp_port, RTLTCP_QUEUE);
+    if (st->ddc == NULL || st->iq == NULL || st->u8 == NULL || st->srv == NULL)
+        return -1;
+    return 0;
+}
+
+static void rtltcp_close(struct rtltcp_state *st) {
+    rtl_tcp_stop(st->srv);
+    ddc_free(st->ddc);
+    free(st->iq);
+    free(st->u8);
+}
+
+// Serve the decimated stream to rtl_tcp clients
+static int rtltcp_block(struct rx888_block *block, void *ctx) {
+    struct rtltcp_state *st = ctx;
+    struct rtl_tcp_command cmd;
+
+    while (rtl_tcp_next_command(st->srv, &cmd))
+        rtltcp_command(st, &cmd);
+
+    // Nobody listening: nothing to compute
+    if (rtl_tcp_clients(st->srv) == 0)
+        return 0;
+
+    trace_begin("ddc", block->seq);
+    size_t n = ddc_process(st->ddc, (const int16_t *)block->data,
+                           block->length / sizeof(int16_t), st->iq);
+    // Mixing a real signal to complex halves its amplitude
+    dsp_cf32_to_cu8(st->iq, st->u8, n, 255.0f);
+    trace_end("ddc", block->seq);
+    trace_begin("send", block->seq);
+    rtl_tcp_broadcast(st->srv, st->u8, 2 * n);
+    trace_end("send", block->seq);
+    return 0;
+}
+
+// Serve products to clients attached over a Unix socket
+static int daemon_block(struct rx888_block *block, void *ctx) {
+    struct daemon *d = ctx;
+
+    if (daemon_clients(d) > 0)
+        daemon_process(d, (const int16_t *)block->data,
+                       block->length / sizeof(int16_t));
+    return 0;
+}
+
+// Clipping means too little attenuation; the peak shows the headroom left
+static void print_adc_stats(const struct rx888_stats *stats) {
+    fprintf(stderr, "ADC: %llu samples clipped, peak %u (%.1f dBFS)\n",
+            (unsigned long long)stats->clipped, stats->peak,
+            stats->peak ? 20 * log10(stats->peak / 32768.0) : -INFINITY);
+}
+
+static void print_sink_stats(struct sink **sinks, unsigned int nsinks) {
+    struct rx888_stats stats;
+
+    rx888_get_stats(dev, &stats);
+    print_adc_stats(&stats);
+    fprintf(stderr, "Transfers in flight: %u, low-water mark %u of %u\n",
+            stats.in_flight, stats.in_flight_low, stats.queuedepth);
+    for (unsigned int i = 0; i < nsinks; i++) {
+        struct sink_stats ss;
+        sink_get_stats(sinks[i], &ss);
+        fprintf(stderr, "Sink %s: %llu blocks in %llu batches (max %u), %llu dropped, "
+                "lag %u, max lag %u\n", sink_name(sinks[i]), (unsigned long long)ss.blocks,
+                (unsigned long long)ss.batches, ss.max_batch,
+                (unsigned long long)ss.dropped, ss.lag, ss.max_lag);
+    }
+    print_file_outputs();
+    fprintf(stderr, "Block hold latency p50 %.1f us, p99 %.1f us, max %.1f us\n",
+            rx888_latency_ns(dev, 0.5) / 1e3, rx888_latency_ns(dev, 0.99) / 1e3,
+            rx888_latency_ns(dev, 1.0) / 1e3);
+}
+
+static uint64_t thread_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Synthetic run summary. Each stage runs on its own thread, so the
+ * busiest one bounds the rate: at 100% CPU it could not go any faster.
+ */
+static void report_synthetic(struct sink **sinks, unsigned int nsinks,
+                             double wall, double dispatch_cpu) {
+    struct rx888_stats stats;
+    const char *bottleneck = "dispatch";
+    double busiest = dispatch_cpu;
+
+    rx888_get_stats(dev, &stats);
+    double delivered = stats.bytes / sizeof(int16_t) / wall;
+    fprintf(stderr, "Synthetic source: %.2f s, %.2f MS/s delivered of %.2f MS/s, "
+            "%llu overruns%s\n", wall, delivered / 1e6, rx888_samplerate(dev) / 1e6,
+            (unsigned long long)stats.overruns,
+            stats.overruns ? " - rate NOT sustained" : "");
+    fprintf(stderr, "Transfers in flight low-water mark: %u of %u\n",
+            stats.in_flight_low, stats.queuedepth);
+    print_adc_stats(&stats);
+    fprintf(stderr, "CPU dispatch (completion and fan-out): %5.1f%%\n",
+            100.0 * dispatch_cpu / wall);
+    for (unsigned int i = 0; i < nsinks; i++) {
+        struct sink_stats ss;
+        sink_get_stats(sinks[i], &ss);
+        double cpu = ss.cpu_ns / 1e9;
+        fprintf(stderr, "CPU sink %-31s %5.1f%%\n", sink_name(sinks[i]), 100.0 * cpu / wall);
+        if (cpu > busiest) {
+            busiest = cpu;
+            bottleneck = sink_name(sinks[i]);
+        }
+    }
+    print_file_outputs();
+    fprintf(stderr, "Block hold latency p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+            rx888_latency_ns(dev, 0.5) / 1e3, rx888_latency_ns(dev, 0.99) / 1e3,
+            rx888_latency_ns(dev, 0.999) / 1e3, rx888_latency_ns(dev, 1.0) / 1e3);
+    if (busiest > 0)
+        fprintf(stderr, "Estimated max sustainable rate: %.1f MS/s, limited by %s\n",
+                delivered * wall / busiest / 1e6, bottleneck);
+}
+
+/*
+ * Hand every completed block to the first nbroadcast sinks by reference,
+ * and to one stripe target if the rest are stripe writers; it goes back
+ * to the device when the slowest sink is done with it.
+ */
+static void run_sinks(struct sink **sinks, unsigned int nbroadcast, unsigned int nsinks) {
+    struct rx888_block *block;
+    uint64_t next_report = 0;
+    uint64_t end = synthetic_seconds * rx888_samplerate(dev);
+    int ret;
+
+    trace_thread_name("dispatch");
+    while ((ret = rx888_lease(dev, &block, 100)) != RX888_STOPPED) {
+        if (trace_dump) {
+            trace_dump = 0;
+            if (trace_export(trace_path) == 0)
+                fprintf(stderr, "Trace written to %s\n", trace_path);
+        }
+        if (ret != RX888_OK)
+            continue;
+        if (end && block->sample_index >= end)
+            rx888_stop(dev);
+        trace_begin("dispatch", block->seq);
+        for (unsigned int i = 0; i < nbroadcast; i++)
+            sink_push(sinks[i], block);
+        if (nsinks > nbroadcast)
+            stripe_push(block);
+        trace_end("dispatch", block->seq);
+        if (verbose && block->sample_index >= next_report) {
+            print_sink_stats(sinks, nsinks);
+            next_report = block->sample_index + 10ULL * rx888_samplerate(dev);
+        }
+        rx888_release(dev, block);
+    }
+}
+
 static void printhelp(void) {
     fprintf(stderr, " --verbose, -v      Verbose output\n");
     fprintf(stderr, " --firmware, -f     Firmware file\n");
@@ -141,6 +1152,49 @@ static void printhelp(void) {
     fprintf(stderr,
             " --reqsize, -p      Packets per transfer request, default 8\n");
     fprintf(stderr, " --refclock-10M, -T  use 10 MHz refclock (27 MHz default)\n");
+    fprintf(stderr, " --output, -o       Write raw samples to this file, - for stdout (default\n");
+    fprintf(stderr, "                    when no other output is selected)\n");
+    fprintf(stderr, " --writeback[=MiB]  Raw output to a regular file: write back and drop from\n");
+    fprintf(stderr, "                    the page cache every MiB (default 8) as the capture grows\n");
+    fprintf(stderr, " --elastic[=MiB]    Buffer the raw output for a consumer that pauses: up to\n");
+    fprintf(stderr, "                    MiB in memory (default 256), then in a scratch file\n");
+    fprintf(stderr, " --spill-dir DIR    Directory for the elastic buffer's scratch file, default\n");
+    fprintf(stderr, "                    /var/tmp\n");
+    fprintf(stderr, " --degrade[=FILE]   Decimate the raw output by 2, then 4, while it stays behind\n");
+    fprintf(stderr, "                    and log each rate change to FILE (default OUTPUT.rate)\n");
+    fprintf(stderr, " --checksum[=FILE]  CRC32C of every block written, for rx888_verify: raw output\n");
+    fprintf(stderr, "                    in FILE (default OUTPUT.crc), stripe target N in\n");
+    fprintf(stderr, "                    MANIFEST.N.crc\n");
+    fprintf(stderr, " --vhf F1[,F2,...]  VHF input through the R82XX tuner at these frequencies (Hz,\n");
+    fprintf(stderr, "                    k/M/G suffixes, START:STOP:STEP ranges). Several sweep\n");
+    fprintf(stderr, "                    them: the raw output keeps the settled part of each dwell,\n");
+    fprintf(stderr, "                    tagged in OUTPUT.sweep\n");
+    fprintf(stderr, " --dwell MS         Samples kept per frequency when sweeping, default 10 ms\n");
+    fprintf(stderr, " --tags[=FILE]      Log every configuration change made while streaming with\n");
+    fprintf(stderr, "                    the sample index it took effect at, to FILE (default\n");
+    fprintf(stderr, "                    OUTPUT.tags)\n");
+    fprintf(stderr, " --calibrate        Measure the dB of every gain and attenuation value against\n");
+    fprintf(stderr, "                    a stable input, write the gain table and exit\n");
+    fprintf(stderr, " --gain-table FILE  Gain table for VITA-49 metadata and rtl_tcp gains, default\n");
+    fprintf(stderr, "                    ~/.cache/rx888/gain.cal; nominal gains without one\n");
+    fprintf(stderr, " --stripe A,B,...   Deal raw blocks round robin to these files, devices or\n");
+    fprintf(stderr, "                    directories, one writer thread each (at most %d)\n", MAX_STRIPES);
+    fprintf(stderr, " --stripe-manifest  Manifest for rx888_unstripe, default capture.stripe\n");
+    fprintf(stderr, " --rtltcp, -R       Serve rtl_tcp on [addr:]port, default address 127.0.0.1\n");
+    fprintf(stderr, " --daemon, -D       Keep streaming and serve clients on this Unix socket\n");
+    fprintf(stderr, " --vrt, -V          Send VITA-49 packets over UDP to host[:port], default port 4991\n");
+    fprintf(stderr, " --vrt-gso          Coalesce VITA-49 packets with UDP GSO\n");
+    fprintf(stderr, " --vrt-payload      Samples per VITA-49 data packet, default 512\n");
+    fprintf(stderr, " --synthetic SEC    No device: run the outputs from a synthetic source paced\n");
+    fprintf(stderr, "                    at the sample rate for SEC seconds and report throughput,\n");
+    fprintf(stderr, "                    CPU per stage and latency\n");
+    fprintf(stderr, " --pktsize          Synthetic source packet size in bytes, default 16384\n");
+    fprintf(stderr, " --sim[=OPTS]       Run against a simulated FX3 instead of the device. OPTS:\n");
+    fprintf(stderr, "                    boot=0|1,speed=X,stall=N,error=N,short=N,pause=N:MS\n");
+    fprintf(stderr, " --journal FILE     Record every USB transfer's status, timing and queue\n");
+    fprintf(stderr, "                    occupancy to FILE, for rx888_journal\n");
+    fprintf(stderr, " --trace FILE       Record per-block pipeline events and write them to FILE\n");
+    fprintf(stderr, "                    as Chrome trace JSON at exit or on SIGUSR1\n");
     fprintf(stderr, " --help, -h         Print this help\n");
 }
 
@@ -194,9 +1248,8 @@ static double actual_freq(double frequency){
 
 int main(int argc, char **argv) {
 
-    unsigned int samplerate = 32000000;
-    unsigned int gain = 0x80;
-    unsigned int att = 0;
+    struct rx888_config cfg;
+    rx888_config_init(&cfg);
 
     int c;
     while (1) {
@@ -211,14 +1264,37 @@ int main(int argc, char **argv) {
             {"att", required_argument, 0, 'a'},
             {"queuedepth", required_argument, 0, 'q'},
             {"reqsize", required_argument, 0, 'p'},
-	    {"refclock-10M", no_argument, &refclock_10M, 'T'}, 
+            {"refclock-10M", no_argument, 0, 'T'},
+            {"output", required_argument, 0, 'o'},
+            {"rtltcp", required_argument, 0, 'R'},
+            {"daemon", required_argument, 0, 'D'},
+            {"vrt", required_argument, 0, 'V'},
+            {"vrt-gso", no_argument, 0, OPT_VRT_GSO},
+            {"vrt-payload", required_argument, 0, OPT_VRT_PAYLOAD},
+            {"synthetic", required_argument, 0, OPT_SYNTHETIC},
+            {"pktsize", required_argument, 0, OPT_PKTSIZE},
+            {"sim", optional_argument, 0, OPT_SIM},
+            {"trace", required_argument, 0, OPT_TRACE},
+            {"writeback", optional_argument, 0, OPT_WRITEBACK},
+            {"stripe", required_argument, 0, OPT_STRIPE},
+            {"stripe-manifest", required_argument, 0, OPT_STRIPE_MANIFEST},
+            {"elastic", optional_argument, 0, OPT_ELASTIC},
+            {"spill-dir", required_argument, 0, OPT_SPILL_DIR},
+            {"degrade", optional_argument, 0, OPT_DEGRADE},
+            {"checksum", optional_argument, 0, OPT_CHECKSUM},
+            {"vhf", required_argument, 0, OPT_VHF},
+            {"dwell", required_argument, 0, OPT_DWELL},
+            {"tags", optional_argument, 0, OPT_TAGS},
+            {"calibrate", no_argument, 0, OPT_CALIBRATE},
+            {"gain-table", required_argument, 0, OPT_GAIN_TABLE},
+            {"journal", required_argument, 0, OPT_JOURNAL},
             {"help", no_argument, 0, 'h'},
             {0, 0, 0, 0}};
 
         int option_index = 0;
         int gainvalue = 0;
 
-        c = getopt_long(argc, argv, "f:drs:hm:g:a:q:p:T", long_options,
+        c = getopt_long(argc, argv, "f:drs:hm:g:a:q:p:TR:V:D:o:", long_options,
                         &option_index);
 
         if (c == -1)
@@ -232,7 +1308,7 @@ int main(int argc, char **argv) {
         switch (c) {
 
         case 'f':
-            firmware = optarg;
+            cfg.firmware = optarg;
             break;
 
         case 'r':
@@ -252,9 +1328,9 @@ int main(int argc, char **argv) {
             break;
 
         case 's':
-            samplerate = strtoul(optarg, NULL, 10);
-            if (samplerate < 1000000) {
-                fprintf(stderr, "Invalid samplerate %d\n", samplerate);
+            cfg.samplerate = strtoul(optarg, NULL, 10);
+            if (cfg.samplerate < 1000000) {
+                fprintf(stderr, "Invalid samplerate %d\n", cfg.samplerate);
                 printhelp();
                 return 0;
             }
@@ -262,9 +1338,9 @@ int main(int argc, char **argv) {
 
         case 'm':
             if (strcmp(optarg, "high") == 0) {
-                gain |= 0x80;
+                cfg.gain |= 0x80;
             } else if (strcmp(optarg, "low") == 0) {
-                gain &= ~0x80;
+                cfg.gain &= ~0x80;
             } else {
                 fprintf(stderr, "Invalid gain mode %s\n", optarg);
                 printhelp();
@@ -279,37 +1355,169 @@ int main(int argc, char **argv) {
                 printhelp();
                 return 0;
             }
-            gain &= ~0x7f;
-            gain |= gainvalue;
+            cfg.gain &= ~0x7f;
+            cfg.gain |= gainvalue;
             break;
 
         case 'a':
-            att = strtol(optarg, NULL, 10);
-            if (att < 0 || att > 63) {
-                fprintf(stderr, "Invalid attenuation value %d\n", att);
+            cfg.att = strtol(optarg, NULL, 10);
+            if (cfg.att > 63) {
+                fprintf(stderr, "Invalid attenuation value %d\n", cfg.att);
                 printhelp();
                 return 0;
             }
             break;
         case 'q':
-            queuedepth = strtol(optarg, NULL, 10);
-            if (queuedepth < 1 || queuedepth > 64) {
-                fprintf(stderr, "Invalid queue depth %d\n", queuedepth);
+            cfg.queuedepth = strtol(optarg, NULL, 10);
+            if (cfg.queuedepth < 1 || cfg.queuedepth > 64) {
+                fprintf(stderr, "Invalid queue depth %d\n", cfg.queuedepth);
                 printhelp();
                 return 0;
             }
             break;
         case 'p':
-            reqsize = strtol(optarg, NULL, 10);
-            if (reqsize < 1 || reqsize > 64) {
-                fprintf(stderr, "Invalid request size %d\n", reqsize);
+            cfg.reqsize = strtol(optarg, NULL, 10);
+            if (cfg.reqsize < 1 || cfg.reqsize > 64) {
+                fprintf(stderr, "Invalid request size %d\n", cfg.reqsize);
                 printhelp();
                 return 0;
             }
             break;
         case 'T':
+            refclock_10M = 1;
             xtalFreq = (uint32_t)10000000;
             break;
+        case 'R': {
+            char *colon = strrchr(optarg, ':');
+            if (colon) {
+                *colon = '\0';
+                rtltcp_addr = optarg;
+                optarg = colon + 1;
+            }
+            rtltcp_port = strtoul(optarg, NULL, 10);
+            if (rtltcp_port < 1 || rtltcp_port > 65535) {
+                fprintf(stderr, "Invalid rtl_tcp port %s\n", optarg);
+                printhelp();
+                return 0;
+            }
+            break;
+        }
+        case 'D':
+            daemon_path = optarg;
+            break;
+        case 'o':
+            output_path = optarg;
+            break;
+        case 'V': {
+            char *colon = strrchr(optarg, ':');
+            if (colon) {
+                *colon = '\0';
+                vrt_port = strtoul(colon + 1, NULL, 10);
+            }
+            vrt_host = optarg;
+            break;
+        }
+        case OPT_VRT_GSO:
+            vrt_cfg.gso = true;
+            break;
+        case OPT_SYNTHETIC:
+            synthetic_seconds = strtod(optarg, NULL);
+            if (synthetic_seconds <= 0) {
+                fprintf(stderr, "Invalid synthetic run time %s\n", optarg);
+                printhelp();
+                return 0;
+            }
+            break;
+        case OPT_PKTSIZE:
+            synthetic_pktsize = strtoul(optarg, NULL, 10);
+            if (synthetic_pktsize < 512 || synthetic_pktsize % 2) {
+                fprintf(stderr, "Invalid packet size %s\n", optarg);
+                printhelp();
+                return 0;
+            }
+            break;
+        case OPT_SIM:
+            sim_spec = optarg ? optarg : "";
+            break;
+        case OPT_TRACE:
+            trace_path = optarg;
+            break;
+        case OPT_WRITEBACK:
+            writeback_mb = optarg ? strtoul(optarg, NULL, 10) : 8;
+            if (writeback_mb == 0 || writeback_mb > 4096) {
+                fprintf(stderr, "Invalid writeback window %s\n", optarg);
+                printhelp();
+                return 0;
+            }
+            break;
+        case OPT_STRIPE:
+            for (char *p = strtok(optarg, ","); p; p = strtok(NULL, ",")) {
+                if (stripe.count == MAX_STRIPES) {
+                    fprintf(stderr, "At most %d stripe targets\n", MAX_STRIPES);
+                    printhelp();
+                    return 0;
+                }
+                stripe.paths[stripe.count++] = p;
+            }
+            break;
+        case OPT_STRIPE_MANIFEST:
+            stripe.manifest_path = optarg;
+            break;
+        case OPT_ELASTIC:
+            elastic_mb = optarg ? strtoul(optarg, NULL, 10) : 256;
+            if (elastic_mb == 0) {
+                fprintf(stderr, "Invalid elastic buffer size %s\n", optarg);
+                printhelp();
+                return 0;
+            }
+            break;
+        case OPT_SPILL_DIR:
+            spill_dir = optarg;
+            break;
+        case OPT_DEGRADE:
+            degrade_path = optarg ? optarg : "";
+            break;
+        case OPT_CHECKSUM:
+            checksum_path = optarg ? optarg : "";
+            break;
+        case OPT_VHF:
+            free(vhf.freqs);
+            vhf.count = sweep_parse(optarg, &vhf.freqs);
+            if (vhf.count == 0) {
+                fprintf(stderr, "Invalid VHF frequency list %s\n", optarg);
+                printhelp();
+                return 0;
+            }
+            vhf_spec = optarg;
+            break;
+        case OPT_TAGS:
+            tags_path = optarg ? optarg : "";
+            break;
+        case OPT_CALIBRATE:
+            calibrate = true;
+            break;
+        case OPT_GAIN_TABLE:
+            gain_table_path = optarg;
+            break;
+        case OPT_JOURNAL:
+            journal_path = optarg;
+            break;
+        case OPT_DWELL:
+            dwell_ms = strtoul(optarg, NULL, 10);
+            if (dwell_ms < 1 || dwell_ms > 60000) {
+                fprintf(stderr, "Invalid dwell time %s\n", optarg);
+                printhelp();
+                return 0;
+            }
+            break;
+        case OPT_VRT_PAYLOAD:
+            vrt_cfg.payload = strtoul(optarg, NULL, 10);
+            if (vrt_cfg.payload < 1 || vrt_cfg.payload > 8192) {
+                fprintf(stderr, "Invalid VITA-49 payload %s\n", optarg);
+                printhelp();
+                return 0;
+            }
+            break;
         case 'h':
         case '?':
         default:
@@ -319,24 +1527,88 @@ int main(int argc, char **argv) {
         }
     }
 
-    fprintf(stderr, "Firmware: %s\n", firmware);
+    if (degrade_path && elastic_mb) {
+        fprintf(stderr, "--degrade and --elastic cannot be combined\n");
+        printhelp();
+        return 0;
+    }
+    bool sweeping = vhf.count > 1;
+    if (sweeping && !output_path && (rtltcp_port || daemon_path || vrt_host)) {
+        fprintf(stderr, "A VHF sweep writes to the raw output, use -o\n");
+        printhelp();
+        return 0;
+    }
+    if (sweeping && (degrade_path || elastic_mb || checksum_path || stripe.count)) {
+        fprintf(stderr, "A VHF sweep cannot be combined with --degrade, --elastic, --checksum "
+                "or --stripe\n");
+        printhelp();
+        return 0;
+    }
+    bool raw_file = output_path && strcmp(output_path, "-") != 0;
+    char degrade_default[4096], checksum_default[4096], sweep_default[4096];
+    char tags_default[4096];
+    if (tags_path && *tags_path == '\0') {
+        snprintf(tags_default, sizeof(tags_default), "%s.tags", raw_file ? output_path : "rx888");
+        tags_path = tags_default;
+    }
+    if (sweeping) {
+        snprintf(sweep_default, sizeof(sweep_default), "%s.sweep",
+                 raw_file ? output_path : "rx888");
+        sweep_path = sweep_default;
+    }
+    if (degrade_path && *degrade_path == '\0') {
+        snprintf(degrade_default, sizeof(degrade_default), "%s.rate",
+                 raw_file ? output_path : "rx888");
+        degrade_path = degrade_default;
+    }
+    if (checksum_path && *checksum_path == '\0') {
+        snprintf(checksum_default, sizeof(checksum_default), "%s.crc",
+                 raw_file ? output_path : "rx888");
+        checksum_path = checksum_default;
+    }
+
+    // rtl_tcp: -s is the ceiling, run the ADC at a power of two of the output rate
+    unsigned int max_adc = cfg.samplerate;
+    if (rtltcp_port) {
+        unsigned int decim = rtltcp_decimation(RTLTCP_RATE, max_adc);
+        if (decim == 0) {
+            fprintf(stderr, "Sample rate %u too low for rtl_tcp\n", max_adc);
+            return 0;
+        }
+        cfg.samplerate = RTLTCP_RATE * decim;
+    }
+
+    fprintf(stderr, "Firmware: %s\n", cfg.firmware);
     fprintf(stderr, "Ref. Clock: %d\n", xtalFreq);
-    fprintf(stderr, "Requested Sample Rate: %u\n", samplerate);
-    actual_freq((double)samplerate);
+    fprintf(stderr, "Requested Sample Rate: %u\n", cfg.samplerate);
+    actual_freq((double)cfg.samplerate);
     fprintf(stderr, "Output Randomizer %s, Dither: %s\n",
             randomizer ? "On" : "Off", dither ? "On" : "Off");
     fprintf(stderr, "Gain Mode: %s, Gain: %u, Att: %u\n",
-            (gain & 0x80) ? "High" : "Low", gain & 0x7f, att);
-    /* code */
-    struct libusb_device_descriptor desc;
-    struct libusb_device *dev;
-    struct libusb_endpoint_descriptor const *endpointDesc;
-    struct libusb_ss_endpoint_companion_descriptor *ep_comp;
-    struct libusb_config_descriptor *config;
-    struct libusb_interface_descriptor const *interfaceDesc;
-    size_t list, i;
-    int ret, temp;
-    int rStatus;
+            (cfg.gain & 0x80) ? "High" : "Low", cfg.gain & 0x7f, cfg.att);
+    char gain_table_default[4096];
+    if (gain_table_path == NULL)
+        gain_table_path = gaincal_default_path(gain_table_default, sizeof(gain_table_default));
+    gaincal_nominal(&gaincal);
+    if (calibrate && gain_table_path == NULL) {
+        fprintf(stderr, "No HOME or XDG_CACHE_HOME for the gain table, use --gain-table\n");
+        return 0;
+    }
+    if (!calibrate && gain_table_path && gaincal_load(&gaincal, gain_table_path) != 0 &&
+        errno == ENOENT && verbose)
+        fprintf(stderr, "No gain table at %s\n", gain_table_path);
+    fprintf(stderr, "Front end gain: %.1f dB (%s)\n", gaincal_db(&gaincal, cfg.gain, cfg.att),
+            gaincal.measured ? "measured" : "nominal");
+    cfg.randomizer = randomizer ? 1 : 0;
+    cfg.dither = dither ? 1 : 0;
+    cfg.sample_stats = 1;
+    cfg.block_crc = checksum_path != NULL;
+    cfg.synthetic = synthetic_seconds > 0;
+    cfg.pktsize = synthetic_pktsize;
+    cfg.sim = sim_spec;
+    cfg.vhf = vhf_spec != NULL;
+    cfg.journal = journal_path;
+
     struct sigaction sigact;
 
     sigact.sa_handler = sig_stop;
@@ -346,196 +1618,168 @@ int main(int argc, char **argv) {
     (void)sigaction(SIGTERM, &sigact, NULL);
     //this is needed for using streamer with a commandline tool like `pv` for limiting file size
     (void)sigaction(SIGPIPE, &sigact, NULL);
-    
-    struct libusb_transfer **transfers = NULL; // List of transfer structures.
-    unsigned char **databuffers = NULL;        // List of data buffers.
-
-    ret = libusb_init(NULL);
-    if (ret != 0) {
-        fprintf(stderr, "Error initializing libusb: %s\n",
-                libusb_error_name(ret));
-        exit(1);
-    }
-
-search:
-    if (firmware) { // there is argument with image file
-        libusb_device **devs;
-        //find the RX888 device 
-        list = libusb_get_device_list(NULL, &devs);
-        if(list < 0) {
-            fprintf(stderr, "Error in getting device list\n");
-            goto close;
-        }
-        
-        for(i=0, temp=(int)list;i<temp;i++) {
-            struct libusb_device_descriptor desc;
-            ret = libusb_get_device_descriptor(devs[i], &desc);
-            if(ret<0) {   
-                fprintf(stderr, "unable to get device descriptor\n");
-                continue;
-            }
-            if (desc.idVendor == (uint16_t)0x04b4) {
-                // no firmware, upload it
-                if (desc.idProduct == (uint16_t)0x00f3) {
-                    ret = libusb_open(devs[i], &dev_handle);
-                    //dev = libusb_get_device(dev_handle);
-                    if (ret>0) {
-                         fprintf(stderr,"Error or device could not be found: error %s", libusb_error_name(ret));
-                    goto close;
-                    }
-                    if (ezusb_load_ram(dev_handle, firmware, FX_TYPE_FX3, IMG_TYPE_IMG,
-                           1) == 0) {
-                        fprintf(stderr, "Firmware updated\n");
-                        libusb_close(dev_handle);
-                        sleep(3);
-                        goto search;
-                    } 
-                    else {
-                        fprintf(stderr, "Firmware upload failed for device\n");
-                    }
-                }
-		        if (desc.idProduct == (uint16_t)0x00f1) {
-                    libusb_open(devs[i], &dev_handle);
-                    if (!dev_handle) {
-                        fprintf(stderr,
-                                "Error or device could not be found, try loading firmware\n");
-                        goto close;
-                    }
-                    ret = libusb_kernel_driver_active(dev_handle, 0);
-                    if (ret != 0) {
-                        fprintf(stderr,
-                                "Kernel driver active. Trying to detach kernel driver\n");
-                        ret = libusb_detach_kernel_driver(dev_handle, 0);
-                        if (ret != 0) {
-                            fprintf(stderr,
-                                    "Could not detach kernel driver from an interface\n");
-                            goto close;
-                        }
-                    }
-                }
-            }
-        }
-
-    sleep(1);
-    //this shouldn't be needed, cleanup
-    dev = libusb_get_device(dev_handle);
-    libusb_get_config_descriptor(dev, 0, &config);
-
-    ret = libusb_claim_interface(dev_handle, interface_number);
-    if (ret != 0) {
-        fprintf(stderr, "Error claiming interface, error: %s\n", libusb_error_name(ret));
-        goto end;
+    if (trace_path) {
+        trace_init(TRACE_EVENTS);
+        sigact.sa_handler = sig_trace;
+        (void)sigaction(SIGUSR1, &sigact, NULL);
     }
 
-    fprintf(stderr, "Successfully claimed interface\n");
-
-    interfaceDesc = &(config->interface[0].altsetting[0]);
-
-    endpointDesc = &interfaceDesc->endpoint[0];
+    if (rx888_open(&dev, &cfg) != RX888_OK)
+        goto close;
 
-    libusb_get_device_descriptor(dev, &desc);
-
-    libusb_get_ss_endpoint_companion_descriptor(NULL, endpointDesc, &ep_comp);
-
-    pktsize = endpointDesc->wMaxPacketSize * (ep_comp->bMaxBurst + 1);
-
-    libusb_free_ss_endpoint_companion_descriptor(ep_comp);
-
-    databuffers = (unsigned char **)calloc(queuedepth, sizeof(u_char *));
-    if (databuffers == NULL) {
-        fprintf(stderr, "Could not allocate memory for data buffers\n");
-        goto end;
+    if (rx888_start(dev) != RX888_OK)
+        goto close;
+    if (vhf.count == 1) {
+        if (rx888_tune(dev, vhf.freqs[0]) != RX888_OK)
+            goto close;
+        fprintf(stderr, "VHF: tuned to %llu Hz\n", (unsigned long long)vhf.freqs[0]);
     }
-
-    transfers = (struct libusb_transfer **)calloc(
-        queuedepth, sizeof(struct libusb_transfer *));
-    if (transfers == NULL) {
-        fprintf(stderr, "Could not allocate memory for transfer structures\n");
-        goto free_transfer_buf;
+    if (calibrate) {
+        if (gaincal_measure(dev, cfg.gain, cfg.att, &gaincal) == 0 &&
+            gaincal_save(&gaincal, gain_table_path) == 0)
+            fprintf(stderr, "Gain table written to %s\n", gain_table_path);
+        goto close;
     }
 
-    fprintf(stderr, "Queue depth: %d, Request size: %d\n", queuedepth,
-            reqsize * pktsize);
-
-    for (unsigned int i = 0; i < queuedepth; i++) {
-        databuffers[i] = (unsigned char *)malloc(reqsize * pktsize);
-        transfers[i] = libusb_alloc_transfer(0);
-        if ((databuffers[i] == NULL) || (transfers[i] == NULL)) {
-            goto free_transfer_buf;
-        }
+    struct sink *sinks[MAX_SINKS + MAX_STRIPES];
+    unsigned int nsinks = 0;
+    struct rtltcp_state rtltcp = {0};
+    struct vrt_state vrt = {.gain = cfg.gain, .att = cfg.att, .samplerate = cfg.samplerate};
+    struct daemon *daemon = NULL;
+    bool failed = false;
+    // A sink that stalls holds at most half the pool, the rest stays in flight
+    unsigned int depth = cfg.queuedepth > 1 ? cfg.queuedepth / 2 : 1;
+
+    if (rtltcp_port) {
+        if (rtltcp_open(&rtltcp, &cfg, max_adc) == 0)
+            sinks[nsinks++] = sink_start(dev, "rtl_tcp", rtltcp_block, &rtltcp, depth);
+        else
+            failed = true;
     }
-
-    for (unsigned int i = 0; i < queuedepth; i++) {
-        libusb_fill_bulk_transfer(transfers[i], dev_handle, ep, databuffers[i],
-                                  reqsize * pktsize, transfer_callback,
-                                  (void *)&pktsize, 0);
-        rStatus = libusb_submit_transfer(transfers[i]);
-        if (rStatus == 0)
-            xfers_in_progress++;
+    if (daemon_path) {
+        daemon = daemon_start(daemon_path, rx888_samplerate(dev),
+                              rx888_block_size(dev) / sizeof(int16_t));
+        if (daemon)
+            sinks[nsinks++] = sink_start(dev, "daemon", daemon_block, daemon, depth);
+        else
+            failed = true;
     }
-
-    /******/
-    uint32_t gpio = 0;
-    if (dither) {
-        gpio |= DITH;
+    if (vrt_host) {
+        vrt_cfg.samplerate = cfg.samplerate;
+        vrt.sink = vrt_open(vrt_host, vrt_port, &vrt_cfg);
+        if (vrt.sink)
+            sinks[nsinks++] = sink_start(dev, "vrt", vrt_block, &vrt, depth);
+        else
+            failed = true;
     }
-    if (randomizer) {
-        gpio |= RANDO;
+    if (tags_path) {
+        if (tag_log_open() == 0)
+            sinks[nsinks++] = sink_start(dev, "tags", tag_log_block, NULL, depth);
+        else
+            failed = true;
     }
-
-    usleep(5000);
-    command_send(dev_handle, GPIOFX3, gpio);
-    usleep(5000);
-    argument_send(dev_handle, DAT31_ATT, att);
-    usleep(5000);
-    argument_send(dev_handle, AD8340_VGA, gain);
-    usleep(5000);
-    command_send(dev_handle, STARTADC, samplerate);
-    usleep(5000);
-    command_send(dev_handle, STARTFX3, 0);
-    usleep(5000);
-    command_send(dev_handle, TUNERSTDBY, 0);
-    /*******/
-
-    do {
-        libusb_handle_events(NULL);
-
-    } while (stop_transfers != true);
-
-    fprintf(stderr, "Test complete. Stopping transfers\n");
-    stop_transfers = true;
-
-    while (xfers_in_progress != 0) {
-        fprintf(stderr, "%d transfers are pending\n", xfers_in_progress);
-        libusb_handle_events(NULL);
-        usleep(100000);
+    if (output_path || (!rtltcp_port && !daemon_path && !vrt_host && !stripe.count)) {
+        if (output_path == NULL || strcmp(output_path, "-") == 0)
+            raw.fd = STDOUT_FILENO;
+        else
+            raw.fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (raw.fd >= 0 && checksum_path &&
+            checksum_open(&raw, checksum_path,
+                          raw.fd == STDOUT_FILENO ? "/proc/self/fd/1" : output_path) != 0) {
+            failed = true;
+        } else if (raw.fd >= 0) {
+            writeback_open(&raw);
+            if (sweeping) {
+                if (vhf_open() == 0)
+                    sinks[nsinks++] = sink_start(dev, "raw", vhf_block, &raw, depth);
+                else
+                    failed = true;
+            } else if (degrade_path) {
+                degrade.write = file_writer(&raw);
+                if (degrade_open(depth) == 0)
+                    sinks[nsinks++] = sink_start_batch(dev, "raw", degrade_batch, &raw, depth);
+                else
+                    failed = true;
+            } else if (elastic_mb == 0)
+                sinks[nsinks++] = sink_start_batch(dev, "raw", file_writer(&raw), &raw, depth);
+            else if ((elastic = elastic_open((size_t)elastic_mb << 20, spill_dir,
+                                             elastic_drain, &raw)) != NULL)
+                sinks[nsinks++] = sink_start_batch(dev, "raw", elastic_batch, NULL, depth);
+            else
+                failed = true;
+        } else {
+            fprintf(stderr, "Cannot open %s: %s\n", output_path, strerror(errno));
+            failed = true;
+        }
     }
-
-    fprintf(stderr, "\nTransfers completed\n");
-    command_send(dev_handle, STOPFX3, 0);
-
-
-free_transfer_buf:
-    free_transfer_buffers(databuffers, transfers);
-
-end:
-    if (dev_handle) {
-        libusb_release_interface(dev_handle, interface_number);
+    for (unsigned int i = 0; i < nsinks; i++) {
+        if (sinks[i] == NULL)
+            failed = true;
+    }
+    // Stripe writers go last: run_sinks() deals blocks to them instead of broadcasting
+    unsigned int nbroadcast = nsinks;
+    if (stripe.count && !failed && stripe_start(sinks, &nsinks, depth) != 0)
+        failed = true;
+
+    // Whatever failed, the sinks that did start are stopped below
+    unsigned int nstarted = nsinks;
+    if (failed) {
+        rx888_stop(dev);
+        nsinks = nbroadcast = 0;
+    }
+    // Before the first block, so before rtl_tcp reads any command
+    rtltcp.shared = rtltcp_port && nsinks > 1;
+    struct timespec t0, t1;
+    uint64_t cpu0 = thread_cpu_ns();
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    run_sinks(sinks, nbroadcast, nsinks);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (cfg.synthetic && !failed)
+        report_synthetic(sinks, nsinks,
+                         (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9,
+                         (thread_cpu_ns() - cpu0) / 1e9);
+    else
+        print_sink_stats(sinks, nsinks);
+    for (unsigned int i = 0; i < nstarted; i++)
+        sink_stop(sinks[i]);
+    if (rtltcp_port)
+        rtltcp_close(&rtltcp);
+    daemon_stop(daemon);
+    vrt_close(vrt.sink);
+    if (elastic) {
+        fprintf(stderr, "Draining the elastic buffer\n");
+        elastic_close(elastic);
+        elastic = NULL;
     }
+    if (raw.fd >= 0)
+        writeback_close(&raw);
+    checksum_close(&raw);
+    degrade_close();
+    vhf_close();
+    stripe_close();
+    if (tag_log.file)
+        fclose(tag_log.file);
+    if (raw.fd > STDOUT_FILENO)
+        close(raw.fd);
+    if (trace_path && trace_export(trace_path) == 0)
+        fprintf(stderr, "Trace written to %s\n", trace_path);
 
-    if (config) {
-        libusb_free_config_descriptor(config);
+    fprintf(stderr, "Test complete. Stopping transfers\n");
+    if (sim_spec) {
+        struct usb_sim_stats ss;
+        usb_sim_get_stats(&ss);
+        fprintf(stderr, "Simulated FX3: %llu transfers, %llu stalls, %llu errors, %llu short, "
+                "%llu pauses, %llu samples lost, %llu firmware bytes\n",
+                (unsigned long long)ss.transfers, (unsigned long long)ss.stalls,
+                (unsigned long long)ss.errors, (unsigned long long)ss.shorts,
+                (unsigned long long)ss.pauses, (unsigned long long)ss.lost_samples,
+                (unsigned long long)ss.fw_bytes);
     }
 
 close:
-    libusb_free_device_list(devs, 1);
-
-    if (dev_handle) {
-        libusb_close(dev_handle);
-    }
-    libusb_exit(NULL);
+    rx888_close(dev);
+    dev = NULL;
 
     return 0;
-    
-    }
 }
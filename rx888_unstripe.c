@@ -0,0 +1,346 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+/*
+ * rx888_unstripe - stream a capture written with rx888_stream --stripe
+ * back in order, as the single raw file the capture would have been. One
+ * reader thread per target reads ahead, so the disks are read in parallel
+ * and the output runs at their combined speed.
+ *
+ *   rx888_unstripe capture.stripe > capture.raw
+ *   rx888_unstripe capture.stripe | some_consumer
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_STRIPES 8
+#define READ_AHEAD 16 // blocks buffered per target
+
+// Dropped or short blocks, by block number, in increasing order
+struct exception {
+    uint64_t block;
+    size_t length; // 0: dropped
+};
+
+struct target {
+    unsigned int index;
+    char path[4096];
+    int fd;
+    pthread_t thread;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned char *buf[READ_AHEAD];
+    size_t len[READ_AHEAD];
+    uint64_t block[READ_AHEAD];
+    unsigned int head;
+    unsigned int count;
+    bool done;  // reader finished, nothing more will be queued
+    bool error; // reader stopped on a read error or truncated file
+};
+
+static size_t block_size;
+static unsigned int ntargets;
+static uint64_t nblocks = UINT64_MAX; // unknown if the capture did not exit cleanly
+static struct target targets[MAX_STRIPES];
+static struct exception *exceptions;
+static size_t nexceptions;
+
+static int parse_manifest(const char *path) {
+    char line[4200];
+    unsigned int version = 0;
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long a, b;
+        unsigned int i;
+        char p[4096];
+
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "rx888-stripe %u", &version) == 1 ||
+            sscanf(line, "samplerate %llu", &a) == 1) {
+            continue;
+        } else if (sscanf(line, "block_size %zu", &block_size) == 1) {
+            continue;
+        } else if (sscanf(line, "targets %u", &ntargets) == 1) {
+            if (ntargets == 0 || ntargets > MAX_STRIPES)
+                break;
+        } else if (sscanf(line, "target %u %4095[^\n]", &i, p) == 2 && i < MAX_STRIPES) {
+            snprintf(targets[i].path, sizeof(targets[i].path), "%s", p);
+        } else if (sscanf(line, "short %llu %llu", &a, &b) == 2 ||
+                   sscanf(line, "drop %llu", &a) == 1) {
+            if (line[0] == 'd')
+                b = 0;
+            if ((nexceptions & (nexceptions + 1)) == 0) {
+                struct exception *e = realloc(exceptions, 2 * (nexceptions + 1) * sizeof(*e));
+                if (e == NULL)
+                    break;
+                exceptions = e;
+            }
+            exceptions[nexceptions].block = a;
+            exceptions[nexceptions].length = b;
+            nexceptions++;
+        } else if (sscanf(line, "blocks %llu", &a) == 1) {
+            nblocks = a;
+        }
+    }
+    fclose(f);
+
+    if (version != 1 || block_size == 0 || ntargets == 0 || ntargets > MAX_STRIPES) {
+        fprintf(stderr, "%s is not an rx888 stripe manifest\n", path);
+        return -1;
+    }
+    for (unsigned int i = 0; i < ntargets; i++) {
+        if (targets[i].path[0] == '\0') {
+            fprintf(stderr, "%s: no path for target %u\n", path, i);
+            return -1;
+        }
+    }
+    if (nblocks == UINT64_MAX)
+        fprintf(stderr, "%s has no block count, reading until the targets end\n", path);
+    return 0;
+}
+
+// Length of block n, 0 if it was dropped; *cursor walks the exceptions in order
+static size_t block_length(uint64_t n, size_t *cursor) {
+    while (*cursor < nexceptions && exceptions[*cursor].block < n)
+        (*cursor)++;
+    if (*cursor < nexceptions && exceptions[*cursor].block == n)
+        return exceptions[*cursor].length;
+    return block_size;
+}
+
+static ssize_t read_full(int fd, unsigned char *buf, size_t len) {
+    size_t got = 0;
+
+    while (got < len) {
+        ssize_t ret = read(fd, buf + got, len - got);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0)
+            return -1;
+        if (ret == 0)
+            break;
+        got += ret;
+    }
+    return got;
+}
+
+// Read this target's blocks in order into the read-ahead ring
+static void *reader(void *arg) {
+    struct target *t = arg;
+    size_t cursor = 0;
+    bool error = false;
+
+    for (uint64_t n = t->index; n < nblocks; n += ntargets) {
+        size_t len = block_length(n, &cursor);
+        if (len == 0)
+            continue;
+
+        pthread_mutex_lock(&t->lock);
+        while (t->count == READ_AHEAD)
+            pthread_cond_wait(&t->cond, &t->lock);
+        unsigned int slot = (t->head + t->count) % READ_AHEAD;
+        pthread_mutex_unlock(&t->lock);
+
+        ssize_t got = read_full(t->fd, t->buf[slot], len);
+        // Without a block count the capture ends wherever a target does
+        if (got >= 0 && got < (ssize_t)len && nblocks == UINT64_MAX)
+            break;
+        if (got != (ssize_t)len) {
+            if (got < 0)
+                fprintf(stderr, "Reading %s: %s\n", t->path, strerror(errno));
+            else
+                fprintf(stderr, "%s is truncated at block %" PRIu64 "\n", t->path, n);
+            error = true;
+            break;
+        }
+
+        pthread_mutex_lock(&t->lock);
+        t->len[slot] = len;
+        t->block[slot] = n;
+        t->count++;
+        pthread_cond_broadcast(&t->cond);
+        pthread_mutex_unlock(&t->lock);
+    }
+
+    pthread_mutex_lock(&t->lock);
+    t->done = true;
+    t->error = error;
+    pthread_cond_broadcast(&t->cond);
+    pthread_mutex_unlock(&t->lock);
+    return NULL;
+}
+
+static int write_full(int fd, const unsigned char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t ret = write(fd, buf, len);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0)
+            return -1;
+        buf += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+static void printhelp(void) {
+    fprintf(stderr, "Usage: rx888_unstripe [-o FILE] MANIFEST\n");
+    fprintf(stderr, " -o FILE   Write the capture to FILE instead of stdout\n");
+}
+
+int main(int argc, char **argv) {
+    const char *out_path = NULL;
+    int out = STDOUT_FILENO;
+    uint64_t written = 0, bytes = 0, dropped = 0;
+    size_t cursor = 0;
+    struct timespec t0, t1;
+    int ret = 0, opt;
+
+    while ((opt = getopt(argc, argv, "o:h")) != -1) {
+        switch (opt) {
+        case 'o':
+            out_path = optarg;
+            break;
+        default:
+            printhelp();
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1) {
+        printhelp();
+        return 1;
+    }
+    if (parse_manifest(argv[optind]) != 0)
+        return 1;
+    if (out_path) {
+        out = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out < 0) {
+            fprintf(stderr, "Cannot open %s: %s\n", out_path, strerror(errno));
+            return 1;
+        }
+    }
+
+    for (unsigned int i = 0; i < ntargets; i++) {
+        struct target *t = &targets[i];
+        t->index = i;
+        t->fd = open(t->path, O_RDONLY);
+        if (t->fd < 0) {
+            fprintf(stderr, "Cannot open %s: %s\n", t->path, strerror(errno));
+            return 1;
+        }
+        posix_fadvise(t->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        for (unsigned int j = 0; j < READ_AHEAD; j++) {
+            t->buf[j] = malloc(block_size);
+            if (t->buf[j] == NULL)
+                return 1;
+        }
+        pthread_mutex_init(&t->lock, NULL);
+        pthread_cond_init(&t->cond, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (unsigned int i = 0; i < ntargets; i++) {
+        if (pthread_create(&targets[i].thread, NULL, reader, &targets[i]) != 0) {
+            fprintf(stderr, "Could not start reader threads\n");
+            return 1;
+        }
+    }
+
+    // Interleave the targets back in block order
+    for (uint64_t n = 0; n < nblocks; n++) {
+        if (block_length(n, &cursor) == 0) {
+            dropped++;
+            continue;
+        }
+        struct target *t = &targets[n % ntargets];
+
+        pthread_mutex_lock(&t->lock);
+        while (t->count == 0 && !t->done)
+            pthread_cond_wait(&t->cond, &t->lock);
+        if (t->count == 0) {
+            ret = t->error ? 1 : 0;
+            pthread_mutex_unlock(&t->lock);
+            break;
+        }
+        unsigned int slot = t->head;
+        pthread_mutex_unlock(&t->lock);
+
+        if (t->block[slot] != n) {
+            fprintf(stderr, "%s: expected block %" PRIu64 ", found %" PRIu64 "\n",
+                    t->path, n, t->block[slot]);
+            ret = 1;
+            break;
+        }
+        if (write_full(out, t->buf[slot], t->len[slot]) != 0) {
+            fprintf(stderr, "Error writing output: %s\n", strerror(errno));
+            ret = 1;
+            break;
+        }
+        written++;
+        bytes += t->len[slot];
+
+        pthread_mutex_lock(&t->lock);
+        t->head = (t->head + 1) % READ_AHEAD;
+        t->count--;
+        pthread_cond_broadcast(&t->cond);
+        pthread_mutex_unlock(&t->lock);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (ret != 0) {
+        // Readers may be waiting for space that will never be freed
+        for (unsigned int i = 0; i < ntargets; i++)
+            pthread_cancel(targets[i].thread);
+    }
+    for (unsigned int i = 0; i < ntargets; i++) {
+        pthread_join(targets[i].thread, NULL);
+        close(targets[i].fd);
+    }
+
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    fprintf(stderr, "%" PRIu64 " blocks, %" PRIu64 " bytes from %u targets in %.2f s "
+            "(%.1f MB/s), %" PRIu64 " dropped blocks skipped\n", written, bytes, ntargets,
+            secs, secs > 0 ? bytes / secs / 1e6 : 0, dropped);
+    if (out != STDOUT_FILENO)
+        close(out);
+    return ret;
+}
@@ -0,0 +1,331 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+/*
+ * rx888_verify - check captures against the CRC32C sidecars written by
+ * rx888_stream --checksum. The checksummed units are split into groups
+ * that worker threads read and check in parallel, so a capture spread
+ * over several disks, or on one fast array, verifies at the speed of the
+ * storage rather than of one thread.
+ *
+ *   rx888_verify capture.raw.crc
+ *   rx888_verify capture.stripe.*.crc
+ *   rx888_verify -f capture.raw rx888.crc
+ */
+
+#define _GNU_SOURCE
+#include "kernels.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define GROUP_BYTES (16 << 20) // read and checked by one thread at a time
+
+struct sidecar {
+    const char *path;
+    char file[4096];
+    int fd;
+    uint64_t bytes;     // sum of the unit lengths
+    uint64_t end;       // total from the closing line
+    bool complete;      // the closing line was there
+    uint64_t units;
+    atomic_uint_fast64_t bad;
+};
+
+// One checksummed write unit
+struct unit {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t crc;
+    unsigned int sidecar;
+    bool bad;
+};
+
+static struct sidecar *sidecars;
+static unsigned int nsidecars;
+static struct unit *units;
+static size_t nunits;
+static size_t *groups; // first unit of each group, plus nunits at the end
+static size_t ngroups;
+static size_t max_group; // bytes
+static atomic_size_t next_group;
+
+static int add_unit(unsigned int s, uint64_t offset, uint32_t length, uint32_t crc) {
+    if ((nunits & (nunits + 1)) == 0) {
+        struct unit *u = realloc(units, 2 * (nunits + 1) * sizeof(*u));
+        if (u == NULL)
+            return -1;
+        units = u;
+    }
+    units[nunits++] = (struct unit){.offset = offset, .length = length, .crc = crc, .sidecar = s};
+    return 0;
+}
+
+static int parse_sidecar(unsigned int s) {
+    struct sidecar *sc = &sidecars[s];
+    char line[4200];
+    unsigned int version = 0;
+    size_t block_size = 0;
+    FILE *f = fopen(sc->path, "r");
+
+    if (f == NULL) {
+        fprintf(stderr, "Cannot open %s: %s\n", sc->path, strerror(errno));
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long a;
+        unsigned int crc;
+        size_t len;
+        char p[4096];
+
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "rx888-crc32c %u", &version) == 1) {
+            continue;
+        } else if (sscanf(line, "file %4095[^\n]", p) == 1) {
+            if (sc->file[0] == '\0')
+                snprintf(sc->file, sizeof(sc->file), "%s", p);
+        } else if (sscanf(line, "block_size %zu", &block_size) == 1) {
+            continue;
+        } else if (sscanf(line, "end %llu", &a) == 1) {
+            sc->end = a;
+            sc->complete = true;
+        } else if (sscanf(line, "%8x %zu", &crc, &len) >= 1) {
+            if (strchr(line, ' ') == NULL)
+                len = block_size;
+            if (len == 0 || len > UINT32_MAX || add_unit(s, sc->bytes, len, crc) != 0)
+                break;
+            sc->bytes += len;
+            sc->units++;
+        }
+    }
+    fclose(f);
+
+    if (version != 1 || block_size == 0) {
+        fprintf(stderr, "%s is not an rx888 checksum sidecar\n", sc->path);
+        return -1;
+    }
+    if (strcmp(sc->file, "-") == 0) {
+        fprintf(stderr, "%s was written to a pipe: give the data file with -f\n", sc->path);
+        return -1;
+    }
+    if (!sc->complete)
+        fprintf(stderr, "%s has no closing line, checking the %" PRIu64 " units it lists\n",
+                sc->path, sc->units);
+    else if (sc->end != sc->bytes) {
+        fprintf(stderr, "%s: units add up to %" PRIu64 " bytes, closing line says %" PRIu64 "\n",
+                sc->path, sc->bytes, sc->end);
+        return -1;
+    }
+    return 0;
+}
+
+// Cut the units into groups of about GROUP_BYTES, never across files
+static int make_groups(void) {
+    size_t bytes = 0;
+
+    groups = malloc((nunits + 1) * sizeof(*groups));
+    if (groups == NULL)
+        return -1;
+    for (size_t i = 0; i < nunits; i++) {
+        if (i == 0 || units[i].sidecar != units[i - 1].sidecar ||
+            bytes + units[i].length > GROUP_BYTES) {
+            groups[ngroups++] = i;
+            bytes = 0;
+        }
+        bytes += units[i].length;
+        if (bytes > max_group)
+            max_group = bytes;
+    }
+    groups[ngroups] = nunits;
+    return 0;
+}
+
+static ssize_t pread_full(int fd, unsigned char *buf, size_t len, off_t offset) {
+    size_t got = 0;
+
+    while (got < len) {
+        ssize_t ret = pread(fd, buf + got, len - got, offset + got);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0)
+            return -1;
+        if (ret == 0)
+            break;
+        got += ret;
+    }
+    return got;
+}
+
+static void *checker(void *arg) {
+    unsigned char *buf = malloc(max_group);
+    uint64_t *checked = arg;
+
+    if (buf == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return NULL;
+    }
+    for (size_t g; (g = atomic_fetch_add(&next_group, 1)) < ngroups;) {
+        struct unit *first = &units[groups[g]], *last = &units[groups[g + 1] - 1];
+        struct sidecar *sc = &sidecars[first->sidecar];
+        size_t len = last->offset + last->length - first->offset;
+
+        ssize_t got = pread_full(sc->fd, buf, len, first->offset);
+        if (got < 0) {
+            fprintf(stderr, "Reading %s: %s\n", sc->file, strerror(errno));
+            got = 0;
+        }
+        for (struct unit *u = first; u <= last; u++) {
+            size_t at = u->offset - first->offset;
+            // Missing data counts as bad
+            if (at + u->length > (size_t)got ||
+                kernel_crc32c(0, buf + at, u->length) != u->crc) {
+                u->bad = true;
+                atomic_fetch_add(&sc->bad, 1);
+            }
+        }
+        *checked += got;
+        // Checked once, not worth keeping in the page cache
+        posix_fadvise(sc->fd, first->offset, len, POSIX_FADV_DONTNEED);
+    }
+    free(buf);
+    return NULL;
+}
+
+static void printhelp(void) {
+    fprintf(stderr, "Usage: rx888_verify [-j N] [-f FILE] SIDECAR...\n");
+    fprintf(stderr, " -f FILE   Data file, for a single sidecar of a capture written to a pipe\n");
+    fprintf(stderr, " -j N      Checker threads, default one per online CPU\n");
+}
+
+int main(int argc, char **argv) {
+    const char *data_path = NULL;
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    struct timespec t0, t1;
+    uint64_t bad = 0, bytes = 0;
+    int ret = 0, opt;
+
+    while ((opt = getopt(argc, argv, "f:j:h")) != -1) {
+        switch (opt) {
+        case 'f':
+            data_path = optarg;
+            break;
+        case 'j':
+            nthreads = strtol(optarg, NULL, 10);
+            break;
+        default:
+            printhelp();
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind == argc || nthreads < 1 || (data_path && argc - optind != 1)) {
+        printhelp();
+        return 1;
+    }
+
+    nsidecars = argc - optind;
+    sidecars = calloc(nsidecars, sizeof(*sidecars));
+    if (sidecars == NULL)
+        return 1;
+    for (unsigned int s = 0; s < nsidecars; s++) {
+        struct sidecar *sc = &sidecars[s];
+        struct stat st;
+
+        sc->path = argv[optind + s];
+        if (data_path)
+            snprintf(sc->file, sizeof(sc->file), "%s", data_path);
+        if (parse_sidecar(s) != 0)
+            return 1;
+        sc->fd = open(sc->file, O_RDONLY);
+        if (sc->fd < 0 || fstat(sc->fd, &st) != 0) {
+            fprintf(stderr, "Cannot open %s: %s\n", sc->file, strerror(errno));
+            return 1;
+        }
+        posix_fadvise(sc->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        if (S_ISREG(st.st_mode) && (uint64_t)st.st_size > sc->bytes)
+            fprintf(stderr, "%s: %" PRIu64 " bytes past the checksummed data\n", sc->file,
+                    (uint64_t)st.st_size - sc->bytes);
+    }
+    if (make_groups() != 0)
+        return 1;
+    if ((size_t)nthreads > ngroups)
+        nthreads = ngroups ? ngroups : 1;
+
+    pthread_t *threads = calloc(nthreads, sizeof(*threads));
+    uint64_t *checked = calloc(nthreads, sizeof(*checked));
+    if (threads == NULL || checked == NULL)
+        return 1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (long i = 0; i < nthreads; i++) {
+        if (pthread_create(&threads[i], NULL, checker, &checked[i]) != 0) {
+            fprintf(stderr, "Could not start checker threads\n");
+            return 1;
+        }
+    }
+    for (long i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+        bytes += checked[i];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    // Units are in file order, so the report is too
+    for (size_t i = 0; i < nunits; i++) {
+        if (units[i].bad)
+            printf("%s: bad unit at offset %" PRIu64 ", length %" PRIu32 "\n",
+                   sidecars[units[i].sidecar].file, units[i].offset, units[i].length);
+    }
+    for (unsigned int s = 0; s < nsidecars; s++) {
+        struct sidecar *sc = &sidecars[s];
+        uint64_t n = atomic_load(&sc->bad);
+
+        printf("%s: %" PRIu64 " units, %" PRIu64 " bytes, %s\n", sc->file, sc->units, sc->bytes,
+               n ? "FAILED" : "OK");
+        bad += n;
+        close(sc->fd);
+    }
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    fprintf(stderr, "%" PRIu64 " bytes checked on %ld threads in %.2f s (%.1f MB/s), "
+            "%" PRIu64 " bad units\n", bytes, nthreads, secs, secs > 0 ? bytes / secs / 1e6 : 0,
+            bad);
+    if (bad)
+        ret = 1;
+
+    free(threads);
+    free(checked);
+    free(groups);
+    free(units);
+    free(sidecars);
+    return ret;
+}
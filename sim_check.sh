@@ -0,0 +1,31 @@
+#!/bin/sh
+#
+# Runs rx888_stream against the simulated FX3 with an output that stops
+# reading, and fails if that starved the USB stream: the stalled output
+# has to drop blocks while the device loses no samples.
+#
+#   make check
+#
+set -e
+
+LOG=$(mktemp)
+FIFO=$(mktemp -u)
+trap 'rm -f "$LOG" "$FIFO"' EXIT
+mkfifo "$FIFO"
+
+# The reader sleeps through most of the run before draining the pipe
+(sleep 3; cat > /dev/null) < "$FIFO" &
+./rx888_stream --sim=boot=0 -s 32000000 -o - --tags=/dev/null > "$FIFO" 2> "$LOG" &
+PID=$!
+sleep 5
+kill -INT $PID
+wait $PID || true
+wait
+
+if ! grep -q "Simulated FX3: .* 0 samples lost" "$LOG" ||
+   grep -q "Sink raw: .* 0 dropped" "$LOG"; then
+    cat "$LOG" >&2
+    echo "FAIL: stalled output starved the stream" >&2
+    exit 1
+fi
+echo "PASS: stalled output dropped blocks, no samples lost"
@@ -0,0 +1,202 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "sink.h"
+#include "probes.h"
+#include "trace.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+struct sink {
+    rx888_t *dev;
+    const char *name;
+    rx888_callback fn;
+    sink_batch_fn batch_fn;
+    void *ctx;
+    pthread_t thread;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool stop;
+    bool failed;                // the handler asked to stop, blocks are discarded
+    struct rx888_block **queue; // ring of block references
+    struct rx888_block **batch; // blocks taken off the queue in one go
+    unsigned int depth;
+    unsigned int head;
+    unsigned int count;
+    unsigned int busy;          // blocks in the handler right now
+
+    struct sink_stats stats;
+};
+
+static void *sink_thread(void *arg) {
+    struct sink *sink = arg;
+    struct timespec cpu;
+
+    trace_thread_name(sink->name);
+    pthread_mutex_lock(&sink->lock);
+    for (;;) {
+        while (sink->count == 0 && !sink->stop)
+            pthread_cond_wait(&sink->cond, &sink->lock);
+        if (sink->count == 0)
+            break;
+        unsigned int n = sink->batch_fn ? sink->count : 1;
+        for (unsigned int i = 0; i < n; i++) {
+            sink->batch[i] = sink->queue[sink->head];
+            sink->head = (sink->head + 1) % sink->depth;
+        }
+        sink->count -= n;
+        sink->busy = n;
+        pthread_mutex_unlock(&sink->lock);
+
+        uint64_t seq = sink->batch[0]->seq;
+        trace_begin(sink->name, seq);
+        RX888_PROBE2(sink_write_start, sink->name, seq);
+        // Like a callback mode handler, non-zero stops streaming
+        bool failed = sink->failed;
+        if (!failed) {
+            int ret = sink->batch_fn ? sink->batch_fn(sink->batch, n, sink->ctx)
+                                     : sink->fn(sink->batch[0], sink->ctx);
+            if (ret != 0) {
+                fprintf(stderr, "Output %s failed, stopping\n", sink->name);
+                sink->failed = failed = true;
+                rx888_stop(sink->dev);
+            }
+        }
+        RX888_PROBE2(sink_write_done, sink->name, seq);
+        trace_end(sink->name, seq);
+        for (unsigned int i = 0; i < n; i++)
+            rx888_release(sink->dev, sink->batch[i]);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+
+        pthread_mutex_lock(&sink->lock);
+        sink->busy = 0;
+        if (failed)
+            sink->stats.dropped += n;
+        else
+            sink->stats.blocks += n;
+        sink->stats.batches++;
+        if (n > sink->stats.max_batch)
+            sink->stats.max_batch = n;
+        sink->stats.cpu_ns = (uint64_t)cpu.tv_sec * 1000000000ULL + cpu.tv_nsec;
+    }
+    pthread_mutex_unlock(&sink->lock);
+    return NULL;
+}
+
+static struct sink *sink_create(rx888_t *dev, const char *name, rx888_callback fn,
+                                sink_batch_fn batch_fn, void *ctx, unsigned int depth) {
+    struct sink *sink;
+
+    sink = calloc(1, sizeof(*sink));
+    if (sink == NULL)
+        return NULL;
+    sink->queue = calloc(depth, sizeof(struct rx888_block *));
+    sink->batch = calloc(depth, sizeof(struct rx888_block *));
+    if (sink->queue == NULL || sink->batch == NULL) {
+        free(sink->queue);
+        free(sink->batch);
+        free(sink);
+        return NULL;
+    }
+    sink->dev = dev;
+    sink->name = name;
+    sink->fn = fn;
+    sink->batch_fn = batch_fn;
+    sink->ctx = ctx;
+    sink->depth = depth;
+    pthread_mutex_init(&sink->lock, NULL);
+    pthread_cond_init(&sink->cond, NULL);
+
+    if (pthread_create(&sink->thread, NULL, sink_thread, sink) != 0) {
+        fprintf(stderr, "Could not start %s sink thread\n", name);
+        pthread_cond_destroy(&sink->cond);
+        pthread_mutex_destroy(&sink->lock);
+        free(sink->queue);
+        free(sink->batch);
+        free(sink);
+        return NULL;
+    }
+    return sink;
+}
+
+struct sink *sink_start(rx888_t *dev, const char *name, rx888_callback fn,
+                        void *ctx, unsigned int depth) {
+    return sink_create(dev, name, fn, NULL, ctx, depth);
+}
+
+struct sink *sink_start_batch(rx888_t *dev, const char *name, sink_batch_fn fn,
+                              void *ctx, unsigned int depth) {
+    return sink_create(dev, name, NULL, fn, ctx, depth);
+}
+
+void sink_stop(struct sink *sink) {
+    if (sink == NULL)
+        return;
+
+    pthread_mutex_lock(&sink->lock);
+    sink->stop = true;
+    pthread_cond_signal(&sink->cond);
+    pthread_mutex_unlock(&sink->lock);
+    pthread_join(sink->thread, NULL);
+
+    pthread_cond_destroy(&sink->cond);
+    pthread_mutex_destroy(&sink->lock);
+    free(sink->queue);
+    free(sink->batch);
+    free(sink);
+}
+
+int sink_push(struct sink *sink, struct rx888_block *block) {
+    pthread_mutex_lock(&sink->lock);
+    if (sink->count + sink->busy >= sink->depth) {
+        sink->stats.dropped++;
+        RX888_PROBE2(sink_drop, sink->name, block->seq);
+        pthread_mutex_unlock(&sink->lock);
+        return -1;
+    }
+    rx888_block_ref(sink->dev, block);
+    sink->queue[(sink->head + sink->count) % sink->depth] = block;
+    sink->count++;
+    if (sink->count > sink->stats.max_lag)
+        sink->stats.max_lag = sink->count;
+    pthread_cond_signal(&sink->cond);
+    pthread_mutex_unlock(&sink->lock);
+    return 0;
+}
+
+const char *sink_name(const struct sink *sink) {
+    return sink->name;
+}
+
+void sink_get_stats(struct sink *sink, struct sink_stats *stats) {
+    pthread_mutex_lock(&sink->lock);
+    *stats = sink->stats;
+    stats->lag = sink->count;
+    pthread_mutex_unlock(&sink->lock);
+}
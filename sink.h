@@ -0,0 +1,87 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#ifndef SINK_H
+#define SINK_H
+
+#include "librx888.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A sink consumes blocks on its own thread. sink_push() hands it a
+ * reference to a block instead of a copy, so any number of sinks can
+ * share one transfer buffer; the buffer goes back to the device once
+ * every sink has released it. A sink holding depth blocks, queued or in
+ * its handler, loses the next ones; the other sinks and the device do
+ * not, as long as depth leaves the device some of the transfer pool.
+ */
+
+struct sink;
+
+struct sink_stats {
+    uint64_t blocks;      // blocks processed
+    uint64_t batches;     // handler calls, one per block unless batched
+    unsigned int max_batch; // most blocks handed over in one call
+    uint64_t dropped;     // blocks skipped: queue full, or the handler failed
+    unsigned int lag;     // blocks queued right now
+    unsigned int max_lag; // most blocks ever queued
+    uint64_t cpu_ns;      // CPU time used by the sink thread
+};
+
+/*
+ * fn is called on the sink thread for every block, see rx888_callback:
+ * non-zero stops streaming, and the sink discards the blocks still queued.
+ */
+struct sink *sink_start(rx888_t *dev, const char *name, rx888_callback fn,
+                        void *ctx, unsigned int depth);
+
+/*
+ * Batch mode: fn gets every block queued when the thread wakes up, in
+ * order, in one call. A sink that keeps up sees batches of one; one that
+ * falls behind sees larger batches and spends fewer calls catching up.
+ */
+typedef int (*sink_batch_fn)(struct rx888_block **blocks, unsigned int n, void *ctx);
+
+struct sink *sink_start_batch(rx888_t *dev, const char *name, sink_batch_fn fn,
+                              void *ctx, unsigned int depth);
+
+// Process the remaining queued blocks, then stop the thread
+void sink_stop(struct sink *sink);
+
+// Queue a reference to block; returns -1 if it had to be dropped
+int sink_push(struct sink *sink, struct rx888_block *block);
+
+const char *sink_name(const struct sink *sink);
+void sink_get_stats(struct sink *sink, struct sink_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,428 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "sweep.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SWEEP_EVENTS 16       // retunes sent that sweep_block() has not reached yet
+#define SWEEP_MAX_FREQS 65536
+
+struct retune {
+    uint64_t freq;
+    uint64_t start; // stream index at the moment the retune was sent
+};
+
+struct sweep {
+    rx888_t *dev;
+    struct sweep_config cfg;
+    double samplerate;
+    uint64_t block_samples;
+    pthread_t thread;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool stop;
+    // Position after the last block fed in and its completion time: the control thread's clock
+    uint64_t pos;
+    uint64_t pos_ns;
+    struct retune events[SWEEP_EVENTS];
+    unsigned int head;
+    unsigned int count;
+    uint64_t settle; // samples; 0 while calibrating, written by sweep_block()
+    struct sweep_stats stats;
+
+    // sweep_block() side
+    bool active; // cur is a dwell
+    struct retune cur;
+    bool calibrating; // cur only measures
+    bool started;     // cur has had a span
+    uint64_t kept;
+    uint64_t measured;
+    size_t settle_windows; // longest measured
+    double *power;         // sum of squares per window of cur
+    double *sorted;
+    size_t max_windows;
+};
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int parse_freq(const char *s, double *hz) {
+    char *end;
+    double v = strtod(s, &end);
+
+    if (end == s)
+        return -1;
+    if (*end == 'k' || *end == 'K')
+        v *= 1e3, end++;
+    else if (*end == 'M')
+        v *= 1e6, end++;
+    else if (*end == 'G')
+        v *= 1e9, end++;
+    if (*end != '\0' || !(v > 0) || v > 1e10)
+        return -1;
+    *hz = v;
+    return 0;
+}
+
+static int add_freq(uint64_t **freqs, unsigned int *count, double hz) {
+    if (*count == SWEEP_MAX_FREQS)
+        return -1;
+    if ((*count & (*count - 1)) == 0) {
+        uint64_t *f = realloc(*freqs, (*count ? *count * 2 : 1) * sizeof(**freqs));
+        if (f == NULL)
+            return -1;
+        *freqs = f;
+    }
+    (*freqs)[(*count)++] = (uint64_t)llround(hz);
+    return 0;
+}
+
+unsigned int sweep_parse(const char *spec, uint64_t **freqs) {
+    char *copy = strdup(spec), *save = NULL;
+    unsigned int count = 0;
+
+    *freqs = NULL;
+    if (copy == NULL)
+        return 0;
+    for (char *tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *parts[3];
+        unsigned int n = 0;
+        double v[3];
+
+        for (char *p = tok; n < 3; n++) {
+            parts[n] = p;
+            p = strchr(p, ':');
+            if (p == NULL) {
+                n++;
+                break;
+            }
+            *p++ = '\0';
+        }
+        if ((n != 1 && n != 3) || strchr(parts[n - 1], ':'))
+            goto fail;
+        for (unsigned int i = 0; i < n; i++) {
+            if (parse_freq(parts[i], &v[i]) != 0)
+                goto fail;
+        }
+        if (n == 1) {
+            if (add_freq(freqs, &count, v[0]) != 0)
+                goto fail;
+            continue;
+        }
+        if (v[1] < v[0])
+            goto fail;
+        // Steps from START, STOP included when it falls on one
+        uint64_t steps = (uint64_t)((v[1] - v[0]) / v[2] + 1e-9);
+        for (uint64_t i = 0; i <= steps; i++) {
+            if (add_freq(freqs, &count, v[0] + i * v[2]) != 0)
+                goto fail;
+        }
+    }
+    free(copy);
+    return count;
+
+fail:
+    free(copy);
+    free(*freqs);
+    *freqs = NULL;
+    return 0;
+}
+
+// Stream index at time t, extrapolated from the last block; called locked
+static uint64_t stream_at(const struct sweep *sw, uint64_t t) {
+    if (t <= sw->pos_ns)
+        return sw->pos;
+    return sw->pos + (uint64_t)((t - sw->pos_ns) * sw->samplerate / 1e9);
+}
+
+/*
+ * Control thread: sleeps until the current dwell is over by the sample
+ * clock, then sends the next retune. The blocks only move the clock, so
+ * the thread is never behind a sink.
+ */
+static void *sweep_thread(void *arg) {
+    struct sweep *sw = arg;
+    uint64_t due = 0;
+
+    pthread_mutex_lock(&sw->lock);
+    while (!sw->stop && sw->pos_ns == 0)
+        pthread_cond_wait(&sw->cond, &sw->lock);
+
+    for (unsigned int k = 0; !sw->stop; k = (k + 1) % sw->cfg.count) {
+        for (;;) {
+            if (sw->stop)
+                goto out;
+            uint64_t now = mono_ns(), at = stream_at(sw, now);
+            if (sw->count == SWEEP_EVENTS) {
+                pthread_cond_wait(&sw->cond, &sw->lock);
+            } else if (at < due) {
+                uint64_t wake = now + (uint64_t)((due - at) * 1e9 / sw->samplerate);
+                struct timespec ts = {.tv_sec = wake / 1000000000ULL,
+                                      .tv_nsec = wake % 1000000000ULL};
+                pthread_cond_timedwait(&sw->cond, &sw->lock, &ts);
+            } else {
+                break;
+            }
+        }
+
+        uint64_t t0 = mono_ns();
+        struct retune r = {.freq = sw->cfg.freqs[k], .start = stream_at(sw, t0)};
+        if (due && r.start >= due + sw->block_samples)
+            sw->stats.late++;
+        pthread_mutex_unlock(&sw->lock);
+        int ret = rx888_tune(sw->dev, r.freq);
+        uint64_t took = mono_ns() - t0;
+        pthread_mutex_lock(&sw->lock);
+
+        if (ret != RX888_OK) {
+            fprintf(stderr, "Retune to %llu Hz failed, VHF sweep stopped\n",
+                    (unsigned long long)r.freq);
+            break;
+        }
+        sw->stats.retunes++;
+        sw->stats.tune_ns_sum += took;
+        if (took > sw->stats.tune_ns_max)
+            sw->stats.tune_ns_max = took;
+        sw->events[(sw->head + sw->count) % SWEEP_EVENTS] = r;
+        sw->count++;
+        due = r.start + sw->settle + sw->cfg.dwell;
+    }
+out:
+    pthread_mutex_unlock(&sw->lock);
+    return NULL;
+}
+
+struct sweep *sweep_start(rx888_t *dev, const struct sweep_config *cfg) {
+    struct sweep *sw;
+    pthread_condattr_t attr;
+
+    if (cfg->count == 0 || cfg->dwell == 0 || cfg->calibrate == 0)
+        return NULL;
+    sw = calloc(1, sizeof(*sw));
+    if (sw == NULL)
+        return NULL;
+    sw->dev = dev;
+    sw->cfg = *cfg;
+    sw->samplerate = rx888_samplerate(dev);
+    sw->block_samples = rx888_block_size(dev) / sizeof(int16_t);
+    // Calibration dwells run a little over when a retune is late
+    sw->max_windows = 2 * cfg->dwell / SWEEP_WINDOW + 2;
+    sw->cfg.freqs = malloc(cfg->count * sizeof(*cfg->freqs));
+    sw->power = calloc(sw->max_windows, sizeof(*sw->power));
+    sw->sorted = malloc(sw->max_windows * sizeof(*sw->sorted));
+    if (sw->cfg.freqs == NULL || sw->power == NULL || sw->sorted == NULL)
+        goto fail;
+    memcpy((uint64_t *)sw->cfg.freqs, cfg->freqs, cfg->count * sizeof(*cfg->freqs));
+
+    pthread_mutex_init(&sw->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sw->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&sw->thread, NULL, sweep_thread, sw) != 0) {
+        pthread_cond_destroy(&sw->cond);
+        pthread_mutex_destroy(&sw->lock);
+        goto fail;
+    }
+    return sw;
+
+fail:
+    free((uint64_t *)sw->cfg.freqs);
+    free(sw->power);
+    free(sw->sorted);
+    free(sw);
+    return NULL;
+}
+
+void sweep_stop(struct sweep *sw) {
+    if (sw == NULL)
+        return;
+    pthread_mutex_lock(&sw->lock);
+    sw->stop = true;
+    pthread_cond_broadcast(&sw->cond);
+    pthread_mutex_unlock(&sw->lock);
+    pthread_join(sw->thread, NULL);
+    pthread_cond_destroy(&sw->cond);
+    pthread_mutex_destroy(&sw->lock);
+    free((uint64_t *)sw->cfg.freqs);
+    free(sw->power);
+    free(sw->sorted);
+    free(sw);
+}
+
+void sweep_get_stats(struct sweep *sw, struct sweep_stats *stats) {
+    pthread_mutex_lock(&sw->lock);
+    *stats = sw->stats;
+    pthread_mutex_unlock(&sw->lock);
+}
+
+static double power_db(double sum) {
+    return 10 * log10(sum / SWEEP_WINDOW + 1e-3);
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Add samples s[i, end) of a calibration dwell to its window powers
+static void measure(struct sweep *sw, const int16_t *s, uint64_t base, size_t i, size_t end) {
+    while (i < end) {
+        uint64_t rel = base + i - sw->cur.start;
+        size_t w = rel / SWEEP_WINDOW;
+        if (w >= sw->max_windows)
+            return;
+        size_t stop = i + (SWEEP_WINDOW - rel % SWEEP_WINDOW);
+        if (stop > end)
+            stop = end;
+        double acc = 0;
+        for (; i < stop; i++)
+            acc += (double)s[i] * s[i];
+        sw->power[w] += acc;
+    }
+}
+
+/*
+ * A calibration dwell ended at stream index end: it settled after the
+ * last window of its first half whose power is off the median of its
+ * second half by more than SWEEP_SETTLE_DB.
+ */
+static void calibrated(struct sweep *sw, uint64_t end) {
+    size_t n = (end - sw->cur.start) / SWEEP_WINDOW;
+
+    if (n > sw->max_windows)
+        n = sw->max_windows;
+    // The first dwell also holds whatever the start of streaming did
+    if (++sw->measured > 1 && n >= 4) {
+        size_t half = n / 2, settled = 0;
+        for (size_t w = half; w < n; w++)
+            sw->sorted[w - half] = power_db(sw->power[w]);
+        qsort(sw->sorted, n - half, sizeof(*sw->sorted), compare_double);
+        double level = sw->sorted[(n - half) / 2];
+        for (size_t w = 0; w < half; w++) {
+            if (fabs(power_db(sw->power[w]) - level) > SWEEP_SETTLE_DB)
+                settled = w + 1;
+        }
+        if (settled > sw->settle_windows)
+            sw->settle_windows = settled;
+    }
+    if (sw->measured < (uint64_t)sw->cfg.count * sw->cfg.calibrate + 1)
+        return;
+
+    uint64_t settle = (sw->settle_windows + 1) * SWEEP_WINDOW;
+    pthread_mutex_lock(&sw->lock);
+    sw->settle = settle;
+    sw->stats.settle = settle;
+    pthread_mutex_unlock(&sw->lock);
+    fprintf(stderr, "VHF sweep: settle time measured at %.1f us, keeping dwells from here\n",
+            settle * 1e6 / sw->samplerate);
+}
+
+unsigned int sweep_block(struct sweep *sw, const struct rx888_block *block,
+                         struct sweep_span *spans, unsigned int max) {
+    const int16_t *s = (const int16_t *)block->data;
+    size_t n = block->length / sizeof(int16_t);
+    uint64_t base = block->sample_index;
+    unsigned int nspans = 0;
+
+    pthread_mutex_lock(&sw->lock);
+    sw->pos = base + n;
+    sw->pos_ns = block->time_ns;
+    pthread_cond_signal(&sw->cond);
+    pthread_mutex_unlock(&sw->lock);
+
+    for (size_t i = 0; i < n;) {
+        struct retune next;
+        bool have;
+
+        pthread_mutex_lock(&sw->lock);
+        have = sw->count > 0 && sw->events[sw->head].start < base + n;
+        if (have)
+            next = sw->events[sw->head];
+        pthread_mutex_unlock(&sw->lock);
+
+        // Up to the next retune, which may already be behind us
+        size_t end = n;
+        if (have)
+            end = next.start > base + i ? next.start - base : i;
+
+        if (sw->active && end > i) {
+            if (sw->calibrating) {
+                measure(sw, s, base, i, end);
+            } else {
+                uint64_t from = sw->cur.start + sw->settle;
+                size_t first = from > base + i ? from - base : i;
+                if (first < end && nspans < max) {
+                    bool opening = !sw->started;
+                    if (opening) {
+                        sw->started = true;
+                        pthread_mutex_lock(&sw->lock);
+                        sw->stats.dwells = ++sw->kept;
+                        pthread_mutex_unlock(&sw->lock);
+                    }
+                    spans[nspans++] = (struct sweep_span){
+                        .freq = sw->cur.freq,
+                        .dwell = sw->kept - 1,
+                        .sample_index = base + first,
+                        .offset = first,
+                        .count = end - first,
+                        .first = opening,
+                    };
+                }
+            }
+        }
+        i = end;
+        if (!have)
+            break;
+
+        pthread_mutex_lock(&sw->lock);
+        sw->head = (sw->head + 1) % SWEEP_EVENTS;
+        sw->count--;
+        pthread_cond_signal(&sw->cond);
+        pthread_mutex_unlock(&sw->lock);
+
+        if (sw->active && sw->calibrating)
+            calibrated(sw, base + i);
+        sw->cur = next;
+        if (sw->cur.start < base + i)
+            sw->cur.start = base + i;
+        sw->active = true;
+        sw->calibrating = sw->settle == 0;
+        sw->started = false;
+        if (sw->calibrating)
+            memset(sw->power, 0, sw->max_windows * sizeof(*sw->power));
+    }
+    return nspans;
+}
@@ -0,0 +1,111 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "librx888.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * VHF sweep: steps the R82XX tuner through a list of frequencies,
+ * dwelling on each for a fixed number of samples after it has settled.
+ * Retunes are sent from a control thread timed off the sample clock, so
+ * the stream and its sinks never wait on a control transfer and a slow
+ * sink does not stretch the dwells. sweep_block() then cuts every block
+ * into the settled part of each dwell, tagged with its frequency.
+ *
+ * The settle time is measured, not configured: the first passes over
+ * the list keep nothing and record, for every dwell, how long the signal
+ * power took to come within SWEEP_SETTLE_DB of its level over the second
+ * half of the dwell. The longest of those, plus a window, is discarded
+ * after every retune from then on. It counts from the retune being sent,
+ * so it includes the command latency.
+ */
+struct sweep;
+
+#define SWEEP_SETTLE_DB 1.0   // power within this of the settled level
+#define SWEEP_WINDOW 1024     // samples per power measurement
+#define SWEEP_SPANS 16        // most spans sweep_block() returns for one block
+
+struct sweep_config {
+    const uint64_t *freqs;  // tuner frequencies in Hz, swept in order and repeated
+    unsigned int count;
+    uint64_t dwell;         // samples kept per dwell; calibration dwells are this long in all
+    unsigned int calibrate; // passes over the list that measure the settle time, at least 1
+};
+
+// Samples of one block kept for a dwell
+struct sweep_span {
+    uint64_t freq;
+    uint64_t dwell;        // kept dwells counted from 0
+    uint64_t sample_index; // stream index of the first sample
+    size_t offset;         // first sample in the block
+    size_t count;
+    int first;             // the dwell starts with this span
+};
+
+struct sweep_stats {
+    uint64_t retunes;
+    uint64_t dwells;      // dwells kept samples
+    uint64_t settle;      // samples discarded after a retune, 0 while calibrating
+    uint64_t tune_ns_max; // longest retune command
+    uint64_t tune_ns_sum;
+    uint64_t late;        // retunes sent a block or more after their dwell was due to end
+};
+
+/*
+ * Parse a frequency list: comma separated frequencies in Hz with an
+ * optional k, M or G suffix, and START:STOP:STEP ranges. Returns the
+ * count, 0 on a parse error, and a malloc()ed array in *freqs.
+ */
+unsigned int sweep_parse(const char *spec, uint64_t **freqs);
+
+// The device must be streaming in VHF mode; the first retune waits for the first block
+struct sweep *sweep_start(rx888_t *dev, const struct sweep_config *cfg);
+
+/*
+ * Feed every block, in order, from one thread. Fills at most max spans
+ * (SWEEP_SPANS is enough for dwells longer than a block) and returns how
+ * many; a block may have none.
+ */
+unsigned int sweep_block(struct sweep *sw, const struct rx888_block *block,
+                         struct sweep_span *spans, unsigned int max);
+
+void sweep_get_stats(struct sweep *sw, struct sweep_stats *stats);
+
+// Stop the control thread and free the sweep
+void sweep_stop(struct sweep *sw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,163 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#define _GNU_SOURCE
+#include "trace.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct trace_event {
+    uint64_t ts_ns;
+    uint64_t seq;
+    const char *name;
+    char phase;
+};
+
+struct trace_ring {
+    struct trace_ring *next;
+    const char *name;
+    pid_t tid;
+    atomic_uint_fast64_t head; // events ever written, only the owner stores
+    struct trace_event events[];
+};
+
+bool trace_on;
+
+static unsigned int ring_size;
+static _Atomic(struct trace_ring *) rings;
+static __thread struct trace_ring *ring;
+
+int trace_init(unsigned int events_per_thread) {
+    if (events_per_thread == 0)
+        return -1;
+    ring_size = events_per_thread;
+    trace_on = true;
+    return 0;
+}
+
+// First event on a thread: allocate its ring and publish it for the exporter
+static struct trace_ring *ring_create(void) {
+    struct trace_ring *r = calloc(1, sizeof(*r) + ring_size * sizeof(struct trace_event));
+    if (r == NULL)
+        return NULL;
+    r->tid = gettid();
+    r->next = atomic_load(&rings);
+    while (!atomic_compare_exchange_weak(&rings, &r->next, r))
+        ;
+    return r;
+}
+
+void trace_thread_name(const char *name) {
+    if (!trace_on)
+        return;
+    if (ring == NULL && (ring = ring_create()) == NULL)
+        return;
+    ring->name = name;
+}
+
+void trace_record(const char *name, char phase, uint64_t seq) {
+    struct timespec ts;
+
+    if (ring == NULL && (ring = ring_create()) == NULL)
+        return;
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    struct trace_event *e = &ring->events[head % ring_size];
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    e->ts_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    e->seq = seq;
+    e->name = name;
+    e->phase = phase;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/*
+ * Copy a ring out. The owner may lap the copy while it runs, so events
+ * that could have been overwritten are dropped afterwards.
+ */
+static uint64_t ring_snapshot(struct trace_ring *r, struct trace_event *out) {
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    uint64_t first = head > ring_size ? head - ring_size : 0;
+
+    for (uint64_t i = first; i < head; i++)
+        out[i - first] = r->events[i % ring_size];
+    uint64_t now = atomic_load_explicit(&r->head, memory_order_acquire);
+    uint64_t valid = now > ring_size ? now - ring_size : 0;
+    if (valid <= first)
+        return head - first;
+    if (valid >= head)
+        return 0;
+    memmove(out, out + (valid - first), (head - valid) * sizeof(*out));
+    return head - valid;
+}
+
+int trace_export(const char *path) {
+    struct trace_event *events;
+    const char *sep = "";
+    pid_t pid = getpid();
+    FILE *f;
+
+    if (!trace_on)
+        return 0;
+    events = malloc(ring_size * sizeof(*events));
+    if (events == NULL)
+        return -1;
+    f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        free(events);
+        return -1;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (struct trace_ring *r = atomic_load(&rings); r != NULL; r = r->next) {
+        if (r->name) {
+            fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"name\":\"%s\"}}", sep, pid, r->tid, r->name);
+            sep = ",";
+        }
+        uint64_t n = ring_snapshot(r, events);
+        for (uint64_t i = 0; i < n; i++) {
+            const struct trace_event *e = &events[i];
+            fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d,",
+                    sep, e->name, e->phase, e->ts_ns / 1e3, pid, r->tid);
+            if (e->phase == 'i')
+                fprintf(f, "\"s\":\"t\",");
+            fprintf(f, "\"args\":{\"seq\":%llu}}", (unsigned long long)e->seq);
+            sep = ",";
+        }
+    }
+    fprintf(f, "\n]}\n");
+    free(events);
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Error writing %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
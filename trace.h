@@ -0,0 +1,79 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Pipeline tracing. Every thread records events into a ring of its own,
+ * with no locks and no shared cache lines on the hot path; the rings keep
+ * the most recent events and are exported as Chrome trace JSON, which
+ * chrome://tracing and ui.perfetto.dev load. Names must be string
+ * literals or otherwise outlive the export. With tracing off a trace
+ * call costs one predictable branch.
+ */
+
+extern bool trace_on;
+
+// Enable tracing, keeping the last events_per_thread events of each thread
+int trace_init(unsigned int events_per_thread);
+
+// Name the calling thread in the exported trace
+void trace_thread_name(const char *name);
+
+void trace_record(const char *name, char phase, uint64_t seq);
+
+// Span of work on a block, seq identifies the block
+static inline void trace_begin(const char *name, uint64_t seq) {
+    if (trace_on)
+        trace_record(name, 'B', seq);
+}
+
+static inline void trace_end(const char *name, uint64_t seq) {
+    if (trace_on)
+        trace_record(name, 'E', seq);
+}
+
+// Point event
+static inline void trace_instant(const char *name, uint64_t seq) {
+    if (trace_on)
+        trace_record(name, 'i', seq);
+}
+
+// Write every thread's events to path; safe while the threads keep tracing
+int trace_export(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,55 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "usb.h"
+
+const struct usb_ops usb_libusb = {
+    .name = "libusb",
+    .init = libusb_init,
+    .exit = libusb_exit,
+    .get_device_list = libusb_get_device_list,
+    .free_device_list = libusb_free_device_list,
+    .get_device_descriptor = libusb_get_device_descriptor,
+    .open = libusb_open,
+    .close = libusb_close,
+    .get_device = libusb_get_device,
+    .get_config_descriptor = libusb_get_config_descriptor,
+    .free_config_descriptor = libusb_free_config_descriptor,
+    .get_ss_endpoint_companion_descriptor = libusb_get_ss_endpoint_companion_descriptor,
+    .free_ss_endpoint_companion_descriptor = libusb_free_ss_endpoint_companion_descriptor,
+    .kernel_driver_active = libusb_kernel_driver_active,
+    .detach_kernel_driver = libusb_detach_kernel_driver,
+    .claim_interface = libusb_claim_interface,
+    .release_interface = libusb_release_interface,
+    .control_transfer = libusb_control_transfer,
+    .alloc_transfer = libusb_alloc_transfer,
+    .free_transfer = libusb_free_transfer,
+    .submit_transfer = libusb_submit_transfer,
+    .cancel_transfer = libusb_cancel_transfer,
+    .handle_events = libusb_handle_events,
+    .handle_events_timeout = libusb_handle_events_timeout,
+};
+
+const struct usb_ops *usb = &usb_libusb;
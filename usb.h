@@ -0,0 +1,120 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#ifndef USB_H
+#define USB_H
+
+#include <stdint.h>
+#include <libusb.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The libusb calls the streaming core makes, behind a table so a
+ * simulated device can stand in for the real one. Signatures and return
+ * codes are libusb's; transfers are filled with libusb_fill_*() as usual.
+ */
+struct usb_ops {
+    const char *name;
+    int (*init)(libusb_context **ctx);
+    void (*exit)(libusb_context *ctx);
+    ssize_t (*get_device_list)(libusb_context *ctx, libusb_device ***list);
+    void (*free_device_list)(libusb_device **list, int unref_devices);
+    int (*get_device_descriptor)(libusb_device *dev, struct libusb_device_descriptor *desc);
+    int (*open)(libusb_device *dev, libusb_device_handle **handle);
+    void (*close)(libusb_device_handle *handle);
+    libusb_device *(*get_device)(libusb_device_handle *handle);
+    int (*get_config_descriptor)(libusb_device *dev, uint8_t index,
+                                 struct libusb_config_descriptor **config);
+    void (*free_config_descriptor)(struct libusb_config_descriptor *config);
+    int (*get_ss_endpoint_companion_descriptor)(
+        libusb_context *ctx, const struct libusb_endpoint_descriptor *endpoint,
+        struct libusb_ss_endpoint_companion_descriptor **ep_comp);
+    void (*free_ss_endpoint_companion_descriptor)(
+        struct libusb_ss_endpoint_companion_descriptor *ep_comp);
+    int (*kernel_driver_active)(libusb_device_handle *handle, int interface_number);
+    int (*detach_kernel_driver)(libusb_device_handle *handle, int interface_number);
+    int (*claim_interface)(libusb_device_handle *handle, int interface_number);
+    int (*release_interface)(libusb_device_handle *handle, int interface_number);
+    int (*control_transfer)(libusb_device_handle *handle, uint8_t request_type,
+                            uint8_t request, uint16_t value, uint16_t index,
+                            unsigned char *data, uint16_t length, unsigned int timeout);
+    struct libusb_transfer *(*alloc_transfer)(int iso_packets);
+    void (*free_transfer)(struct libusb_transfer *transfer);
+    int (*submit_transfer)(struct libusb_transfer *transfer);
+    int (*cancel_transfer)(struct libusb_transfer *transfer);
+    int (*handle_events)(libusb_context *ctx);
+    int (*handle_events_timeout)(libusb_context *ctx, struct timeval *tv);
+};
+
+// Backend in use, &usb_libusb unless a simulated device was selected
+extern const struct usb_ops *usb;
+
+extern const struct usb_ops usb_libusb;
+
+/*
+ * Simulated FX3 (usb_sim.c): enumerates in bootloader mode, takes a
+ * firmware upload and re-enumerates with the SDDC firmware PID, answers
+ * the vendor requests and streams a sample counter ramp (randomized if
+ * the RAND GPIO is set) at the rate set with STARTADC.
+ */
+struct usb_sim_config {
+    int boot;            // start in bootloader mode, default 1
+    double speed;        // 1.0 paces bulk data in real time, 0 as fast as possible
+    unsigned int stall;  // every Nth bulk transfer completes with STALL, 0 never
+    unsigned int error;  // every Nth with ERROR
+    unsigned int shortx; // every Nth is a short transfer
+    unsigned int pause;  // every Nth, the device stops streaming for pause_ms...
+    unsigned int pause_ms;
+};
+
+struct usb_sim_stats {
+    uint64_t transfers;    // bulk transfers completed, any status
+    uint64_t stalls;
+    uint64_t errors;
+    uint64_t shorts;
+    uint64_t pauses;
+    uint64_t lost_samples; // samples the FX3 dropped with no transfer submitted
+    uint64_t fw_bytes;     // firmware bytes uploaded
+};
+
+/*
+ * Parse "key=value,..." with keys boot, speed, stall, error, short and
+ * pause=N:MS into cfg, after setting the defaults. Returns 0 or -1.
+ */
+int usb_sim_parse(struct usb_sim_config *cfg, const char *spec);
+
+// Reset the simulated device to cfg and return its backend.
+const struct usb_ops *usb_sim_init(const struct usb_sim_config *cfg);
+
+void usb_sim_get_stats(struct usb_sim_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,646 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+/*
+ * Simulated FX3 behind the usb_ops table, for exercising bring-up,
+ * streaming and error recovery without hardware. One device, one
+ * handle; bulk transfers are completed by a device thread and their
+ * callbacks run from handle_events, as with libusb.
+ */
+
+#include "usb.h"
+#include "rx888.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SIM_VID 0x04b4
+#define SIM_PID_BOOT 0x00f3
+#define SIM_PID_STREAM 0x00f1
+#define SIM_RW_INTERNAL 0xA0 // bootloader RAM access, as in ezusb.c
+#define SIM_FW_CHUNK 4096
+#define SIM_QUEUE 256        // bulk transfers the host controller holds at once
+#define SIM_ARGS 16
+
+static struct {
+    struct usb_sim_config cfg;
+    pthread_mutex_t lock;
+    pthread_cond_t completed_cond; // handle_events: completions waiting
+    pthread_cond_t wake;           // device thread: something to do
+    pthread_t thread;
+    bool running;
+    bool quit;
+
+    bool boot; // enumerated with the bootloader PID
+    bool open;
+    bool streaming;
+    uint32_t samplerate;
+    uint32_t gpio;
+    uint16_t args[SIM_ARGS];
+    uint64_t sample; // ramp value of the next sample
+
+    // Last firmware chunk written, read back by the loader to verify it
+    unsigned char fw_chunk[SIM_FW_CHUNK];
+    uint32_t fw_addr;
+    uint16_t fw_len;
+
+    struct libusb_transfer *submitted[SIM_QUEUE];
+    unsigned int submitted_head;
+    unsigned int submitted_count;
+    struct libusb_transfer *completed[SIM_QUEUE];
+    unsigned int completed_head;
+    unsigned int completed_count;
+
+    struct usb_sim_stats stats;
+
+    // Their addresses stand in for the opaque libusb objects
+    char device;
+    char handle;
+} sim = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .completed_cond = PTHREAD_COND_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+#define SIM_DEVICE ((libusb_device *)&sim.device)
+#define SIM_HANDLE ((libusb_device_handle *)&sim.handle)
+
+static const struct libusb_endpoint_descriptor sim_endpoint = {
+    .bLength = 7,
+    .bDescriptorType = 5,
+    .bEndpointAddress = 1 | LIBUSB_ENDPOINT_IN,
+    .bmAttributes = 2, // bulk
+    .wMaxPacketSize = 1024,
+};
+
+static const struct libusb_interface_descriptor sim_altsetting = {
+    .bNumEndpoints = 1,
+    .endpoint = &sim_endpoint,
+};
+
+static const struct libusb_interface sim_interface = {
+    .altsetting = &sim_altsetting,
+    .num_altsetting = 1,
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t t) {
+    struct timespec ts = {.tv_sec = t / 1000000000ULL, .tv_nsec = t % 1000000000ULL};
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+static uint32_t get_u32(const unsigned char *data, uint16_t length) {
+    uint32_t v = 0;
+    if (data && length >= sizeof(v))
+        memcpy(&v, data, sizeof(v));
+    return v;
+}
+
+// Called with the lock held
+static void complete(struct libusb_transfer *transfer) {
+    sim.completed[(sim.completed_head + sim.completed_count) % SIM_QUEUE] = transfer;
+    sim.completed_count++;
+    pthread_cond_signal(&sim.completed_cond);
+}
+
+// Sample counter ramp, through the ADC randomizer if it is enabled
+static void fill(int16_t *samples, size_t n, uint64_t first, bool randomize) {
+    for (size_t i = 0; i < n; i++) {
+        uint16_t v = (uint16_t)(first + i);
+        if (randomize && (v & 1))
+            v ^= 0xfffe;
+        samples[i] = (int16_t)v;
+    }
+}
+
+/*
+ * The GPIF engine: one transfer's worth of samples every period. With no
+ * transfer submitted the FX3 has nowhere to put them and they are lost.
+ */
+static void *sim_device(void *arg) {
+    uint64_t t = now_ns();
+    size_t length = 0;
+
+    (void)arg;
+    pthread_mutex_lock(&sim.lock);
+    while (!sim.quit) {
+        if (!sim.streaming || sim.samplerate == 0 ||
+            (sim.submitted_count == 0 && (sim.cfg.speed <= 0 || length == 0))) {
+            pthread_cond_wait(&sim.wake, &sim.lock);
+            t = now_ns();
+            continue;
+        }
+        if (sim.submitted_count > 0)
+            length = sim.submitted[sim.submitted_head]->length;
+        uint64_t n = length / sizeof(int16_t);
+
+        if (sim.cfg.speed > 0) {
+            t += (uint64_t)(n * 1e9 / (sim.samplerate * sim.cfg.speed));
+            pthread_mutex_unlock(&sim.lock);
+            sleep_until(t);
+            pthread_mutex_lock(&sim.lock);
+            if (!sim.streaming)
+                continue;
+        }
+        if (sim.submitted_count == 0) {
+            sim.stats.lost_samples += n;
+            sim.sample += n;
+            continue;
+        }
+
+        struct libusb_transfer *transfer = sim.submitted[sim.submitted_head];
+        sim.submitted_head = (sim.submitted_head + 1) % SIM_QUEUE;
+        sim.submitted_count--;
+        uint64_t seq = ++sim.stats.transfers;
+        uint64_t first = sim.sample;
+        bool randomize = sim.gpio & RANDO;
+
+        transfer->status = LIBUSB_TRANSFER_COMPLETED;
+        transfer->actual_length = transfer->length;
+        if (sim.cfg.stall && seq % sim.cfg.stall == 0) {
+            transfer->status = LIBUSB_TRANSFER_STALL;
+            transfer->actual_length = 0;
+            sim.stats.stalls++;
+        } else if (sim.cfg.error && seq % sim.cfg.error == 0) {
+            transfer->status = LIBUSB_TRANSFER_ERROR;
+            transfer->actual_length = 0;
+            sim.stats.errors++;
+        } else if (sim.cfg.shortx && seq % sim.cfg.shortx == 0) {
+            transfer->actual_length = (transfer->length / 2) & ~1;
+            sim.stats.shorts++;
+        }
+        // Samples of a failed transfer are gone like on the wire
+        sim.sample += transfer->status == LIBUSB_TRANSFER_COMPLETED
+                          ? transfer->actual_length / sizeof(int16_t)
+                          : n;
+
+        // Fill outside the lock, the transfer belongs to the device until completed
+        pthread_mutex_unlock(&sim.lock);
+        if (transfer->status == LIBUSB_TRANSFER_COMPLETED)
+            fill((int16_t *)transfer->buffer, transfer->actual_length / sizeof(int16_t),
+                 first, randomize);
+        pthread_mutex_lock(&sim.lock);
+        complete(transfer);
+
+        if (sim.cfg.pause && seq % sim.cfg.pause == 0) {
+            uint64_t lost = (uint64_t)sim.samplerate * sim.cfg.pause_ms / 1000;
+            sim.stats.pauses++;
+            pthread_mutex_unlock(&sim.lock);
+            sleep_until(now_ns() + sim.cfg.pause_ms * 1000000ULL);
+            pthread_mutex_lock(&sim.lock);
+            sim.stats.lost_samples += lost;
+            sim.sample += lost;
+            t = now_ns();
+        }
+    }
+    pthread_mutex_unlock(&sim.lock);
+    return NULL;
+}
+
+static int sim_init(libusb_context **ctx) {
+    if (ctx)
+        *ctx = NULL;
+    pthread_mutex_lock(&sim.lock);
+    sim.boot = sim.cfg.boot;
+    sim.open = false;
+    sim.streaming = false;
+    sim.samplerate = 0;
+    sim.gpio = 0;
+    sim.sample = 0;
+    sim.fw_len = 0;
+    sim.submitted_count = 0;
+    sim.completed_count = 0;
+    memset(&sim.stats, 0, sizeof(sim.stats));
+    sim.quit = false;
+    pthread_mutex_unlock(&sim.lock);
+
+    if (!sim.running) {
+        if (pthread_create(&sim.thread, NULL, sim_device, NULL) != 0)
+            return LIBUSB_ERROR_NO_MEM;
+        sim.running = true;
+    }
+    return LIBUSB_SUCCESS;
+}
+
+static void sim_exit(libusb_context *ctx) {
+    (void)ctx;
+    if (!sim.running)
+        return;
+    pthread_mutex_lock(&sim.lock);
+    sim.quit = true;
+    pthread_cond_signal(&sim.wake);
+    pthread_mutex_unlock(&sim.lock);
+    pthread_join(sim.thread, NULL);
+    sim.running = false;
+}
+
+static ssize_t sim_get_device_list(libusb_context *ctx, libusb_device ***list) {
+    (void)ctx;
+    *list = calloc(2, sizeof(libusb_device *));
+    if (*list == NULL)
+        return LIBUSB_ERROR_NO_MEM;
+    (*list)[0] = SIM_DEVICE;
+    return 1;
+}
+
+static void sim_free_device_list(libusb_device **list, int unref_devices) {
+    (void)unref_devices;
+    free(list);
+}
+
+static int sim_get_device_descriptor(libusb_device *dev, struct libusb_device_descriptor *desc) {
+    if (dev != SIM_DEVICE)
+        return LIBUSB_ERROR_NO_DEVICE;
+    memset(desc, 0, sizeof(*desc));
+    desc->bLength = 18;
+    desc->bDescriptorType = 1;
+    desc->bcdUSB = 0x0300;
+    desc->bMaxPacketSize0 = 9;
+    desc->idVendor = SIM_VID;
+    pthread_mutex_lock(&sim.lock);
+    desc->idProduct = sim.boot ? SIM_PID_BOOT : SIM_PID_STREAM;
+    pthread_mutex_unlock(&sim.lock);
+    desc->bNumConfigurations = 1;
+    return LIBUSB_SUCCESS;
+}
+
+static int sim_open(libusb_device *dev, libusb_device_handle **handle) {
+    if (dev != SIM_DEVICE)
+        return LIBUSB_ERROR_NO_DEVICE;
+    pthread_mutex_lock(&sim.lock);
+    sim.open = true;
+    pthread_mutex_unlock(&sim.lock);
+    *handle = SIM_HANDLE;
+    return LIBUSB_SUCCESS;
+}
+
+static void sim_close(libusb_device_handle *handle) {
+    (void)handle;
+    pthread_mutex_lock(&sim.lock);
+    sim.open = false;
+    pthread_mutex_unlock(&sim.lock);
+}
+
+static libusb_device *sim_get_device(libusb_device_handle *handle) {
+    return handle == SIM_HANDLE ? SIM_DEVICE : NULL;
+}
+
+static int sim_get_config_descriptor(libusb_device *dev, uint8_t index,
+                                     struct libusb_config_descriptor **config) {
+    if (dev != SIM_DEVICE || index != 0)
+        return LIBUSB_ERROR_NOT_FOUND;
+    *config = calloc(1, sizeof(**config));
+    if (*config == NULL)
+        return LIBUSB_ERROR_NO_MEM;
+    (*config)->bNumInterfaces = 1;
+    (*config)->interface = &sim_interface;
+    return LIBUSB_SUCCESS;
+}
+
+static void sim_free_config_descriptor(struct libusb_config_descriptor *config) {
+    free(config);
+}
+
+static int sim_get_ss_endpoint_companion_descriptor(
+    libusb_context *ctx, const struct libusb_endpoint_descriptor *endpoint,
+    struct libusb_ss_endpoint_companion_descriptor **ep_comp) {
+    (void)ctx;
+    if (endpoint != &sim_endpoint)
+        return LIBUSB_ERROR_NOT_FOUND;
+    *ep_comp = calloc(1, sizeof(**ep_comp));
+    if (*ep_comp == NULL)
+        return LIBUSB_ERROR_NO_MEM;
+    (*ep_comp)->bLength = 6;
+    (*ep_comp)->bDescriptorType = 48;
+    (*ep_comp)->bMaxBurst = 15;
+    return LIBUSB_SUCCESS;
+}
+
+static void sim_free_ss_endpoint_companion_descriptor(
+    struct libusb_ss_endpoint_companion_descriptor *ep_comp) {
+    free(ep_comp);
+}
+
+static int sim_kernel_driver_active(libusb_device_handle *handle, int interface_number) {
+    (void)handle;
+    (void)interface_number;
+    return 0;
+}
+
+static int sim_detach_kernel_driver(libusb_device_handle *handle, int interface_number) {
+    (void)handle;
+    (void)interface_number;
+    return LIBUSB_ERROR_NOT_FOUND;
+}
+
+static int sim_claim_interface(libusb_device_handle *handle, int interface_number) {
+    if (handle != SIM_HANDLE || interface_number != 0)
+        return LIBUSB_ERROR_NOT_FOUND;
+    return sim.boot ? LIBUSB_ERROR_NOT_FOUND : LIBUSB_SUCCESS;
+}
+
+static int sim_release_interface(libusb_device_handle *handle, int interface_number) {
+    (void)handle;
+    (void)interface_number;
+    return LIBUSB_SUCCESS;
+}
+
+// FX3 bootloader: RAM writes, read back, and the jump to the loaded image
+static int sim_bootloader(uint8_t request_type, uint8_t request, uint32_t addr,
+                          unsigned char *data, uint16_t length) {
+    if (request != SIM_RW_INTERNAL || length > SIM_FW_CHUNK)
+        return LIBUSB_ERROR_PIPE;
+
+    if (request_type & LIBUSB_ENDPOINT_IN) {
+        if (addr == sim.fw_addr && length <= sim.fw_len)
+            memcpy(data, sim.fw_chunk, length);
+        else
+            memset(data, 0, length);
+        return length;
+    }
+    if (length == 0) {
+        // Firmware starts and re-enumerates with the streaming PID
+        sim.boot = false;
+        sim.open = false;
+        return 0;
+    }
+    memcpy(sim.fw_chunk, data, length);
+    sim.fw_addr = addr;
+    sim.fw_len = length;
+    sim.stats.fw_bytes += length;
+    return length;
+}
+
+// SDDC firmware vendor requests, see FX3Command in rx888.h
+static int sim_firmware(uint8_t request_type, uint8_t request, uint16_t value,
+                        uint16_t index, unsigned char *data, uint16_t length) {
+    if (request_type & LIBUSB_ENDPOINT_IN) {
+        switch (request) {
+        case TESTFX3:
+        case I2CRFX3:
+            memset(data, 0, length);
+            return length;
+        case READINFODEBUG:
+            return 0;
+        default:
+            return LIBUSB_ERROR_PIPE;
+        }
+    }
+
+    switch (request) {
+    case STARTFX3:
+        sim.streaming = true;
+        pthread_cond_signal(&sim.wake);
+        break;
+    case STOPFX3:
+        sim.streaming = false;
+        break;
+    case GPIOFX3:
+        sim.gpio = get_u32(data, length);
+        break;
+    case STARTADC:
+        sim.samplerate = get_u32(data, length);
+        pthread_cond_signal(&sim.wake);
+        break;
+    case SETARGFX3:
+        if (index >= SIM_ARGS)
+            return LIBUSB_ERROR_PIPE;
+        sim.args[index] = value;
+        break;
+    case RESETFX3:
+        sim.boot = true;
+        sim.streaming = false;
+        sim.open = false;
+        break;
+    case I2CWFX3:
+    case TUNERINIT:
+    case TUNERTUNE:
+    case TUNERSTDBY:
+        break;
+    default:
+        return LIBUSB_ERROR_PIPE;
+    }
+    return length;
+}
+
+static int sim_control_transfer(libusb_device_handle *handle, uint8_t request_type,
+                                uint8_t request, uint16_t value, uint16_t index,
+                                unsigned char *data, uint16_t length, unsigned int timeout) {
+    int ret;
+
+    (void)timeout;
+    if (handle != SIM_HANDLE)
+        return LIBUSB_ERROR_NO_DEVICE;
+    pthread_mutex_lock(&sim.lock);
+    if (!sim.open)
+        ret = LIBUSB_ERROR_NO_DEVICE;
+    else if (sim.boot)
+        ret = sim_bootloader(request_type, request, value | (uint32_t)index << 16,
+                             data, length);
+    else
+        ret = sim_firmware(request_type, request, value, index, data, length);
+    pthread_mutex_unlock(&sim.lock);
+    return ret;
+}
+
+static struct libusb_transfer *sim_alloc_transfer(int iso_packets) {
+    if (iso_packets != 0)
+        return NULL;
+    return calloc(1, sizeof(struct libusb_transfer));
+}
+
+static void sim_free_transfer(struct libusb_transfer *transfer) {
+    free(transfer);
+}
+
+static int sim_submit_transfer(struct libusb_transfer *transfer) {
+    int ret = LIBUSB_SUCCESS;
+
+    pthread_mutex_lock(&sim.lock);
+    if (!sim.open || sim.boot || transfer->dev_handle != SIM_HANDLE) {
+        ret = LIBUSB_ERROR_NO_DEVICE;
+    } else if (transfer->endpoint != sim_endpoint.bEndpointAddress) {
+        ret = LIBUSB_ERROR_NOT_FOUND;
+    } else if (sim.submitted_count == SIM_QUEUE) {
+        ret = LIBUSB_ERROR_NO_MEM;
+    } else {
+        sim.submitted[(sim.submitted_head + sim.submitted_count) % SIM_QUEUE] = transfer;
+        sim.submitted_count++;
+        pthread_cond_signal(&sim.wake);
+    }
+    pthread_mutex_unlock(&sim.lock);
+    return ret;
+}
+
+static int sim_cancel_transfer(struct libusb_transfer *transfer) {
+    int ret = LIBUSB_ERROR_NOT_FOUND;
+
+    pthread_mutex_lock(&sim.lock);
+    for (unsigned int i = 0; i < sim.submitted_count; i++) {
+        unsigned int slot = (sim.submitted_head + i) % SIM_QUEUE;
+        if (sim.submitted[slot] != transfer)
+            continue;
+        // Close the gap, keeping the others in order
+        for (unsigned int j = i; j + 1 < sim.submitted_count; j++)
+            sim.submitted[(sim.submitted_head + j) % SIM_QUEUE] =
+                sim.submitted[(sim.submitted_head + j + 1) % SIM_QUEUE];
+        sim.submitted_count--;
+        transfer->status = LIBUSB_TRANSFER_CANCELLED;
+        transfer->actual_length = 0;
+        complete(transfer);
+        ret = LIBUSB_SUCCESS;
+        break;
+    }
+    pthread_mutex_unlock(&sim.lock);
+    return ret;
+}
+
+static int sim_handle_events_timeout(libusb_context *ctx, struct timeval *tv) {
+    struct libusb_transfer *done[SIM_QUEUE];
+    struct timespec deadline;
+    unsigned int n = 0;
+
+    (void)ctx;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += tv->tv_sec;
+    deadline.tv_nsec += tv->tv_usec * 1000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&sim.lock);
+    while (sim.completed_count == 0) {
+        if (pthread_cond_timedwait(&sim.completed_cond, &sim.lock, &deadline) != 0)
+            break;
+    }
+    while (sim.completed_count > 0) {
+        done[n++] = sim.completed[sim.completed_head];
+        sim.completed_head = (sim.completed_head + 1) % SIM_QUEUE;
+        sim.completed_count--;
+    }
+    pthread_mutex_unlock(&sim.lock);
+
+    for (unsigned int i = 0; i < n; i++)
+        done[i]->callback(done[i]);
+    return LIBUSB_SUCCESS;
+}
+
+static int sim_handle_events(libusb_context *ctx) {
+    struct timeval tv = {.tv_sec = 1};
+    return sim_handle_events_timeout(ctx, &tv);
+}
+
+static const struct usb_ops usb_sim = {
+    .name = "simulated FX3",
+    .init = sim_init,
+    .exit = sim_exit,
+    .get_device_list = sim_get_device_list,
+    .free_device_list = sim_free_device_list,
+    .get_device_descriptor = sim_get_device_descriptor,
+    .open = sim_open,
+    .close = sim_close,
+    .get_device = sim_get_device,
+    .get_config_descriptor = sim_get_config_descriptor,
+    .free_config_descriptor = sim_free_config_descriptor,
+    .get_ss_endpoint_companion_descriptor = sim_get_ss_endpoint_companion_descriptor,
+    .free_ss_endpoint_companion_descriptor = sim_free_ss_endpoint_companion_descriptor,
+    .kernel_driver_active = sim_kernel_driver_active,
+    .detach_kernel_driver = sim_detach_kernel_driver,
+    .claim_interface = sim_claim_interface,
+    .release_interface = sim_release_interface,
+    .control_transfer = sim_control_transfer,
+    .alloc_transfer = sim_alloc_transfer,
+    .free_transfer = sim_free_transfer,
+    .submit_transfer = sim_submit_transfer,
+    .cancel_transfer = sim_cancel_transfer,
+    .handle_events = sim_handle_events,
+    .handle_events_timeout = sim_handle_events_timeout,
+};
+
+int usb_sim_parse(struct usb_sim_config *cfg, const char *spec) {
+    char buf[256], *save = NULL;
+
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->boot = 1;
+    cfg->speed = 1.0;
+    if (spec == NULL)
+        return 0;
+    if (strlen(spec) >= sizeof(buf)) {
+        fprintf(stderr, "Simulator options too long\n");
+        return -1;
+    }
+    strcpy(buf, spec);
+
+    for (char *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *val = strchr(tok, '=');
+        if (val == NULL) {
+            fprintf(stderr, "Simulator option %s needs a value\n", tok);
+            return -1;
+        }
+        *val++ = '\0';
+        if (strcmp(tok, "boot") == 0) {
+            cfg->boot = strtoul(val, NULL, 10) != 0;
+        } else if (strcmp(tok, "speed") == 0) {
+            cfg->speed = strtod(val, NULL);
+        } else if (strcmp(tok, "stall") == 0) {
+            cfg->stall = strtoul(val, NULL, 10);
+        } else if (strcmp(tok, "error") == 0) {
+            cfg->error = strtoul(val, NULL, 10);
+        } else if (strcmp(tok, "short") == 0) {
+            cfg->shortx = strtoul(val, NULL, 10);
+        } else if (strcmp(tok, "pause") == 0) {
+            if (sscanf(val, "%u:%u", &cfg->pause, &cfg->pause_ms) != 2) {
+                fprintf(stderr, "Simulator pause wants N:MS, got %s\n", val);
+                return -1;
+            }
+        } else {
+            fprintf(stderr, "Unknown simulator option %s\n", tok);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+const struct usb_ops *usb_sim_init(const struct usb_sim_config *cfg) {
+    pthread_mutex_lock(&sim.lock);
+    sim.cfg = *cfg;
+    pthread_mutex_unlock(&sim.lock);
+    return &usb_sim;
+}
+
+void usb_sim_get_stats(struct usb_sim_stats *stats) {
+    pthread_mutex_lock(&sim.lock);
+    *stats = sim.stats;
+    pthread_mutex_unlock(&sim.lock);
+}
@@ -0,0 +1,352 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#define _GNU_SOURCE
+#include "vrt.h"
+#include "kernels.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define VRT_TSI_UTC 1
+#define VRT_TSF_REALTIME 2 // fractional timestamp in picoseconds
+#define GSO_MAX_SEGMENTS 64
+#define GSO_MAX_BYTES 65000
+#define SNDBUF_SIZE (8 * 1024 * 1024)
+
+struct vrt_sink {
+    struct vrt_config cfg;
+    int fd;
+    bool gso;
+
+    size_t pkt_bytes;     // size of a full data packet
+    uint8_t *pkts;        // packets of one vrt_send(), pkt_bytes apart
+    size_t max_pkts;
+    size_t *lens;         // length of each built packet
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+    uint8_t *cmsgs;       // one UDP_SEGMENT control message per msg
+
+    unsigned int data_count; // 4 bit packet counters
+    unsigned int ctx_count;
+    bool have_epoch;
+    uint64_t epoch_sec;   // UTC time of sample 0
+    double epoch_frac;    // seconds, [0, 1)
+
+    struct vrt_context last_ctx;
+    bool have_ctx;
+
+    struct vrt_stats stats;
+};
+
+static void put32(uint8_t *p, uint32_t v) {
+    v = htonl(v);
+    memcpy(p, &v, 4);
+}
+
+// Prologue common to data and context packets; returns bytes written
+static size_t put_prologue(struct vrt_sink *sink, uint8_t *p, unsigned int type,
+                           unsigned int *count, size_t words, uint64_t sample_index) {
+    double t = sink->epoch_frac + (double)sample_index / sink->cfg.samplerate;
+    uint64_t sec = (uint64_t)t;
+    uint64_t ps = (uint64_t)((t - (double)sec) * 1e12);
+
+    put32(p, (uint32_t)type << 28 | VRT_TSI_UTC << 22 | VRT_TSF_REALTIME << 20 |
+                 (*count & 0xf) << 16 | (uint32_t)words);
+    put32(p + 4, sink->cfg.stream_id);
+    put32(p + 8, (uint32_t)(sink->epoch_sec + sec));
+    put32(p + 12, (uint32_t)(ps >> 32));
+    put32(p + 16, (uint32_t)ps);
+    *count = (*count + 1) & 0xf;
+    return VRT_HEADER_WORDS * 4;
+}
+
+static void set_epoch(struct vrt_sink *sink, uint64_t sample_index) {
+    struct timespec now;
+    double t;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    t = (double)now.tv_nsec / 1e9 - (double)sample_index / sink->cfg.samplerate;
+    sink->epoch_sec = now.tv_sec + (int64_t)floor(t);
+    sink->epoch_frac = t - floor(t);
+    sink->have_epoch = true;
+}
+
+struct vrt_sink *vrt_open(const char *host, unsigned int port,
+                          const struct vrt_config *cfg) {
+    struct addrinfo hints, *res = NULL;
+    struct vrt_sink *sink;
+    char service[16];
+    int sndbuf = SNDBUF_SIZE;
+
+    sink = calloc(1, sizeof(*sink));
+    if (sink == NULL)
+        return NULL;
+    sink->cfg = *cfg;
+    if (sink->cfg.payload == 0)
+        sink->cfg.payload = VRT_DEFAULT_PAYLOAD;
+    // Payload is padded to whole 32 bit words
+    sink->pkt_bytes = VRT_HEADER_WORDS * 4 + ((sink->cfg.payload * 2 + 3) & ~(size_t)3);
+    sink->fd = -1;
+
+#ifdef UDP_SEGMENT
+    sink->gso = cfg->gso;
+#else
+    if (cfg->gso)
+        fprintf(stderr, "vrt: UDP GSO not supported by this build\n");
+#endif
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    snprintf(service, sizeof(service), "%u", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0 || res == NULL) {
+        fprintf(stderr, "vrt: cannot resolve %s\n", host);
+        goto fail;
+    }
+    sink->fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (sink->fd < 0 || connect(sink->fd, res->ai_addr, res->ai_addrlen) != 0) {
+        fprintf(stderr, "vrt: cannot connect to %s:%u: %s\n", host, port, strerror(errno));
+        goto fail;
+    }
+    setsockopt(sink->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    freeaddrinfo(res);
+    fprintf(stderr, "vrt: sending stream 0x%08x to %s:%u, %u samples per packet%s\n",
+            cfg->stream_id, host, port, sink->cfg.payload, sink->gso ? ", GSO" : "");
+    return sink;
+
+fail:
+    if (res)
+        freeaddrinfo(res);
+    vrt_close(sink);
+    return NULL;
+}
+
+void vrt_close(struct vrt_sink *sink) {
+    if (sink == NULL)
+        return;
+    if (sink->fd >= 0)
+        close(sink->fd);
+    free(sink->pkts);
+    free(sink->lens);
+    free(sink->msgs);
+    free(sink->iovs);
+    free(sink->cmsgs);
+    free(sink);
+}
+
+static int reserve(struct vrt_sink *sink, size_t npkts) {
+    if (npkts <= sink->max_pkts)
+        return 0;
+
+    free(sink->pkts);
+    free(sink->lens);
+    free(sink->msgs);
+    free(sink->iovs);
+    free(sink->cmsgs);
+    sink->pkts = malloc(npkts * sink->pkt_bytes);
+    sink->lens = malloc(npkts * sizeof(size_t));
+    sink->msgs = calloc(npkts, sizeof(struct mmsghdr));
+    sink->iovs = calloc(npkts, sizeof(struct iovec));
+    sink->cmsgs = calloc(npkts, CMSG_SPACE(sizeof(uint16_t)));
+    if (!sink->pkts || !sink->lens || !sink->msgs || !sink->iovs || !sink->cmsgs) {
+        sink->max_pkts = 0;
+        return -1;
+    }
+    sink->max_pkts = npkts;
+    return 0;
+}
+
+/*
+ * Group the built packets into messages: one per packet, or with GSO one
+ * per run of equally sized packets, of which only the last may be short.
+ */
+static unsigned int build_msgs(struct vrt_sink *sink, size_t npkts) {
+    unsigned int nmsgs = 0;
+
+    for (size_t i = 0; i < npkts;) {
+        struct msghdr *mh = &sink->msgs[nmsgs].msg_hdr;
+        size_t first = i, bytes = 0;
+
+        memset(mh, 0, sizeof(*mh));
+        do {
+            bytes += sink->lens[i];
+            i++;
+        } while (sink->gso && i < npkts && i - first < GSO_MAX_SEGMENTS &&
+                 bytes + sink->lens[i] <= GSO_MAX_BYTES &&
+                 sink->lens[i - 1] == sink->pkt_bytes);
+
+        sink->iovs[nmsgs].iov_base = sink->pkts + first * sink->pkt_bytes;
+        sink->iovs[nmsgs].iov_len = bytes;
+        mh->msg_iov = &sink->iovs[nmsgs];
+        mh->msg_iovlen = 1;
+#ifdef UDP_SEGMENT
+        if (sink->gso && i - first > 1) {
+            uint8_t *buf = sink->cmsgs + nmsgs * CMSG_SPACE(sizeof(uint16_t));
+            struct cmsghdr *cm = (struct cmsghdr *)buf;
+            uint16_t seg = (uint16_t)sink->pkt_bytes;
+            mh->msg_control = buf;
+            mh->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            memcpy(CMSG_DATA(cm), &seg, sizeof(seg));
+        }
+#endif
+        nmsgs++;
+    }
+    return nmsgs;
+}
+
+static int send_msgs(struct vrt_sink *sink, unsigned int nmsgs) {
+    unsigned int sent = 0;
+
+    while (sent < nmsgs) {
+        int ret = sendmmsg(sink->fd, sink->msgs + sent, nmsgs - sent, 0);
+        sink->stats.syscalls++;
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            // Kernel or route without GSO support: fall back to plain packets
+            if (sink->gso && (errno == EINVAL || errno == EIO || errno == ENOPROTOOPT)) {
+                fprintf(stderr, "vrt: UDP GSO rejected (%s), disabling\n", strerror(errno));
+                sink->gso = false;
+                return 1;
+            }
+            // Receiver not listening (ICMP unreachable) or buffer full: drop
+            sink->stats.errors++;
+            return -1;
+        }
+        sent += ret;
+    }
+    return 0;
+}
+
+int vrt_send(struct vrt_sink *sink, const int16_t *samples, size_t n,
+             uint64_t sample_index) {
+    size_t npkts = (n + sink->cfg.payload - 1) / sink->cfg.payload;
+    unsigned int nmsgs;
+    int ret;
+
+    if (n == 0)
+        return 0;
+    if (!sink->have_epoch)
+        set_epoch(sink, sample_index);
+    if (reserve(sink, npkts) != 0)
+        return -1;
+
+    for (size_t i = 0; i < npkts; i++) {
+        uint8_t *p = sink->pkts + i * sink->pkt_bytes;
+        size_t off = i * sink->cfg.payload;
+        size_t len = n - off < sink->cfg.payload ? n - off : sink->cfg.payload;
+        size_t words = VRT_HEADER_WORDS + (len * 2 + 3) / 4;
+        p += put_prologue(sink, p, VRT_TYPE_IF_DATA_SID, &sink->data_count, words,
+                          sample_index + off);
+
+        // VRT payloads are big endian
+        uint16_t *dst = (uint16_t *)p;
+        kernel_s16_to_be16(samples + off, dst, len);
+        if (len & 1)
+            dst[len] = 0;
+        sink->lens[i] = words * 4;
+    }
+
+    do {
+        nmsgs = build_msgs(sink, npkts);
+        ret = send_msgs(sink, nmsgs);
+    } while (ret == 1);
+
+    if (ret == 0) {
+        sink->stats.packets += npkts;
+        sink->stats.bytes += n * 2;
+    }
+    return ret;
+}
+
+int vrt_send_context(struct vrt_sink *sink, const struct vrt_context *ctx,
+                     uint64_t sample_index) {
+    uint8_t pkt[10 * 4];
+    uint32_t cif0 = VRT_CIF0_GAIN | VRT_CIF0_SAMPLE_RATE | VRT_CIF0_STATE_EVENT;
+    uint32_t state;
+    uint64_t rate;
+    int16_t gain;
+    size_t off;
+
+    if (!sink->have_epoch)
+        set_epoch(sink, sample_index);
+    if (!sink->have_ctx || memcmp(ctx, &sink->last_ctx, sizeof(*ctx)) != 0)
+        cif0 |= VRT_CIF0_CHANGE;
+    sink->last_ctx = *ctx;
+    sink->have_ctx = true;
+
+    off = put_prologue(sink, pkt, VRT_TYPE_IF_CONTEXT, &sink->ctx_count,
+                       sizeof(pkt) / 4, sample_index);
+    put32(pkt + off, cif0);
+    off += 4;
+
+    // Gain: stage 1 in the low 16 bits, dB with 7 fractional bits
+    gain = (int16_t)lrint(ctx->gain_db * 128);
+    put32(pkt + off, (uint16_t)gain);
+    off += 4;
+
+    // Sample rate: Hz with 20 fractional bits
+    rate = (uint64_t)llrint(ctx->samplerate * (1 << 20));
+    put32(pkt + off, (uint32_t)(rate >> 32));
+    put32(pkt + off + 4, (uint32_t)rate);
+    off += 8;
+
+    state = (VRT_STATE_VALID_DATA | VRT_STATE_SAMPLE_LOSS) << 12;
+    state |= VRT_STATE_VALID_DATA;
+    if (ctx->ref_known) {
+        state |= VRT_STATE_REF_LOCK << 12;
+        if (ctx->ref_locked)
+            state |= VRT_STATE_REF_LOCK;
+    }
+    if (ctx->sample_loss)
+        state |= VRT_STATE_SAMPLE_LOSS;
+    put32(pkt + off, state);
+
+    sink->stats.syscalls++;
+    if (send(sink->fd, pkt, sizeof(pkt), 0) < 0) {
+        sink->stats.errors++;
+        return -1;
+    }
+    sink->stats.packets++;
+    return 0;
+}
+
+void vrt_get_stats(const struct vrt_sink *sink, struct vrt_stats *stats) {
+    *stats = sink->stats;
+}
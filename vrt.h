@@ -0,0 +1,108 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#ifndef VRT_H
+#define VRT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * VITA-49 (VRT) output over UDP. Samples go out as IF data packets with
+ * a stream ID, UTC integer seconds and picosecond fractional timestamps;
+ * context packets carry sample rate, gain and reference lock state.
+ * Packets are sent in batches with sendmmsg(), optionally coalesced with
+ * UDP GSO so that the kernel splits one large send into packets.
+ */
+
+#define VRT_HEADER_WORDS 5      // header, stream ID, TSI, 2 x TSF
+#define VRT_DEFAULT_PAYLOAD 512 // samples per data packet, fits a 1500 byte MTU
+
+// Packet types (header bits 31-28)
+#define VRT_TYPE_IF_DATA_SID 0x1
+#define VRT_TYPE_IF_CONTEXT 0x4
+
+// Context indicator field 0 bits
+#define VRT_CIF0_CHANGE (1u << 31)
+#define VRT_CIF0_GAIN (1u << 23)
+#define VRT_CIF0_SAMPLE_RATE (1u << 21)
+#define VRT_CIF0_STATE_EVENT (1u << 16)
+
+// State and event indicator bits, enable is indicator << 12
+#define VRT_STATE_VALID_DATA (1u << 18)
+#define VRT_STATE_REF_LOCK (1u << 17)
+#define VRT_STATE_SAMPLE_LOSS (1u << 12)
+
+struct vrt_config {
+    uint32_t stream_id;
+    double samplerate;
+    unsigned int payload; // samples per data packet
+    bool gso;             // coalesce packets with UDP_SEGMENT
+};
+
+struct vrt_context {
+    double samplerate;
+    double gain_db;
+    bool ref_known;  // ref_locked is meaningful; the indicator is left disabled otherwise
+    bool ref_locked;
+    bool sample_loss;
+};
+
+struct vrt_stats {
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t syscalls;
+    uint64_t errors;
+};
+
+struct vrt_sink;
+
+struct vrt_sink *vrt_open(const char *host, unsigned int port,
+                          const struct vrt_config *cfg);
+void vrt_close(struct vrt_sink *sink);
+
+/*
+ * Packetize and send n int16 samples starting at stream index
+ * sample_index. The first call fixes the UTC time of sample 0.
+ */
+int vrt_send(struct vrt_sink *sink, const int16_t *samples, size_t n,
+             uint64_t sample_index);
+
+// Send a context packet describing the stream at sample_index
+int vrt_send_context(struct vrt_sink *sink, const struct vrt_context *ctx,
+                     uint64_t sample_index);
+
+void vrt_get_stats(const struct vrt_sink *sink, struct vrt_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
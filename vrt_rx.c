@@ -0,0 +1,283 @@
+/*
+
+Copyright (c) 2021 Ruslan Migirov <trapi78@gmail.com>
+Copyright (c) 2024 David Goncalves <dave@w1euj.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+/*
+ * vrt_rx - receive a VITA-49 stream from rx888_stream --vrt and report
+ * throughput and packet loss. With -g it also generates a synthetic
+ * stream at the given rate through the same sender code, so the whole
+ * path can be measured on loopback without a device.
+ */
+
+#define _GNU_SOURCE
+#include "vrt.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BATCH 64
+#define MAX_PACKET 65536
+#define RCVBUF_SIZE (64 * 1024 * 1024)
+#define GEN_BLOCK 65536 // samples per generated block, one rx888 transfer
+
+static volatile sig_atomic_t stop;
+static unsigned int port = 4991;
+static double gen_rate;
+static bool gen_gso;
+static unsigned int gen_payload = VRT_DEFAULT_PAYLOAD;
+
+static void sig_stop(int signum) {
+    (void)signum;
+    stop = 1;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t get32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return ntohl(v);
+}
+
+// Paced synthetic sender: a ramp, sent in transfer sized blocks
+static void *generator(void *arg) {
+    struct vrt_config cfg = {.stream_id = 1, .samplerate = gen_rate,
+                             .payload = gen_payload, .gso = gen_gso};
+    struct vrt_context ctx = {.samplerate = gen_rate};
+    struct vrt_sink *sink;
+    struct timespec due;
+    int16_t *samples;
+    uint64_t index = 0;
+
+    (void)arg;
+    samples = malloc(GEN_BLOCK * sizeof(int16_t));
+    sink = vrt_open("127.0.0.1", port, &cfg);
+    if (samples == NULL || sink == NULL) {
+        stop = 1;
+        free(samples);
+        return NULL;
+    }
+    for (int i = 0; i < GEN_BLOCK; i++)
+        samples[i] = (int16_t)(i * 7);
+
+    clock_gettime(CLOCK_MONOTONIC, &due);
+    while (!stop) {
+        if (index % (uint64_t)gen_rate < GEN_BLOCK)
+            vrt_send_context(sink, &ctx, index);
+        vrt_send(sink, samples, GEN_BLOCK, index);
+        index += GEN_BLOCK;
+
+        double t = due.tv_nsec + GEN_BLOCK * 1e9 / gen_rate;
+        due.tv_sec += (time_t)(t / 1e9);
+        due.tv_nsec = (long)fmod(t, 1e9);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+    }
+
+    struct vrt_stats st;
+    vrt_get_stats(sink, &st);
+    fprintf(stderr, "generator: %llu packets, %llu syscalls, %.1f packets/syscall\n",
+            (unsigned long long)st.packets, (unsigned long long)st.syscalls,
+            st.syscalls ? (double)st.packets / st.syscalls : 0.0);
+    vrt_close(sink);
+    free(samples);
+    return NULL;
+}
+
+static void printhelp(void) {
+    fprintf(stderr, "Usage: vrt_rx [options]\n");
+    fprintf(stderr, " --port, -p       UDP port, default 4991\n");
+    fprintf(stderr, " --duration, -d   Stop after this many seconds, default run until ^C\n");
+    fprintf(stderr, " --generate, -g   Also send a synthetic stream at this sample rate\n");
+    fprintf(stderr, " --gso, -G        Use UDP GSO for the generated stream\n");
+    fprintf(stderr, " --payload, -n    Samples per generated packet, default 512\n");
+    fprintf(stderr, " --help, -h       Print this help\n");
+}
+
+int main(int argc, char **argv) {
+    static struct option long_options[] = {
+        {"port", required_argument, 0, 'p'},
+        {"duration", required_argument, 0, 'd'},
+        {"generate", required_argument, 0, 'g'},
+        {"gso", no_argument, 0, 'G'},
+        {"payload", required_argument, 0, 'n'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}};
+    struct mmsghdr msgs[BATCH];
+    struct iovec iovs[BATCH];
+    uint8_t *bufs;
+    double duration = 0;
+    pthread_t gen;
+    int c, fd;
+
+    while ((c = getopt_long(argc, argv, "p:d:g:Gn:h", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'p':
+            port = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            duration = strtod(optarg, NULL);
+            break;
+        case 'g':
+            gen_rate = strtod(optarg, NULL);
+            break;
+        case 'G':
+            gen_gso = true;
+            break;
+        case 'n':
+            gen_payload = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            printhelp();
+            return 0;
+        }
+    }
+
+    signal(SIGINT, sig_stop);
+    signal(SIGTERM, sig_stop);
+
+    struct sockaddr_in local = {.sin_family = AF_INET, .sin_port = htons(port)};
+    int rcvbuf = RCVBUF_SIZE;
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (bind(fd, (struct sockaddr *)&local, sizeof(local)) != 0) {
+        fprintf(stderr, "cannot bind port %u: %s\n", port, strerror(errno));
+        return 1;
+    }
+    struct timeval tv = {0, 100000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    bufs = malloc(BATCH * MAX_PACKET);
+    if (bufs == NULL)
+        return 1;
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < BATCH; i++) {
+        iovs[i].iov_base = bufs + i * MAX_PACKET;
+        iovs[i].iov_len = MAX_PACKET;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    if (gen_rate > 0 && pthread_create(&gen, NULL, generator, NULL) != 0) {
+        fprintf(stderr, "cannot start generator\n");
+        return 1;
+    }
+
+    double samplerate = 0;       // from context packets
+    bool have_last = false;
+    unsigned int last_count = 0;
+    uint32_t sec0 = 0;
+    double last_t = 0, last_len = 0;
+    uint64_t packets = 0, samples = 0, lost = 0, syscalls = 0;
+    uint64_t int_packets = 0, int_samples = 0, int_lost = 0;
+    double start = now(), tick = start;
+
+    while (!stop && (duration <= 0 || now() - start < duration)) {
+        int n = recvmmsg(fd, msgs, BATCH, MSG_WAITFORONE, NULL);
+        syscalls++;
+        for (int i = 0; i < n; i++) {
+            const uint8_t *p = iovs[i].iov_base;
+            if (msgs[i].msg_len < VRT_HEADER_WORDS * 4)
+                continue;
+            uint32_t hdr = get32(p);
+            unsigned int type = hdr >> 28;
+            if (!have_last)
+                sec0 = get32(p + 8);
+            double t = (double)(get32(p + 8) - sec0) +
+                       (((uint64_t)get32(p + 12) << 32) | get32(p + 16)) / 1e12;
+
+            if (type == VRT_TYPE_IF_CONTEXT && msgs[i].msg_len >= 40) {
+                uint64_t rate = ((uint64_t)get32(p + 28) << 32) | get32(p + 32);
+                samplerate = rate / (double)(1 << 20);
+                continue;
+            }
+            if (type != VRT_TYPE_IF_DATA_SID)
+                continue;
+
+            unsigned int count = (hdr >> 16) & 0xf;
+            size_t len = ((hdr & 0xffff) - VRT_HEADER_WORDS) * 2;
+            if (have_last) {
+                uint64_t missed = (count - last_count - 1) & 0xf;
+                // The 4 bit counter wraps; use the timestamps for long gaps
+                if (samplerate > 0) {
+                    double gap = (t - last_t) * samplerate - last_len;
+                    if (gap > 0.5 && len > 0)
+                        missed = (uint64_t)llround(gap / len);
+                }
+                int_lost += missed;
+            }
+            have_last = true;
+            last_count = count;
+            last_t = t;
+            last_len = len;
+            int_packets++;
+            int_samples += len;
+        }
+
+        double t = now();
+        if (t - tick >= 1.0) {
+            double dt = t - tick;
+            fprintf(stderr, "%8.1f MS/s %8.0f packets/s  lost %llu (%.4f%%)\n",
+                    int_samples / dt / 1e6, int_packets / dt,
+                    (unsigned long long)int_lost,
+                    int_packets ? 100.0 * int_lost / (int_packets + int_lost) : 0.0);
+            packets += int_packets;
+            samples += int_samples;
+            lost += int_lost;
+            int_packets = int_samples = int_lost = 0;
+            tick = t;
+        }
+    }
+    stop = 1;
+    if (gen_rate > 0)
+        pthread_join(gen, NULL);
+
+    packets += int_packets;
+    samples += int_samples;
+    lost += int_lost;
+    double elapsed = now() - start;
+    printf("{\"packets\": %llu, \"lost\": %llu, \"loss_pct\": %.6f, \"msps\": %.3f, "
+           "\"packets_per_syscall\": %.2f}\n",
+           (unsigned long long)packets, (unsigned long long)lost,
+           packets ? 100.0 * lost / (packets + lost) : 0.0, samples / elapsed / 1e6,
+           syscalls ? (double)packets / syscalls : 0.0);
+
+    free(bufs);
+    close(fd);
+    return 0;
+}